@@ -5,6 +5,7 @@
 #include "../rt/common/simpleApp.h"
 #include "../rt/common/first-person-controller.h"
 #include "../rt/common/recorder.h"
+#include "../rt/common/readback-ring.h"
 #include <GLFW/glfw3.h>
 #include <functional>
 #include <regex>
@@ -81,7 +82,10 @@ public:
         });
 
         // Pass recording path if any.
-        if (o.recordPath.size() > 0) { _recorder.setOutputPath(o.recordPath); }
+        if (o.recordPath.size() > 0) {
+            _recorder.setOutputPath(o.recordPath);
+            frameRecorded.connect([this](const SimpleRenderLoop::RecordParameters & rp, VkImageLayout layout) { readbackFrame(rp, layout); });
+        }
     }
 
     void run() {
@@ -95,8 +99,9 @@ public:
             bool running = true;
             while (running) {
                 running &= render();
-                running &= recordFrame(VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+                running &= recordFrame();
             }
+            flushRecording();
             return;
         }
 
@@ -145,16 +150,19 @@ public:
             } else {
                 // deal with possible window resizing
                 if (newWidnowSize.width != windowsize.width || newWidnowSize.height != windowsize.height) {
+                    // frames pending in the readback ring belong to the old render loop.
+                    flushRecording();
                     resize(_window, newWidnowSize.width, newWidnowSize.height);
                     windowsize = newWidnowSize;
                 }
                 running = render();
-                recordFrame(VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+                recordFrame();
             }
 
             // poll window system events
             glfwPollEvents();
         }
+        flushRecording();
     }
 
 protected:
@@ -175,26 +183,44 @@ private:
 
     /// Used to record application screen to video or a series of images.
     Recorder _recorder;
-    size_t   _recorded = 0;
-
-    /// Records current draw to an image.
-    bool recordFrame(VkImageLayout layout) {
-        // If we are recording.
-        auto & loop    = this->loop();
-        bool   running = true;
-        if (_options.recordPath.size() > 0 && loop.frameCounter() >= _options.recordStartFrame) {
-            // Write the image to the recorder.
-            _recorder.write(readCurrentFrame(layout), loop.frameCounter());
-            if (++_recorded == _options.recordFrameCount) running = false;
+    size_t   _recorded = 0; ///< number of frames read back so far.
+
+    /// Reads back recorded frames without waiting for GPU. Created on first use.
+    std::unique_ptr<ReadbackRing> _readback;
+
+    std::chrono::high_resolution_clock::time_point _recordStartTime;
+
+    bool recording() const { return _options.recordFrameCount == 0 || _recorded < _options.recordFrameCount; }
+
+    /// Records command to copy current back buffer to the readback ring. Called right before the frame is submitted.
+    void readbackFrame(const SimpleRenderLoop::RecordParameters & rp, VkImageLayout layout) {
+        auto & loop = this->loop();
+        if (!recording() || loop.frameCounter() < _options.recordStartFrame) return;
+        if (!_readback) {
+            // One more slot than in-flight frames, so a slot is always free by the time the frame is recorded.
+            _readback.reset(new ReadbackRing(dev().vgi(), loop.cp().maxInFlightFrames + 1));
+            _recordStartTime = std::chrono::high_resolution_clock::now();
         }
-        return running;
+        const auto & bb = sw().backBuffer(rp.backBufferIndex);
+        _readback->cmdReadback(loop, rp.cb, bb.image, layout, bb.format, bb.extent.width, bb.extent.height, loop.frameCounter());
+        ++_recorded;
+    }
+
+    /// Sends frames that are done by GPU to the recorder.
+    /// @return false, if all frames requested by the options have been read back.
+    bool recordFrame() {
+        if (_readback) _readback->drain([&](ph::RawImage && image, uint64_t frameIndex) { _recorder.write(std::move(image), frameIndex); });
+        return recording();
     }
 
-    /// @param layout the back buffer layout.
-    /// @return raw image read from current frame.
-    ph::RawImage readCurrentFrame(VkImageLayout layout) {
-        return readBaseImagePixels(dev().graphicsQ(), sw().backBuffer(sw().activeBackBufferIndex()).image, layout, sw().initParameters().colorFormat,
-                                   sw().initParameters().width, sw().initParameters().height);
+    /// Waits for GPU and sends all pending frames to the recorder.
+    void flushRecording() {
+        if (!_readback) return;
+        dev().waitIdle();
+        _readback->flush([&](ph::RawImage && image, uint64_t frameIndex) { _recorder.write(std::move(image), frameIndex); });
+        auto seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - _recordStartTime).count();
+        PH_LOGI("%zu frames read back in %.2f seconds (%.1f fps), %llu stalls.", _recorded, seconds, seconds > 0 ? _recorded / seconds : 0.0,
+                (unsigned long long) _readback->stats().stalls);
     }
 };
 
@@ -271,12 +297,19 @@ inline void run(const DesktopApp::Options & dao, ARGS... args) {
                                  "       <0: accumulate for N seconds.\n"                                                       \
                                  "   Default is accumulating for %d frames.",                                                   \
                                  o.accum));                                                                                     \
+    app.add_option("--batched-skinning", o.batchedSkinning, "Skin all meshes with a few batched dispatches. Default is on.");   \
+    app.add_flag("--blend-animations", o.blendAnimations, "Blend animations of a model through the animation mixer.");          \
     app.add_option("--camera", o.activeCamera, "Select active camera. Default is 0.");                                          \
+    app.add_flag("--cpu-morph", o.cpuMorphTargets, "Apply morph targets on CPU worker threads, not the compute shader.");       \
+    app.add_flag("--cpu-skinning", o.cpuSkinning, "Skin meshes on CPU worker threads, instead of the compute shader.");         \
     app.add_option("--db,--max-diffuse-bounces", o.diffBounces, "Specify maximum diffuse bounces.");                            \
+    app.add_flag("--dq-skinning", o.dualQuaternionSkinning, "Skin meshes with dual quaternions, instead of linear blending.");  \
     app.add_flag("--flythrough", o.flythroughCamera, "Use flythrough, instead of orbital, camera.");                            \
     app.add_flag("-l,--left-handed", o.leftHanded,                                                                              \
                  ph::formatstr("Specify the handedness of the coordinate system from which the geometry data is based off of. " \
                                "Default is a right-handed configuration."));                                                    \
+    app.add_option("--parallel-loading", o.parallelAssetConversion, "Convert scene assets on worker threads. Default is on.");  \
+    app.add_flag("--quantized-morph", o.quantizedMorphTargets, "Store morph targets as 10-bit integers, not half floats.");     \
     app.add_option("-r,--render-pack", o.rpmode,                                                                                \
                    ph::formatstr("Select render pack mode. Default is %d.\n"                                                    \
                                  "       0 : Rasterize.\n"                                                                      \
@@ -294,8 +327,17 @@ inline void run(const DesktopApp::Options & dao, ARGS... args) {
                                  "       4 : ray traced shadows with alpha-blended transparency.\n",                            \
                                  o.shadowMode));                                                                                \
     app.add_option("--sb,--max-specular-bounces", o.specBounces, "Specify maximum specular bounces.");                          \
+    app.add_option("--scene-graph-mode", o.sceneGraphMode,                                                                      \
+                   ph::formatstr("Select how scene graph updates world transforms. Default is %d.\n"                            \
+                                 "       0 : Hierarchical. Lazily update each node by walking its parent chain.\n"              \
+                                 "       1 : Flat. Update all dirty nodes in one linear pass over SoA arrays.\n"                \
+                                 "       2 : Parallel. Update dirty subtrees concurrently on worker threads.\n",                \
+                                 o.sceneGraphMode));                                                                            \
     app.add_option("--show-ui", o.showUI, "Specify visibility of UI window. Default is on.");                                   \
-    app.add_option("--spp", o.spp, ph::formatstr("Samples per pixel per frame. Default is %d.", o.spp));
+    app.add_option("--spp", o.spp, ph::formatstr("Samples per pixel per frame. Default is %d.", o.spp));                        \
+    app.add_option("--texture-budget", o.textureBudgetMB, "GPU memory budget of textures, in MB. Default is 0, no limit.");     \
+    app.add_option("--texture-upload-budget", o.textureUploadBudgetMB,                                                          \
+                   "Texture mip levels uploaded per frame, in MB. Default is 0, no limit: all levels are uploaded at once.");
 
 // ---------------------------------------------------------------------------------------------------------------------
 /// Setup common command line options (required CLI11 library)
@@ -0,0 +1,158 @@
+/*****************************************************************************
+ * Copyright (C) 2020 - 2024 OPPO. All rights reserved.
+ *******************************************************************************/
+
+/**
+ *
+ */
+#include "pch.h"
+#include "animation-mixer.h"
+#include "root-transform-channel.h"
+
+#include <limits>
+#include <queue>
+#include <unordered_set>
+
+namespace animations {
+
+size_t AnimationMixer::addLayer(std::shared_ptr<Timeline> timeline, BlendMode mode, float weight) {
+    PH_REQUIRE(timeline);
+
+    Layer layer;
+    layer.timeline = timeline;
+    layer.mode     = mode;
+    layer.weight   = std::clamp(weight, 0.0f, 1.0f);
+
+    // Bind all transform channels of the timeline to node slots.
+    for (const auto & c : timeline->getChannels()) {
+        auto channel = dynamic_cast<TransformChannel *>(c.get());
+
+        // Root transform channels work in root space. Leave them alone.
+        if (!channel || dynamic_cast<RootTransformChannel *>(channel)) continue;
+
+        sg::Node * node = channel->getTarget();
+        auto       iter = _nodeToSlot.find(node);
+        uint32_t   slot;
+        if (iter != _nodeToSlot.end()) {
+            slot = iter->second;
+        } else {
+            // First time seeing this node. Its rest pose is the one the channel started from.
+            slot = (uint32_t) _nodes.size();
+            _nodes.push_back(node);
+            _nodeToSlot[node] = slot;
+            _rest.push_back({channel->getTranslation(), channel->getRotation(), channel->getScale()});
+
+            // Make sure the node is written on the first tick.
+            Pose unknown = _rest.back();
+            unknown.translation.setConstant(std::numeric_limits<float>::quiet_NaN());
+            _written.push_back(unknown);
+        }
+
+        // From now on, the mixer is in charge of the node transform.
+        channel->setApplyToTarget(false);
+        layer.bindings.push_back({slot, channel, 1.0f});
+    }
+
+    // Sample the first frame as the reference pose of additive layers.
+    if (BlendMode::ADDITIVE == mode) {
+        timeline->setTime(timeline->getStart());
+        for (const auto & b : layer.bindings) layer.reference.push_back({b.channel->getTranslation(), b.channel->getRotation(), b.channel->getScale()});
+    }
+
+    _layers.push_back(std::move(layer));
+    return _layers.size() - 1;
+}
+
+void AnimationMixer::setMask(size_t layer, const std::vector<const sg::Node *> & nodes) {
+    PH_REQUIRE(layer < _layers.size());
+    std::unordered_set<const sg::Node *> allowed(nodes.begin(), nodes.end());
+    for (auto & b : _layers[layer].bindings) b.mask = (allowed.empty() || allowed.count(_nodes[b.slot])) ? 1.0f : 0.0f;
+}
+
+std::vector<const sg::Node *> AnimationMixer::subtree(const sg::Node * root) {
+    std::vector<const sg::Node *> result;
+    if (!root) return result;
+    std::queue<const sg::Node *> pending;
+    pending.push(root);
+    while (!pending.empty()) {
+        auto n = pending.front();
+        pending.pop();
+        result.push_back(n);
+        for (auto c : n->children()) pending.push(c);
+    }
+    return result;
+}
+
+void AnimationMixer::clear() {
+    for (auto & l : _layers)
+        for (auto & b : l.bindings) b.channel->setApplyToTarget(true);
+    _layers.clear();
+    _nodes.clear();
+    _nodeToSlot.clear();
+    _rest.clear();
+    _pose.clear();
+    _written.clear();
+}
+
+void AnimationMixer::tick(std::chrono::duration<uint64_t, std::nano> elapsedTime) {
+    // Sample all layers. Transform channels only store the samples, without touching the nodes.
+    for (auto & l : _layers) l.timeline->tick(elapsedTime);
+
+    apply();
+}
+
+void AnimationMixer::apply() {
+    // Start from the rest pose.
+    _pose = _rest;
+
+    // Blend layers from bottom to top.
+    for (const auto & l : _layers) {
+        if (l.weight <= 0.0f) continue;
+        for (size_t i = 0; i < l.bindings.size(); ++i) {
+            const auto & b = l.bindings[i];
+            const float  w = l.weight * b.mask;
+            if (w <= 0.0f) continue;
+
+            auto &       pose        = _pose[b.slot];
+            const auto & translation = b.channel->getTranslation();
+            const auto & rotation    = b.channel->getRotation();
+            const auto & scale       = b.channel->getScale();
+
+            if (BlendMode::OVERRIDE == l.mode) {
+                if (w >= 1.0f) {
+                    pose = {translation, rotation, scale};
+                } else {
+                    pose.translation += w * (translation - pose.translation);
+                    pose.scale       += w * (scale - pose.scale);
+                    pose.rotation     = pose.rotation.slerp(w, rotation);
+                }
+            } else {
+                // Add the difference to the reference pose. Scale difference is a ratio, which is 1 where the
+                // reference scale is zero.
+                const auto &   ref   = l.reference[i];
+                Eigen::Array3f ratio = (ref.scale.array() != 0.0f).select(scale.array() / ref.scale.array(), 1.0f);
+                pose.translation += w * (translation - ref.translation);
+                pose.rotation     = (pose.rotation * Eigen::Quaternionf::Identity().slerp(w, ref.rotation.conjugate() * rotation)).normalized();
+                pose.scale        = pose.scale.cwiseProduct((1.0f + w * (ratio - 1.0f)).matrix());
+            }
+        }
+    }
+
+    // Write each node once, and only when its pose changed.
+    for (size_t slot = 0; slot < _nodes.size(); ++slot) {
+        const auto & pose    = _pose[slot];
+        auto &       written = _written[slot];
+        if (pose.translation == written.translation && pose.rotation.coeffs() == written.rotation.coeffs() && pose.scale == written.scale) continue;
+
+        // Combine everything into the transform by order of translate, rotate, scale. Same as TransformChannel.
+        sg::Transform nodeTransform = sg::Transform::Identity();
+        nodeTransform.translate(pose.translation);
+        nodeTransform.rotate(pose.rotation);
+        nodeTransform.scale(pose.scale);
+        _nodes[slot]->setTransform(nodeTransform);
+
+        written = pose;
+    }
+}
+
+} // namespace animations
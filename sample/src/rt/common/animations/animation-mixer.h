@@ -0,0 +1,185 @@
+/*****************************************************************************
+ * Copyright (C) 2020 - 2024 OPPO. All rights reserved.
+ *******************************************************************************/
+
+/**
+ *
+ */
+#pragma once
+
+#include <ph/rt-utils.h>
+
+#include "timeline.h"
+#include "transform-channel.h"
+
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace animations {
+
+/**
+ * Plays several timelines at once and blends their results into one pose.
+ *
+ * Timelines added to the mixer no longer write node transforms themselves:
+ * their transform channels only hold the sampled translation, rotation and
+ * scale. On every tick, the mixer blends the samples of all layers, in the
+ * order they were added, then writes the transform of each animated node
+ * exactly once. Nodes whose blended pose didn't change since the last tick
+ * are not touched at all, so they don't dirty their subtree.
+ *
+ * Each layer has a blend mode, a weight and an optional node mask:
+ * - OVERRIDE layers blend from the pose below them toward their own sample.
+ *   With weight 1 they replace it, which is what happens without the mixer
+ *   when timelines are ticked one after another.
+ * - ADDITIVE layers add the difference between their sample and their
+ *   reference pose (the first frame of the timeline) to the pose below
+ *   them, e.g. an idle breathing clip on top of a walk cycle.
+ * - Masks restrict a layer to a set of nodes, e.g. an upper body override:
+ *   mixer.setMask(layer, AnimationMixer::subtree(spine)).
+ *
+ * Nodes start from their rest pose, which is the pose they had when first
+ * added to the mixer. Only plain TransformChannels are mixed. Other channels,
+ * like weight channels and root transform channels, still apply their values
+ * directly. A timeline in the mixer should not be ticked anywhere else.
+ */
+class AnimationMixer {
+public:
+    /**
+     * How a layer is combined with the layers below it.
+     */
+    enum class BlendMode {
+        OVERRIDE,
+        ADDITIVE,
+    };
+
+    /**
+     *
+     */
+    AnimationMixer() = default;
+
+    /**
+     * Gives control of the node transforms back to the timelines.
+     */
+    virtual ~AnimationMixer() { clear(); }
+
+    PH_NO_COPY(AnimationMixer);
+
+    /**
+     * Adds a timeline on top of the existing layers.
+     * @param timeline The timeline to play.
+     * @param mode How the timeline is combined with the layers below it.
+     * @param weight Blend weight in range [0, 1].
+     * @return Index of the new layer.
+     */
+    size_t addLayer(std::shared_ptr<Timeline> timeline, BlendMode mode = BlendMode::OVERRIDE, float weight = 1.0f);
+
+    /**
+     * @return Number of layers.
+     */
+    size_t getLayerCount() const { return _layers.size(); }
+
+    /**
+     * @return The timeline played by the layer.
+     */
+    const std::shared_ptr<Timeline> & getTimeline(size_t layer) const {
+        PH_REQUIRE(layer < _layers.size());
+        return _layers[layer].timeline;
+    }
+
+    /**
+     * @return Blend weight of the layer.
+     */
+    float getWeight(size_t layer) const {
+        PH_REQUIRE(layer < _layers.size());
+        return _layers[layer].weight;
+    }
+
+    /**
+     * @param weight Blend weight of the layer, in range [0, 1]. A layer with zero weight is still ticked, but not blended.
+     */
+    void setWeight(size_t layer, float weight) {
+        PH_REQUIRE(layer < _layers.size());
+        _layers[layer].weight = std::clamp(weight, 0.0f, 1.0f);
+    }
+
+    /**
+     * Restricts the layer to the given nodes.
+     * @param nodes The nodes the layer is allowed to animate. Empty means all nodes.
+     */
+    void setMask(size_t layer, const std::vector<const sg::Node *> & nodes);
+
+    /**
+     * @return The given node and all of its descendants. Handy to build a mask.
+     */
+    static std::vector<const sg::Node *> subtree(const sg::Node * root);
+
+    /**
+     * Removes all layers, and gives control of the node transforms back to the timelines.
+     */
+    void clear();
+
+    /**
+     * Ticks all timelines, then blends and applies the results to the nodes.
+     * @param elapsedTime Amount to add to the time of each timeline.
+     */
+    void tick(std::chrono::duration<uint64_t, std::nano> elapsedTime);
+
+    /**
+     * Blends the current samples of all layers and applies the results to the nodes, without ticking the timelines.
+     * Call this after setting the time of the timelines manually.
+     */
+    void apply();
+
+private:
+    /**
+     * Decomposed transform of a node.
+     */
+    struct Pose {
+        Eigen::Vector3f    translation;
+        Eigen::Quaternionf rotation;
+        Eigen::Vector3f    scale;
+    };
+
+    using PoseArray = std::vector<Pose, Eigen::aligned_allocator<Pose>>;
+
+    /**
+     * A transform channel of a layer's timeline, bound to a node slot of the mixer.
+     */
+    struct Binding {
+        uint32_t           slot;
+        TransformChannel * channel;
+        float              mask; ///< 1 if the layer is allowed to animate the node, 0 otherwise.
+    };
+
+    /**
+     *
+     */
+    struct Layer {
+        std::shared_ptr<Timeline> timeline;
+        BlendMode                 mode;
+        float                     weight;
+        std::vector<Binding>      bindings;
+        PoseArray                 reference; ///< pose of each binding at the first frame. Used by additive layers only.
+    };
+
+    /**
+     * All layers, from bottom to top.
+     */
+    std::vector<Layer> _layers;
+
+    /**
+     * All nodes animated by any layer, and their slot in the pose buffers.
+     */
+    std::vector<sg::Node *>                        _nodes;
+    std::unordered_map<const sg::Node *, uint32_t> _nodeToSlot;
+
+    /**
+     * Pose buffers, one pose per slot: the rest pose, the blended pose of the current tick,
+     * and the pose that was written to the node last time.
+     */
+    PoseArray _rest, _pose, _written;
+};
+
+} // namespace animations
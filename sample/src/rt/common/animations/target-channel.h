@@ -16,6 +16,7 @@
 #include <chrono>
 #include <cstdint>
 #include <unordered_map>
+#include <vector>
 
 namespace animations {
 
@@ -48,8 +49,16 @@ public:
     /**
      * @return A sorted map, mapping times to the value target should
      * be at each time.
+     *
+     * The map is the source of truth of the channel. Calling this method
+     * invalidates the baked keys, which are then rebuilt from the map on
+     * next evaluation. So always call this method again to modify the keys,
+     * instead of holding on to the returned reference.
      */
-    std::map<std::chrono::duration<uint64_t, std::nano>, std::shared_ptr<KeyValue<T>>> & getTimeToKeyValue() { return _timeToKeyValue; }
+    std::map<std::chrono::duration<uint64_t, std::nano>, std::shared_ptr<KeyValue<T>>> & getTimeToKeyValue() {
+        _baked.dirty = true;
+        return _timeToKeyValue;
+    }
 
     /**
      * Calculates what the value will be at a given time using the key values.
@@ -57,41 +66,31 @@ public:
      * @param value Reference is set to the value for time.
      * This will be unmodified if timeToKeyValue is empty.
      *
-     * \TODO this method is extremely slow when the scene has lots of animations, primarily due to calling of std::map::upper_bound()
-     *  and std::map::lower_bound(). Optimize it for continuously increasing time values.
-     *
+     * Evaluation runs on the baked keys. Lookup is O(1) when time is
+     * increasing continuously, which is the case of normal playback.
      */
     void getValueAtTime(std::chrono::duration<uint64_t, std::nano> time, T & value) {
-        // If map of key values is empty, there is nothing to be done.
-        if (_timeToKeyValue.empty()) { return; }
+        // Rebuild the baked keys, if key values have been touched since last evaluation.
+        if (_baked.dirty) bake();
 
-        // Get the upper bound, that is, the first key value greater than time.
-        auto upperBoundIterator = _timeToKeyValue.upper_bound(time);
+        // If there are no key values, there is nothing to be done.
+        const size_t count = _baked.times.size();
+        if (0 == count) { return; }
 
-        // If time has reached or passed the last value.
-        if (upperBoundIterator == _timeToKeyValue.end()) {
-            // Fetch the last key value in the animation.
-            auto lastValueIterator = std::prev(upperBoundIterator);
-
-            // Set interpolated to the last value of the animation.
-            value = lastValueIterator->second->getEndValue();
-
-            // If time has not yet passed the last value.
+        // Get the upper bound, that is, the first key value greater than time.
+        size_t upper = findUpperKey(time);
+
+        if (upper == count) {
+            // If time has reached or passed the last value, use the last value of the animation.
+            value = _baked.values[count - 1];
+        } else if (upper == 0) {
+            // If we haven't even reached the first key, use the first value of the animation.
+            value = _baked.values[0];
         } else {
-            // If we haven't even reached the first key.
-            if (upperBoundIterator == _timeToKeyValue.begin()) {
-                // The first key value is the starting value of the animation.
-                // Since we are before it, initialize value to it.
-                value = upperBoundIterator->second->getEndValue();
-
-                // If we are between two key values.
-            } else {
-                // Get the lower bound, which would be the one just before the upper bound.
-                auto lowerBoundIterator = std::prev(upperBoundIterator);
-
-                // Interpolate the value between the lower and upper key values.
-                interpolateIterators(lowerBoundIterator, upperBoundIterator, time, value);
-            }
+            // If we are between two key values, interpolate the value between them.
+            // The interpolator of the upper key handles the interpolation.
+            float normalizedTime = normalizeTime(_baked.times[upper - 1], _baked.times[upper], time);
+            _baked.interpolators[upper]->interpolate(_baked.values[upper - 1], _baked.values[upper], normalizedTime, value);
         }
     }
 
@@ -150,31 +149,6 @@ protected:
         return relativeTime / totalTime;
     }
 
-    /**
-     * Calculates the interpolated value between two iterators in the key value map.
-     * @param start The previous keyframe.
-     * @param end The next keyframe.
-     * @param time A time relative to the range start and endtime that we want
-     * to get the interpolated value for.
-     * @param interpolated Will be assigned the result of the operation,
-     * the interpolated result relative to the 2 keys that parameter time represents.
-     * @param <KeyValueIterator> Iterator type used to iterate key values.
-     */
-    template<class KeyValueIterator>
-    static void interpolateIterators(KeyValueIterator start, KeyValueIterator end, std::chrono::duration<uint64_t, std::nano> time, T & interpolated) {
-        // Fetch the upper key value since that is what will be handling the interpolation
-        // and will therefore be used more than once in this function.
-        KeyValue<T> * endKeyValue = end->second.get();
-
-        // Calculate the interpolated value.
-        // Calculate normalized time.
-        float normalizedTime = normalizeTime(start->first, end->first, time);
-
-        // Use the interpolator to calculate the interpolated value
-        // and save it to the value variable.
-        endKeyValue->getInterpolator()->interpolate(start->second->getEndValue(), endKeyValue->getEndValue(), normalizedTime, interpolated);
-    }
-
 private:
     /**
      * The item being updated by the animation.
@@ -187,6 +161,59 @@ private:
      * be at each time.
      */
     std::map<std::chrono::duration<uint64_t, std::nano>, std::shared_ptr<KeyValue<T>>> _timeToKeyValue;
+
+    /**
+     * Key values flattened into contiguous arrays, indexed by key.
+     * Built from timeToKeyValue on demand.
+     */
+    struct BakedKeys {
+        std::vector<std::chrono::duration<uint64_t, std::nano>> times;
+        std::vector<T, Eigen::aligned_allocator<T>>             values;
+        std::vector<std::shared_ptr<Interpolator<T>>>           interpolators; ///< interpolator of each key. Used for the segment ending at the key.
+        size_t                                                  cursor = 0;    ///< upper key of the last evaluation.
+        bool                                                    dirty  = true;
+    };
+
+    BakedKeys _baked;
+
+    /**
+     * Rebuilds the baked keys from timeToKeyValue.
+     */
+    void bake() {
+        _baked.times.clear();
+        _baked.values.clear();
+        _baked.interpolators.clear();
+        _baked.times.reserve(_timeToKeyValue.size());
+        _baked.values.reserve(_timeToKeyValue.size());
+        _baked.interpolators.reserve(_timeToKeyValue.size());
+        for (auto & [time, keyValue] : _timeToKeyValue) {
+            _baked.times.push_back(time);
+            _baked.values.push_back(keyValue->getEndValue());
+            _baked.interpolators.push_back(keyValue->getInterpolator());
+        }
+        _baked.cursor = 0;
+        _baked.dirty  = false;
+    }
+
+    /**
+     * @return Index of the first baked key with time greater than the given time,
+     * or number of keys if there's no such key.
+     */
+    size_t findUpperKey(std::chrono::duration<uint64_t, std::nano> time) {
+        const auto & times  = _baked.times;
+        size_t       cursor = _baked.cursor;
+
+        // Fast path: time is still in the last evaluated segment, or a few segments after it.
+        if (0 == cursor || times[cursor - 1] <= time) {
+            for (int i = 0; i < 4 && cursor < times.size() && times[cursor] <= time; ++i) ++cursor;
+            if (cursor == times.size() || times[cursor] > time) return _baked.cursor = cursor;
+        }
+
+        // Slow path: time jumped backward, or too far forward. Binary search the contiguous array.
+        cursor        = (size_t) (std::upper_bound(times.begin(), times.end(), time) - times.begin());
+        _baked.cursor = cursor;
+        return cursor;
+    }
 };
 
 } // namespace animations
@@ -33,6 +33,9 @@ TransformChannel::TransformChannel(sg::Node * target, const Eigen::Vector3f & tr
 }
 
 void TransformChannel::setTime(std::chrono::duration<uint64_t, std::nano>) {
+    // Someone else is in charge of the target.
+    if (!_applyToTarget) return;
+
     // Calculate the node transform from the separated transforms.
     // Make sure the transform is initialized to identity.
     sg::Transform nodeTransform = sg::Transform::Identity();
@@ -95,6 +95,18 @@ public:
      */
     void setScale(const Eigen::Vector3f & scale) { _scale = scale; }
 
+    /**
+     * @return Whether the channel writes its values to the target node on every tick.
+     */
+    bool getApplyToTarget() const { return _applyToTarget; }
+
+    /**
+     * @param applyToTarget If false, the channel only holds the sampled values and leaves
+     * the target node untouched. This is used by AnimationMixer, which blends values from
+     * several channels before writing the node transform.
+     */
+    void setApplyToTarget(bool applyToTarget) { _applyToTarget = applyToTarget; }
+
     /**
      * This will simply set the target to the current values of the transform.
      */
@@ -121,6 +133,11 @@ private:
      * Scale the target will be set to.
      */
     Eigen::Vector3f _scale;
+
+    /**
+     * Whether values are written to the target on every tick.
+     */
+    bool _applyToTarget = true;
 };
 
 } // namespace animations
@@ -0,0 +1,230 @@
+/*****************************************************************************
+ * Copyright (C) 2020 - 2024 OPPO. All rights reserved.
+ *******************************************************************************/
+
+/**
+ *
+ */
+#include "pch.h"
+#include "transform-track-set.h"
+
+#include <algorithm>
+
+namespace animations {
+
+/**
+ * @return Index of the first key with time greater than the given time, or count if there's no such key.
+ * The search starts from the cursor, which is the result of the previous search, so playing forward is O(1).
+ */
+static uint32_t findUpperKey(const std::chrono::duration<uint64_t, std::nano> * times, uint32_t count, uint32_t cursor,
+                             std::chrono::duration<uint64_t, std::nano> time) {
+    // Fast path: time is still in the last evaluated segment, or a few segments after it.
+    if (0 == cursor || times[cursor - 1] <= time) {
+        for (int i = 0; i < 4 && cursor < count && times[cursor] <= time; ++i) ++cursor;
+        if (cursor == count || times[cursor] > time) return cursor;
+    }
+
+    // Slow path: binary search.
+    return (uint32_t) (std::upper_bound(times, times + count, time) - times);
+}
+
+/**
+ * Same as TargetChannel::normalizeTime().
+ */
+static float normalizeTime(std::chrono::duration<uint64_t, std::nano> startTime, std::chrono::duration<uint64_t, std::nano> endTime,
+                           std::chrono::duration<uint64_t, std::nano> time) {
+    std::chrono::duration<float, std::nano> totalTime    = (endTime - startTime);
+    std::chrono::duration<float, std::nano> relativeTime = (time - startTime);
+    return relativeTime / totalTime;
+}
+
+void TransformTrackSet::addTrack(TransformChannel * target, Property property, Interpolation interpolation,
+                                 const std::vector<std::chrono::duration<uint64_t, std::nano>> & times, const std::vector<float> & values) {
+    PH_REQUIRE(target);
+    if (times.empty()) return;
+
+    const size_t components    = (Property::ROTATION == property) ? 4 : 3;
+    const size_t valuesPerKey  = (Interpolation::CUBIC_SPLINE == interpolation) ? 3 : 1;
+    const size_t floatsPerKey  = components * valuesPerKey;
+    const size_t valueOffset   = (Interpolation::CUBIC_SPLINE == interpolation) ? components : 0;
+    auto         readComponent = [&](size_t key, size_t offset) {
+        Eigen::Vector4f v = Eigen::Vector4f::Zero();
+        for (size_t c = 0; c < components; ++c) v[c] = values[key * floatsPerKey + offset + c];
+        return v;
+    };
+
+    if (values.size() < times.size() * floatsPerKey) {
+        PH_LOGW("Animation track has %zu keys, but only %zu values. Track ignored.", times.size(), values.size());
+        return;
+    }
+
+    Track track;
+    track.target        = target;
+    track.property      = property;
+    track.interpolation = interpolation;
+    track.firstKey      = (uint32_t) _times.size();
+    track.keyCount      = (uint32_t) times.size();
+    track.cursor        = 0;
+    _tracks.push_back(track);
+
+    for (size_t k = 0; k < times.size(); ++k) {
+        PH_ASSERT(0 == k || times[k - 1] < times[k]);
+        _times.push_back(times[k]);
+        _values.push_back(readComponent(k, valueOffset));
+        if (Interpolation::CUBIC_SPLINE == interpolation) {
+            _inTangents.push_back(readComponent(k, 0));
+            _outTangents.push_back(readComponent(k, components * 2));
+        } else {
+            _inTangents.push_back(Eigen::Vector4f::Zero());
+            _outTangents.push_back(Eigen::Vector4f::Zero());
+        }
+    }
+
+    _duration    = std::max(_duration, times.back());
+    _groupsDirty = true;
+}
+
+void TransformTrackSet::setTime(std::chrono::duration<uint64_t, std::nano> time) {
+    if (_groupsDirty) buildGroups();
+
+    for (const auto & group : _groups) {
+        const size_t count = group.end - group.begin;
+        const bool   cubic = Interpolation::CUBIC_SPLINE == group.interpolation;
+
+        // Gather keys of all tracks in the group into the scratch buffers.
+        for (size_t i = 0; i < count; ++i) gather(_tracks[group.begin + i], i, time, cubic);
+
+        // Interpolate all of them in one pass.
+        interpolate(group, count);
+
+        // Write the results to the transform channels.
+        for (size_t i = 0; i < count; ++i) {
+            const auto & track = _tracks[group.begin + i];
+            switch (track.property) {
+            case Property::TRANSLATION:
+                track.target->setTranslation(_result.col(i).head<3>());
+                break;
+            case Property::ROTATION: {
+                Eigen::Quaternionf rotation;
+                rotation.coeffs() = _result.col(i);
+                track.target->setRotation(rotation);
+                break;
+            }
+            case Property::SCALE:
+                track.target->setScale(_result.col(i).head<3>());
+                break;
+            }
+        }
+    }
+}
+
+void TransformTrackSet::buildGroups() {
+    auto key = [](const Track & t) { return std::make_pair(Property::ROTATION == t.property, (int) t.interpolation); };
+    std::stable_sort(_tracks.begin(), _tracks.end(), [&](const Track & a, const Track & b) { return key(a) < key(b); });
+
+    _groups.clear();
+    size_t maxCount = 0;
+    for (size_t begin = 0; begin < _tracks.size();) {
+        size_t end = begin + 1;
+        while (end < _tracks.size() && key(_tracks[end]) == key(_tracks[begin])) ++end;
+        _groups.push_back({begin, end, Property::ROTATION == _tracks[begin].property, _tracks[begin].interpolation});
+        maxCount = std::max(maxCount, end - begin);
+        begin    = end;
+    }
+
+    // Allocate scratch buffers for the largest group, so no allocation happens during evaluation.
+    for (auto m : {&_start, &_end, &_startTangent, &_endTangent, &_fraction, &_result}) m->resize(4, (Eigen::Index) maxCount);
+    _weights.resize(2, (Eigen::Index) maxCount);
+
+    _groupsDirty = false;
+}
+
+void TransformTrackSet::gather(Track & track, size_t lane, std::chrono::duration<uint64_t, std::nano> time, bool cubic) {
+    const auto * times = &_times[track.firstKey];
+    track.cursor       = findUpperKey(times, track.keyCount, track.cursor, time);
+    const auto upper   = track.cursor;
+
+    if (0 == upper || upper == track.keyCount) {
+        // Before the first key or after the last key: hold the value of that key.
+        const auto & value = _values[track.firstKey + (upper ? upper - 1 : 0)];
+        _start.col(lane)   = value;
+        _end.col(lane)     = value;
+        _fraction.col(lane).setZero();
+        if (cubic) {
+            _startTangent.col(lane).setZero();
+            _endTangent.col(lane).setZero();
+        }
+        return;
+    }
+
+    // Between two keys. Same as TargetChannel, the upper key defines how the segment is interpolated.
+    const size_t k   = track.firstKey + upper;
+    _start.col(lane) = _values[k - 1];
+    _end.col(lane)   = _values[k];
+    _fraction.col(lane).setConstant(normalizeTime(times[upper - 1], times[upper], time));
+    if (cubic) {
+        _startTangent.col(lane) = _inTangents[k];
+        _endTangent.col(lane)   = _outTangents[k];
+    }
+}
+
+void TransformTrackSet::interpolate(const Group & group, size_t count) {
+    const auto n = (Eigen::Index) count;
+    auto       s = _start.leftCols(n).array();
+    auto       e = _end.leftCols(n).array();
+    auto       f = _fraction.leftCols(n).array();
+    auto       r = _result.leftCols(n).array();
+
+    switch (group.interpolation) {
+    case Interpolation::STEP:
+        // Same as StepInterpolator.
+        r = (f < 1.0f).select(s, e);
+        break;
+
+    case Interpolation::LINEAR:
+        if (!group.rotation) {
+            // Same as SimpleLinearInterpolator.
+            r = s + f * (e - s);
+        } else {
+            // Same as Eigen::QuaternionBase::slerp(). Blend weights are computed per lane, then blending is done in one pass.
+            auto       w   = _weights.leftCols(n);
+            const auto one = 1.0f - Eigen::NumTraits<float>::epsilon();
+            w.row(0)       = (s * e).colwise().sum();
+            for (Eigen::Index i = 0; i < n; ++i) {
+                float d    = w(0, i);
+                float absD = std::abs(d);
+                float t    = f(0, i);
+                float scale0, scale1;
+                if (absD >= one) {
+                    scale0 = 1.0f - t;
+                    scale1 = t;
+                } else {
+                    float theta    = std::acos(absD);
+                    float sinTheta = std::sin(theta);
+                    scale0         = std::sin((1.0f - t) * theta) / sinTheta;
+                    scale1         = std::sin(t * theta) / sinTheta;
+                }
+                w(0, i) = scale0;
+                w(1, i) = d < 0.0f ? -scale1 : scale1;
+            }
+            r = s.rowwise() * w.row(0) + e.rowwise() * w.row(1);
+        }
+        break;
+
+    case Interpolation::CUBIC_SPLINE: {
+        // Same as SimpleCubicSplineInterpolator and QuaternionfCubicSplineInterpolator.
+        auto m0 = _startTangent.leftCols(n).array();
+        auto m1 = _endTangent.leftCols(n).array();
+        auto t2 = _weights.leftCols(n).row(0);
+        auto t3 = _weights.leftCols(n).row(1);
+        t2      = f.row(0) * f.row(0);
+        t3      = t2 * f.row(0);
+        r       = s.rowwise() * (2.0f * t3 - 3.0f * t2 + 1.0f) + m0.rowwise() * (t3 - 2.0f * t2 + f.row(0)) + e.rowwise() * (-2.0f * t3 + 3.0f * t2) +
+            m1.rowwise() * (t3 - t2);
+        if (group.rotation) _result.leftCols(n).colwise().normalize();
+        break;
+    }
+    }
+}
+
+} // namespace animations
@@ -0,0 +1,161 @@
+/*****************************************************************************
+ * Copyright (C) 2020 - 2024 OPPO. All rights reserved.
+ *******************************************************************************/
+
+/**
+ *
+ */
+#pragma once
+
+#include <ph/rt-utils.h>
+
+#include "channel.h"
+#include "transform-channel.h"
+
+#include <chrono>
+#include <vector>
+
+namespace animations {
+
+/**
+ * A channel that samples all translation, rotation and scale tracks of a
+ * clip in one batch, instead of one TargetChannel per track.
+ *
+ * Tracks sharing the same value type and interpolation are evaluated
+ * together: their keys are gathered into SoA matrices, one column per
+ * track, and then interpolated with coefficient-wise vector operations.
+ * Results are written to the TransformChannel of each track. So, just
+ * like TargetChannel, this channel has to be placed before the transform
+ * channels in the timeline, which then apply the results to the nodes.
+ *
+ * Interpolation results are identical to the ones of TargetChannel with
+ * the interpolators created by the glTF transform channel builder.
+ */
+class TransformTrackSet : public Channel {
+public:
+    /**
+     * Property of the transform channel animated by a track.
+     */
+    enum class Property {
+        TRANSLATION,
+        ROTATION,
+        SCALE,
+    };
+
+    /**
+     * How values are interpolated between two keys.
+     */
+    enum class Interpolation {
+        STEP,
+        LINEAR,
+        CUBIC_SPLINE,
+    };
+
+    /**
+     *
+     */
+    TransformTrackSet() = default;
+
+    /**
+     *
+     */
+    virtual ~TransformTrackSet() = default;
+
+    /**
+     * Adds a track to the set.
+     * @param target The transform channel animated by the track.
+     * @param property The property of target animated by the track.
+     * @param interpolation How values are interpolated between keys.
+     * @param times Time of each key. Must be sorted and have no duplicates.
+     * @param values Value of each key: 3 floats for translation and scale, 4 floats (x, y, z, w) for rotation.
+     * Cubic spline tracks have 3 values for each key: in-tangent, value and out-tangent.
+     * Rotations are expected to be normalized already.
+     */
+    void addTrack(TransformChannel * target, Property property, Interpolation interpolation, const std::vector<std::chrono::duration<uint64_t, std::nano>> & times,
+                  const std::vector<float> & values);
+
+    /**
+     * @return Number of tracks in the set.
+     */
+    size_t getTrackCount() const { return _tracks.size(); }
+
+    /**
+     * Samples all tracks at the given time, and writes the results to their transform channels.
+     */
+    void setTime(std::chrono::duration<uint64_t, std::nano> time) override;
+
+    std::chrono::duration<uint64_t, std::nano> getDuration() override { return _duration; }
+
+private:
+    /**
+     * A single animated property.
+     */
+    struct Track {
+        TransformChannel * target;
+        Property           property;
+        Interpolation      interpolation;
+        uint32_t           firstKey; ///< index of the first key of the track in the key arrays.
+        uint32_t           keyCount;
+        uint32_t           cursor;   ///< upper key of the last evaluation.
+    };
+
+    /**
+     * A range of tracks sharing the same value type and interpolation.
+     */
+    struct Group {
+        size_t        begin, end;
+        bool          rotation;
+        Interpolation interpolation;
+    };
+
+    using Vector4fArray = std::vector<Eigen::Vector4f, Eigen::aligned_allocator<Eigen::Vector4f>>;
+    using Lanes         = Eigen::Matrix<float, 4, Eigen::Dynamic>;
+
+    /**
+     * All tracks. Sorted by group when the set is evaluated.
+     */
+    std::vector<Track> _tracks;
+
+    /**
+     * Time, value and tangents of all keys of all tracks. Values are stored as 4 floats
+     * for all types. Tangents are only used by cubic spline tracks.
+     */
+    std::vector<std::chrono::duration<uint64_t, std::nano>> _times;
+    Vector4fArray                                           _values;
+    Vector4fArray                                           _inTangents;
+    Vector4fArray                                           _outTangents;
+
+    /**
+     * Groups of tracks. Rebuilt when tracks are added.
+     */
+    std::vector<Group> _groups;
+    bool               _groupsDirty = false;
+
+    /**
+     * The last key time of all tracks.
+     */
+    std::chrono::duration<uint64_t, std::nano> _duration = std::chrono::nanoseconds::zero();
+
+    /**
+     * Scratch buffers of the batch evaluation. One column per track.
+     */
+    Lanes                                  _start, _end, _startTangent, _endTangent, _fraction, _result;
+    Eigen::Array<float, 2, Eigen::Dynamic> _weights; ///< per track blend weights.
+
+    /**
+     * Sorts tracks by group and rebuilds the group list.
+     */
+    void buildGroups();
+
+    /**
+     * Finds the segment of the track at the given time and gathers its keys into column lane of the scratch buffers.
+     */
+    void gather(Track & track, size_t lane, std::chrono::duration<uint64_t, std::nano> time, bool cubic);
+
+    /**
+     * Interpolates all lanes in range [0, count) of the scratch buffers.
+     */
+    void interpolate(const Group & group, size_t count);
+};
+
+} // namespace animations
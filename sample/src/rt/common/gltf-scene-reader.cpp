@@ -13,9 +13,9 @@
 #include <filesystem>
 
 GLTFSceneReader::GLTFSceneReader(ph::AssetSystem * assetSystem, TextureCache * textureCache, sg::Graph * graph, skinning::SkinMap * skinnedMeshes,
-                                 MorphTargetManager * morphTargetManager, SceneBuildBuffers * sbb, bool createGeomLights)
+                                 MorphTargetManager * morphTargetManager, SceneBuildBuffers * sbb, bool createGeomLights, bool parallel)
     : _assetSystem(assetSystem), _textureCache(textureCache), _mainGraph(graph), _skinnedMeshes(skinnedMeshes), _morphTargetManager(morphTargetManager),
-      _sbb(sbb), _createGeomLights(createGeomLights) {
+      _sbb(sbb), _createGeomLights(createGeomLights), _parallel(parallel) {
     //
 }
 
@@ -105,7 +105,7 @@ std::shared_ptr<const SceneAsset> GLTFSceneReader::read(const std::string & asse
     // Create a builder to hold all the variables needed to generate the PhysRay objects.
     PH_LOGI("[GLTF] Constructing GLTF scene builder....");
     gltf::GLTFSceneAssetBuilder sceneBuilder(_assetSystem, _textureCache, _mainGraph, &model, assetBaseDirectory, _skinnedMeshes, _morphTargetManager, _sbb,
-                                             _createGeomLights);
+                                             _createGeomLights, _parallel);
 
     // Generate all of the available scenes and fetch the result.
     PH_LOGI("[GLTF] Building scene graph....");
@@ -33,9 +33,10 @@ public:
      * @param textureCache The object used to load and cache textures.
      * @param world The world used to generate objects.
      * @param mainScene The main scene nodes will be added to.
+     * @param parallel Convert images and meshes on multiple threads.
      */
     GLTFSceneReader(ph::AssetSystem * assetSystem, TextureCache * textureCache, sg::Graph * graph, skinning::SkinMap * skinnedMeshes,
-                    MorphTargetManager * morphTargetManager, SceneBuildBuffers * sbb, bool createGeomLights);
+                    MorphTargetManager * morphTargetManager, SceneBuildBuffers * sbb, bool createGeomLights, bool parallel = true);
 
     virtual ~GLTFSceneReader() = default;
 
@@ -61,4 +62,5 @@ private:
     MorphTargetManager * _morphTargetManager;
     SceneBuildBuffers *  _sbb;
     bool                 _createGeomLights;
+    bool                 _parallel;
 };
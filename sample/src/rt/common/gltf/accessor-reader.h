@@ -126,6 +126,24 @@ public:
      */
     static std::size_t getComponentTypeSize(const tinygltf::Accessor & accessor) { return getComponentTypeSize(accessor.componentType); }
 
+    /**
+     * @param <T> A C++ component type, such as float or uint16_t.
+     * @return The GLTF component type that is stored as T,
+     * or -1 if there is no such type.
+     */
+    template<typename T>
+    static constexpr int getComponentType() {
+        if (std::is_same<T, int8_t>::value) return TINYGLTF_COMPONENT_TYPE_BYTE;
+        if (std::is_same<T, uint8_t>::value) return TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+        if (std::is_same<T, int16_t>::value) return TINYGLTF_COMPONENT_TYPE_SHORT;
+        if (std::is_same<T, uint16_t>::value) return TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT;
+        if (std::is_same<T, int32_t>::value) return TINYGLTF_COMPONENT_TYPE_INT;
+        if (std::is_same<T, uint32_t>::value) return TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT;
+        if (std::is_same<T, float>::value) return TINYGLTF_COMPONENT_TYPE_FLOAT;
+        if (std::is_same<T, double>::value) return TINYGLTF_COMPONENT_TYPE_DOUBLE;
+        return -1;
+    }
+
     /**
      * @return Total number of components in the given accessor.
      * For example, if there are 2 Vec3s, it will return 2 * 3 = 6.
@@ -241,6 +259,108 @@ public:
      */
     const tinygltf::Model * getModel() const { return _model; }
 
+    /**
+     * A strided span pointing straight into the memory of a tinygltf::Buffer.
+     * It stays valid for as long as the model is alive.
+     * @param <T> Component type of the span.
+     */
+    template<typename T>
+    struct AccessorView {
+        /**
+         * First component of the first element. Null if the accessor can't be viewed in place.
+         */
+        const T * data = nullptr;
+
+        /**
+         * Number of elements.
+         */
+        std::size_t count = 0;
+
+        /**
+         * Number of components in each element. For example, VEC3 would be 3.
+         */
+        std::size_t width = 0;
+
+        /**
+         * Distance in bytes between the start of two consecutive elements.
+         */
+        std::size_t stride = 0;
+
+        bool empty() const { return nullptr == data; }
+
+        /**
+         * @return true if there is no gap between elements,
+         * so the view can be used as a plain array of count * width components.
+         */
+        bool packed() const { return stride == width * sizeof(T); }
+
+        /**
+         * @return The component'th component of the index'th element.
+         */
+        const T & at(std::size_t index, std::size_t component) const { return *(const T *) ((const uint8_t *) data + index * stride + component * sizeof(T)); }
+    };
+
+    /**
+     * Views the contents of the given accessor in place, without copying them.
+     *
+     * This only works when readAccessor() would have nothing to do besides
+     * copying: the accessor must be backed by a buffer view, must not be sparse,
+     * its component type must be T, and its data must be suitably aligned and
+     * within the bounds of the buffer. In any other case, the returned view is
+     * empty and the caller should fall back to readAccessor().
+     * @param <T> Component type of the view.
+     * @param accessor The accessor being viewed.
+     * @return The view of the accessor, or an empty view if it needs conversion.
+     */
+    template<typename T>
+    AccessorView<T> viewAccessor(const tinygltf::Accessor & accessor) const {
+        AccessorView<T> result;
+
+        // Accessors without a buffer view are filled with default values,
+        // and sparse accessors are patched on top of their base values.
+        // Both have to be materialized by readAccessor().
+        if (accessor.bufferView < 0 || accessor.sparse.isSparse) return result;
+
+        // Any conversion of the component type requires a copy as well.
+        if (getComponentType<T>() != accessor.componentType) return result;
+
+        const tinygltf::BufferView & bufferView = _model->bufferViews[accessor.bufferView];
+        const tinygltf::Buffer &     buffer     = _model->buffers[bufferView.buffer];
+
+        std::size_t elementByteCount = calculateElementByteCount(accessor);
+        std::size_t byteStride       = bufferView.byteStride ? bufferView.byteStride : elementByteCount;
+        std::size_t byteOffset       = accessor.byteOffset + bufferView.byteOffset;
+
+        // Make sure the whole accessor is inside of the buffer.
+        if (accessor.count > 0 && byteOffset + (accessor.count - 1) * byteStride + elementByteCount > buffer.data.size()) {
+            PH_LOGW("Accessor %s is out of the bounds of its buffer.", accessor.name.c_str());
+            return result;
+        }
+
+        // The glTF spec requires accessors to be aligned to their component size,
+        // but not every exporter respects that. Misaligned data has to be copied.
+        const uint8_t * start = buffer.data.data() + byteOffset;
+        if (0 != ((std::uintptr_t) start % alignof(T)) || 0 != (byteStride % alignof(T))) return result;
+
+        result.data   = (const T *) start;
+        result.count  = accessor.count;
+        result.width  = getComponentCount(accessor.type);
+        result.stride = byteStride;
+        return result;
+    }
+
+    /**
+     * Views the contents of the given accessor in place, without copying them.
+     * @param <T> Component type of the view.
+     * @param accessorId Id of accessor being viewed,
+     * which will be selected from the model.
+     * @return The view of the accessor, or an empty view if it needs conversion.
+     */
+    template<typename T>
+    AccessorView<T> viewAccessor(std::size_t accessorId) const {
+        return viewAccessor<T>(_model->accessors[accessorId]);
+    }
+
     /**
      * Reads the contents of the given accessor,
      * casts them to type T if it doesn't match the accessor's type,
@@ -285,6 +405,34 @@ public:
         readAccessor(accessor, result);
     }
 
+    /**
+     * Reads only the elements stored in a sparse accessor, without expanding
+     * them to the full accessor. This only works for sparse accessors without
+     * a buffer view, whose other elements are all zero, like the ones of
+     * morph targets that displace a few vertices of the mesh.
+     * @param <ResultType> Type of the values to be saved to.
+     * @param accessor The accessor being read from.
+     * @param indices Element index of each value, in increasing order.
+     * @param values Components of the stored elements, casted to ResultType.
+     * @return false if the accessor isn't such a sparse accessor. Nothing is
+     * read in that case, and the caller should fall back to readAccessor().
+     */
+    template<typename ResultType>
+    bool readSparseAccessor(const tinygltf::Accessor & accessor, std::vector<uint32_t> & indices, std::vector<ResultType> & values) const {
+        if (!accessor.sparse.isSparse || accessor.bufferView >= 0) return false;
+
+        // Read the element indices.
+        std::vector<std::size_t> sparseIndices;
+        readSparseIndices(accessor, sparseIndices);
+        indices.assign(sparseIndices.begin(), sparseIndices.end());
+
+        // Read the values of those elements.
+        values.clear();
+        const tinygltf::BufferView & valuesBufferView = _model->bufferViews[accessor.sparse.values.bufferView];
+        readBufferView(valuesBufferView, accessor.sparse.values.byteOffset, accessor.sparse.count, accessor.type, accessor.componentType, values);
+        return true;
+    }
+
     /**
      * Reads the contents of the given accessor,
      * casts them to type T if it doesn't match the accessor's type,
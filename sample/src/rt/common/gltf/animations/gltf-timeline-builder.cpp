@@ -18,9 +18,9 @@ namespace gltf {
 namespace animations {
 
 GLTFTimelineBuilder::GLTFTimelineBuilder(tinygltf::Model * model, std::shared_ptr<SceneAsset> sceneAsset, tinygltf::Animation * animation,
-                                         MorphTargetManager * morphTargetManager)
+                                         MorphTargetManager * morphTargetManager, bool batched)
     : _model(model), _sceneAsset(sceneAsset), _animation(animation), _morphTargetManager(morphTargetManager) {
-    //
+    if (batched) _trackSet = std::make_shared<::animations::TransformTrackSet>();
 }
 
 std::shared_ptr<::animations::Timeline> GLTFTimelineBuilder::build() {
@@ -40,6 +40,11 @@ std::shared_ptr<::animations::Timeline> GLTFTimelineBuilder::build() {
         addChannel(channels, channel);
     }
 
+    // In batched mode, the track set samples all transform channels. It has to run before the transform channels,
+    // which apply the sampled values to the nodes.
+    if (_trackSet && _trackSet->getTrackCount() > 0) channels.push_back(_trackSet);
+    _trackSet.reset();
+
     // Add all the transform channels to the end of the list of channels.
     for (auto iterator = _nodeToTransformChannel.begin(); iterator != _nodeToTransformChannel.end(); ++iterator) {
         // Store the channel in a shared pointer to handle its deletion
@@ -73,7 +78,7 @@ void GLTFTimelineBuilder::addChannel(std::vector<std::shared_ptr<::animations::C
         std::shared_ptr<::animations::Channel> propertyTransformChannel = buildTransformChannel(channel, &GLTFTransformChannelBuilder::buildTranslateChannel);
 
         // Build the channel and add it to the timeline's list of channels.
-        channels.push_back(propertyTransformChannel);
+        if (propertyTransformChannel) channels.push_back(propertyTransformChannel);
 
         // If this is animating the node's rotation.
     } else if (channel.target_path == "rotation") {
@@ -81,7 +86,7 @@ void GLTFTimelineBuilder::addChannel(std::vector<std::shared_ptr<::animations::C
         std::shared_ptr<::animations::Channel> propertyTransformChannel = buildTransformChannel(channel, &GLTFTransformChannelBuilder::buildRotateChannel);
 
         // Build the channel and add it to the timeline's list of channels.
-        channels.push_back(propertyTransformChannel);
+        if (propertyTransformChannel) channels.push_back(propertyTransformChannel);
 
         // If this is animating the node's scale.
     } else if (channel.target_path == "scale") {
@@ -89,7 +94,7 @@ void GLTFTimelineBuilder::addChannel(std::vector<std::shared_ptr<::animations::C
         std::shared_ptr<::animations::Channel> propertyTransformChannel = buildTransformChannel(channel, &GLTFTransformChannelBuilder::buildScaleChannel);
 
         // Build the channel and add it to the timeline's list of channels.
-        channels.push_back(propertyTransformChannel);
+        if (propertyTransformChannel) channels.push_back(propertyTransformChannel);
 
         // If this is animating the node's morph targets.
     } else if (channel.target_path == "weights") {
@@ -120,6 +125,12 @@ GLTFTimelineBuilder::buildTransformChannel(tinygltf::AnimationChannel & channel,
     // Create the object to build the channel.
     GLTFTransformChannelBuilder channelBuilder(_model, transformChannel, &channel, &sampler);
 
+    // In batched mode, add the keys to the track set. There's no separate channel to return.
+    if (_trackSet) {
+        channelBuilder.addTrack(*_trackSet);
+        return nullptr;
+    }
+
     // Build the channel using the selected build method and return it.
     return (channelBuilder.*buildMethod)();
 }
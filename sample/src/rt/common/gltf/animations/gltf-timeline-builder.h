@@ -13,6 +13,7 @@
 #include "../gltf.h"
 #include "../../scene-asset.h"
 #include "../../animations/transform-channel.h"
+#include "../../animations/transform-track-set.h"
 #include "../../animations/weight-channel.h"
 #include "../../morphtargets.h"
 
@@ -33,9 +34,11 @@ public:
      * @param model The tinygltf model who's items are being instantiated as animations.
      * @param sceneAsset The scene asset who's items are being animated.
      * @param animation The animation a Timeline is being built from.
+     * @param batched If true, all translation, rotation and scale channels of the animation are evaluated together by one
+     * TransformTrackSet, instead of one TargetChannel for each of them.
      */
     GLTFTimelineBuilder(tinygltf::Model * model, std::shared_ptr<SceneAsset> sceneAsset, tinygltf::Animation * animation,
-                        MorphTargetManager * morphTargetManager = nullptr);
+                        MorphTargetManager * morphTargetManager = nullptr, bool batched = true);
 
     /**
      * Destructor.
@@ -81,6 +84,11 @@ private:
 
     MorphTargetManager * _morphTargetManager;
 
+    /**
+     * Evaluates all transform channels of the animation in batched mode. Null otherwise.
+     */
+    std::shared_ptr<::animations::TransformTrackSet> _trackSet;
+
     /**
      * Maps node ids to the transform channel being
      * used to animate their transforms.
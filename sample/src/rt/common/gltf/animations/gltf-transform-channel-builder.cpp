@@ -215,5 +215,86 @@ void GLTFTransformChannelBuilder::buildQuaternionfKeyValues(
     }
 }
 
+void GLTFTransformChannelBuilder::addTrack(::animations::TransformTrackSet & trackSet) {
+    using TrackSet = ::animations::TransformTrackSet;
+
+    // Determine the animated property.
+    TrackSet::Property property;
+    if (_animationChannel->target_path == "translation") {
+        property = TrackSet::Property::TRANSLATION;
+    } else if (_animationChannel->target_path == "rotation") {
+        property = TrackSet::Property::ROTATION;
+    } else if (_animationChannel->target_path == "scale") {
+        property = TrackSet::Property::SCALE;
+    } else {
+        PH_LOGW("Unsupported animation channel target path '%s'", _animationChannel->target_path.c_str());
+        return;
+    }
+
+    // Determine the interpolation.
+    TrackSet::Interpolation interpolation;
+    if (_animationSampler->interpolation == "LINEAR") {
+        interpolation = TrackSet::Interpolation::LINEAR;
+    } else if (_animationSampler->interpolation == "STEP") {
+        interpolation = TrackSet::Interpolation::STEP;
+    } else if (_animationSampler->interpolation == "CUBICSPLINE") {
+        interpolation = TrackSet::Interpolation::CUBIC_SPLINE;
+    } else {
+        PH_LOGW("Interpolation type '%s' not supported.", _animationSampler->interpolation.c_str());
+        return;
+    }
+
+    const bool        rotation   = TrackSet::Property::ROTATION == property;
+    const std::size_t components = rotation ? 4 : 3;
+    const std::size_t stride     = components * ((TrackSet::Interpolation::CUBIC_SPLINE == interpolation) ? 3 : 1);
+
+    // Parse out the time of each keyframe, which is saved as seconds.
+    std::vector<float> keyValueTimes;
+    _accessorReader.readAccessor(_model->accessors[_animationSampler->input], keyValueTimes);
+
+    // Read the sample output data, which holds the key values and tangents.
+    std::vector<float> samplerOutput;
+    _accessorReader.readAccessor(_model->accessors[_animationSampler->output], samplerOutput);
+    if (samplerOutput.size() < keyValueTimes.size() * stride) {
+        PH_LOGW("Animation sampler output has %zu floats, less than the %zu expected.", samplerOutput.size(), keyValueTimes.size() * stride);
+        return;
+    }
+
+    // Sort keys by time. Same as buildKeyValues(), negative times are skipped, and the last key wins if times are duplicated.
+    std::map<std::chrono::duration<uint64_t, std::nano>, std::size_t> timeToFrame;
+    for (std::size_t frameIndex = 0; frameIndex < keyValueTimes.size(); ++frameIndex) {
+        float keyValueTimeSeconds = keyValueTimes[frameIndex];
+        if (keyValueTimeSeconds < 0) {
+            PH_LOGW("Animation input accessor element at index "
+                    "%zu is negative: %f.",
+                    frameIndex, keyValueTimeSeconds);
+            continue;
+        }
+        timeToFrame[std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<float>(keyValueTimeSeconds))] = frameIndex;
+    }
+
+    std::vector<std::chrono::duration<uint64_t, std::nano>> times;
+    std::vector<float>                                      values;
+    times.reserve(timeToFrame.size());
+    values.reserve(timeToFrame.size() * stride);
+    for (const auto & tf : timeToFrame) {
+        times.push_back(tf.first);
+        auto start = samplerOutput.begin() + tf.second * stride;
+        for (std::size_t i = 0; i < stride; i += components) {
+            if (rotation) {
+                // GLTF animated quaternions are NOT guaranteed to already be normalized. Same as parseQuaternionf(),
+                // tangents are normalized too.
+                Eigen::Quaternionf q;
+                parseQuaternionf(start + i, q);
+                values.insert(values.end(), q.coeffs().data(), q.coeffs().data() + 4);
+            } else {
+                values.insert(values.end(), start + i, start + i + components);
+            }
+        }
+    }
+
+    trackSet.addTrack(_transformChannel, property, interpolation, times, values);
+}
+
 } // namespace animations
 } // namespace gltf
@@ -17,6 +17,7 @@
 #include "../../scene-asset.h"
 #include "../../animations/quaternionf-cubic-spline-interpolator.h"
 #include "../../animations/transform-channel.h"
+#include "../../animations/transform-track-set.h"
 
 #include <memory>
 
@@ -75,6 +76,13 @@ public:
      */
     std::shared_ptr<::animations::Channel> buildScaleChannel();
 
+    /**
+     * Adds the keys of the tinygltf animation channel to a track set, instead of building a separate channel for it.
+     * Keys are parsed the same way as the build methods above.
+     * @param trackSet The track set to add the track to.
+     */
+    void addTrack(::animations::TransformTrackSet & trackSet);
+
 private:
     /**
      * Builds keyvalues.
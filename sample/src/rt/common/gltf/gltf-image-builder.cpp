@@ -63,11 +63,7 @@ bool GLTFImageBuilder::build(const tinygltf::Image & image, ph::RawImage & phIma
         return true;
     } else if (isRelativeURI(image.uri)) {
         // This is a relative URI.
-        // Unescape any special characters, like spaces.
-        std::string decodedURI = decodeURI(image.uri);
-
-        // Convert to an absolute URI by adding it to the directory the gltf file was loaded from.
-        auto name = (_assetBaseDirectory / decodedURI).string();
+        auto name = getAssetPath(image);
 
         // Load the image bytes from the asset system.
         std::future<ph::Asset> futureAsset = _assetSys->load(name.c_str());
@@ -83,4 +79,14 @@ bool GLTFImageBuilder::build(const tinygltf::Image & image, ph::RawImage & phIma
     }
 }
 
+std::string GLTFImageBuilder::getAssetPath(const tinygltf::Image & image) const {
+    if (image.as_is || image.uri.empty() || !isRelativeURI(image.uri)) return {};
+
+    // Unescape any special characters, like spaces.
+    std::string decodedURI = decodeURI(image.uri);
+
+    // Convert to an absolute URI by adding it to the directory the gltf file was loaded from.
+    return (_assetBaseDirectory / decodedURI).string();
+}
+
 } // namespace gltf
@@ -49,6 +49,14 @@ public:
      */
     bool build(const tinygltf::Image & image, ph::RawImage & phImage);
 
+    /**
+     * @param image The tinygltf image.
+     * @return Path of the image in the asset system, if it is stored in a
+     * file of its own. Empty if the image is embedded in the model, or has
+     * an absolute uri.
+     */
+    std::string getAssetPath(const tinygltf::Image & image) const;
+
 private:
     /**
      * @return true if this is a relative uri, false otherwise.
@@ -13,12 +13,13 @@
 namespace gltf {
 
 GLTFMaterialBuilder::GLTFMaterialBuilder(TextureCache * textureCache, ph::rt::Scene * scene, const tinygltf::Model * model,
-                                         const std::vector<ph::RawImage> * images)
-    : _textureCache(textureCache), _scene(scene), _model(model), _images(images) {
+                                         const std::vector<ph::RawImage> * images, const std::vector<std::string> * imagePaths)
+    : _textureCache(textureCache), _scene(scene), _model(model), _images(images), _imagePaths(imagePaths) {
     PH_REQUIRE(textureCache);
     PH_REQUIRE(scene);
     PH_REQUIRE(model);
     PH_REQUIRE(images);
+    PH_REQUIRE(imagePaths);
 }
 
 ph::rt::Material * GLTFMaterialBuilder::build(const tinygltf::Material & material) {
@@ -70,24 +71,65 @@ ph::rt::Material * GLTFMaterialBuilder::build(const tinygltf::Material & materia
     }
 
     // Transfer the basic color's texture if any.
-    phMaterialDesc.maps[(std::size_t) ph::rt::Material::TextureType::ALBEDO] = getTextureHandle(metallicRoughness.baseColorTexture);
+    phMaterialDesc.maps[(std::size_t) ph::rt::Material::TextureType::ALBEDO] = getTextureHandle(metallicRoughness.baseColorTexture, ph::rt::Material::TextureType::ALBEDO);
 
     // Copy emission color & texture
     for (std::size_t index = 0; index < 3; ++index) { phMaterialDesc.emission[index] = (float) material.emissiveFactor[index]; }
-    phMaterialDesc.maps[(std::size_t) ph::rt::Material::TextureType::EMISSION] = getTextureHandle(material.emissiveTexture);
+    phMaterialDesc.maps[(std::size_t) ph::rt::Material::TextureType::EMISSION] = getTextureHandle(material.emissiveTexture, ph::rt::Material::TextureType::EMISSION);
 
     // Copy other textures (if any).
-    phMaterialDesc.maps[(std::size_t) ph::rt::Material::TextureType::NORMAL] = getTextureHandle(material.normalTexture);
+    phMaterialDesc.maps[(std::size_t) ph::rt::Material::TextureType::NORMAL] = getTextureHandle(material.normalTexture, ph::rt::Material::TextureType::NORMAL);
 
     // If this material has occlusion or metallic roughness.
     phMaterialDesc.maps[(std::size_t) ph::rt::Material::TextureType::ORM] = getOrmTextureHandle(material);
 
-    // Create the material and return it.
+    // Create the material.
     auto phMaterial = _scene->world()->create(material.name, phMaterialDesc);
+
+    // Stream in the maps that are not decoded yet. The material is rendered without them until they are ready.
+    for (const auto & [type, path] : _asyncMaps) {
+        _textureCache->loadFromAssetAsync(path, [phMaterial, type = type](const ph::rt::Material::TextureHandle & h) {
+            phMaterial->setDesc(ph::rt::Material::Desc(phMaterial->desc()).setMap(type, h));
+        });
+    }
+    _asyncMaps.clear();
+
     return phMaterial;
 }
 
-ph::rt::Material::TextureHandle GLTFMaterialBuilder::getTextureHandleForImageId(int imageId, std::string uri) {
+void GLTFMaterialBuilder::markSplicedImages(const tinygltf::Model & model, std::vector<bool> & spliced) {
+    auto mark = [&](int textureIndex) {
+        if (textureIndex < 0) return;
+        int source = model.textures[textureIndex].source;
+        if (source >= 0 && (size_t) source < spliced.size()) spliced[source] = true;
+    };
+    for (const auto & material : model.materials) {
+        // Packed ORM maps are used as is.
+        if (getPackedOrmImage(model, material) >= 0) continue;
+        mark(material.occlusionTexture.index);
+        mark(material.pbrMetallicRoughness.metallicRoughnessTexture.index);
+    }
+}
+
+int GLTFMaterialBuilder::getPackedOrmImage(const tinygltf::Model & model, const tinygltf::Material & material) {
+    int occlusion  = material.occlusionTexture.index;
+    int metalRough = material.pbrMetallicRoughness.metallicRoughnessTexture.index;
+    if (occlusion < 0 || metalRough < 0) return -1;
+
+    // glTF stores occlusion in the red channel, and roughness and metalness in green and blue. So the same image used
+    // for both is laid out as an ORM map already.
+    int source = model.textures[occlusion].source;
+    return source == model.textures[metalRough].source ? source : -1;
+}
+
+ph::rt::Material::TextureHandle GLTFMaterialBuilder::getTextureHandleForImageId(int imageId, std::string uri, ph::rt::Material::TextureType type) {
+    // Images that are not decoded are loaded by the texture cache in background, once the material is created.
+    const std::string & path = (*_imagePaths)[imageId];
+    if ((*_images)[imageId].empty() && !path.empty()) {
+        _asyncMaps.emplace_back(type, path);
+        return ph::rt::Material::TextureHandle::EMPTY_2D();
+    }
+
     // If the texture handle does not exist, create it.
     // Get the image we want a texture handle for.
     const ph::ImageProxy & imageProxy = (*_images)[imageId].proxy();
@@ -118,11 +160,19 @@ ph::rt::Material::TextureHandle GLTFMaterialBuilder::getOrmTextureHandle(const t
 
     // If texture handle for this ORM already exists.
     if (iterator != _ormToTextureHandle.end()) {
-        // Then just return it.
+        // Then just return it, with one more reference for this material.
+        _textureCache->retain(iterator->second);
         return iterator->second;
 
         // If texture handle does not exist.
     } else {
+        // An image packing all three channels is the ORM map already. Load it in background, if it isn't decoded.
+        int packed = getPackedOrmImage(*_model, material);
+        if (packed >= 0 && (*_images)[packed].empty() && !(*_imagePaths)[packed].empty()) {
+            _asyncMaps.emplace_back(ph::rt::Material::TextureType::ORM, (*_imagePaths)[packed]);
+            return ph::rt::Material::TextureHandle::EMPTY_2D();
+        }
+
         // Create a texture handle for an image containing the combination of the
         // occlusion and metallic roughness images.
         // Get the images we are combining.
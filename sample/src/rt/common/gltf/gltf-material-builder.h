@@ -25,8 +25,13 @@ public:
     /**
      * This constructor will load all of the images inside
      * the model file.
+     * @param images Decoded images, indexed by image id. Images that are
+     * not decoded are loaded asynchronously from imagePaths.
+     * @param imagePaths Asset path of each image, indexed by image id.
+     * Empty for images embedded in the model.
      */
-    GLTFMaterialBuilder(TextureCache * textureCache, ph::rt::Scene * scene, const tinygltf::Model * model, const std::vector<ph::RawImage> * images);
+    GLTFMaterialBuilder(TextureCache * textureCache, ph::rt::Scene * scene, const tinygltf::Model * model, const std::vector<ph::RawImage> * images,
+                        const std::vector<std::string> * imagePaths);
 
     /**
      *
@@ -46,6 +51,15 @@ public:
      */
     ph::rt::Material * build(const tinygltf::Material & material);
 
+    /**
+     * Marks images whose pixels are needed to build materials, which are
+     * the ones spliced into ORM maps. Other images stored in files of their
+     * own are streamed in by the texture cache, and need not be decoded.
+     * @param model The tinygltf model.
+     * @param spliced Flags indexed by image id. Set to true for spliced images.
+     */
+    static void markSplicedImages(const tinygltf::Model & model, std::vector<bool> & spliced);
+
 private:
     /**
      * A functor allowing _ormToTextureHandle to use tuples as keys.
@@ -74,6 +88,17 @@ private:
      */
     const std::vector<ph::RawImage> * _images;
 
+    /**
+     * Asset path of each tiny gltf image. Empty for embedded images.
+     */
+    const std::vector<std::string> * _imagePaths;
+
+    /**
+     * Maps of the material being built, that are loaded asynchronously
+     * once the material is created.
+     */
+    std::vector<std::pair<ph::rt::Material::TextureType, std::string>> _asyncMaps;
+
     /**
      * Records the combined Occlusion-Metalness-roughness images.
      * The builder combines the AO and MR (metal-rougness) images into a single ORM map that
@@ -87,9 +112,18 @@ private:
     /**
      * @param imageId Id of the image we want the texture handle for.
      * Does NOT check for negative ids.
-     * @return The texture handle wrapping the given image.
+     * @param type The map of the material the texture is for.
+     * @return The texture handle wrapping the given image. Empty if the
+     * image is not decoded, in which case it is loaded asynchronously into
+     * the map once the material is created.
+     */
+    ph::rt::Material::TextureHandle getTextureHandleForImageId(int imageId, std::string uri, ph::rt::Material::TextureType type);
+
+    /**
+     * @return Id of the image that packs occlusion, roughness and metalness of
+     * the material, as an ORM map already. -1 if the material has none.
      */
-    ph::rt::Material::TextureHandle getTextureHandleForImageId(int imageId, std::string uri);
+    static int getPackedOrmImage(const tinygltf::Model & model, const tinygltf::Material & material);
 
     /**
      * Retrieves the uri of the given texture info object.
@@ -128,9 +162,10 @@ private:
      * All of the tinygltf classes have the same layout and members, but
      * do not share any base classes or interfaces.
      * @param info Info struct the image is being extracted from.
+     * @param type The map of the material the texture is for.
      */
     template<typename TextureInfo>
-    const ph::rt::Material::TextureHandle getTextureHandle(const TextureInfo & info) {
+    const ph::rt::Material::TextureHandle getTextureHandle(const TextureInfo & info, ph::rt::Material::TextureType type) {
         // If texture does not exist.
         if (info.index < 0) {
             // Just return an empty texture handle.
@@ -151,7 +186,7 @@ private:
         std::string               uri     = _model->images[texture.source].uri; // may need to convert to absolute path?
 
         // Return the texture handle for this texture's image.
-        return getTextureHandleForImageId(texture.source, uri);
+        return getTextureHandleForImageId(texture.source, uri, type);
     }
 
     /**
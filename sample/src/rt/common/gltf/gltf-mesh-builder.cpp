@@ -12,7 +12,8 @@
 
 namespace gltf {
 
-bool GLTFMeshBuilder::build(const tinygltf::Primitive & primitive, MeshData & meshData, Eigen::AlignedBox3f & bbox, skinning::SkinningData & skinData) {
+bool GLTFMeshBuilder::build(const tinygltf::Primitive & primitive, MeshData & meshData, Eigen::AlignedBox3f & bbox, skinning::SkinningData & skinData,
+                            MorphTargetData * morphData) {
     // Only triangles are currently supported.
     // If this isn't a triangle.
     if (primitive.mode != TINYGLTF_MODE_TRIANGLES) {
@@ -53,21 +54,18 @@ bool GLTFMeshBuilder::build(const tinygltf::Primitive & primitive, MeshData & me
         if (name == "POSITION") {
             positionAccessor = readPositions(iterator->second, meshData.positions);
 
-            if (getSkinnedData) skinData.origPositions = meshData.positions.vec;
+            if (getSkinnedData) skinData.origPositions.assign(meshData.positions.data(), meshData.positions.data() + meshData.positions.size());
 
             // Mesh normals
         } else if (name == "NORMAL") {
             readNormals(iterator->second, meshData.normals);
 
-            if (getSkinnedData) skinData.origNormals = meshData.normals.vec;
+            if (getSkinnedData) skinData.origNormals.assign(meshData.normals.data(), meshData.normals.data() + meshData.normals.size());
 
             // Mesh texture coordinates.
         } else if (name == "TEXCOORD_0") {
-            // Read the attribute.
-            _accessorReader.readAccessor(iterator->second, meshData.texCoords.vec);
-
-            // Stride of vec2
-            meshData.texCoords.width = 2;
+            // Read the attribute as vec2.
+            readAttribute(iterator->second, 2, meshData.texCoords);
 
             // Mesh tangents.
         } else if (name == "TANGENT") {
@@ -113,6 +111,8 @@ bool GLTFMeshBuilder::build(const tinygltf::Primitive & primitive, MeshData & me
 
             // Calculate a default value for the normals
             // by calculating the direction of the face of each triangle.
+            positions.materialize();
+            normals.clear();
             auto calculatedNormals = calculateTriangleNormals(indices.vec, positions.vec);
             normals.vec.assign(calculatedNormals.begin(), calculatedNormals.end());
             normals.width = 3;
@@ -123,6 +123,11 @@ bool GLTFMeshBuilder::build(const tinygltf::Primitive & primitive, MeshData & me
                             StridedBuffer<float> & texCoords, StridedBuffer<float> & normals) {
         // Check tangent
         if (tangents.count() != positions.count()) {
+            // The generators below work on vectors.
+            positions.materialize();
+            normals.materialize();
+            texCoords.materialize();
+            tangents.clear();
             if (texCoords.empty()) {
                 PH_LOGW("The mesh primitive is missing both tangent and texcoord. Generating from normal and aniso...");
                 auto nonAveragedTangents = calculateNonAveragedTangents(indices.vec, positions.vec, normals.vec);
@@ -154,11 +159,14 @@ bool GLTFMeshBuilder::build(const tinygltf::Primitive & primitive, MeshData & me
     // Check texcoord
     if (meshData.texCoords.count() != meshData.positions.count()) {
         PH_LOGW("Missing or incomplete texture coordinates.");
-        meshData.texCoords.vec.clear();
+        meshData.texCoords.clear();
     }
 
     checkTangents(meshData.tangents, meshData.positions, meshData.indices, meshData.texCoords, meshData.normals);
 
+    // Read morph targets, now that the attributes they displace are complete.
+    if (morphData) readMorphTargets(primitive, meshData, *morphData);
+
     // Since we were able to complete the mesh data, return true
     return true;
 }
@@ -309,34 +317,93 @@ void GLTFMeshBuilder::readWeights(int accessorId, std::vector<float> & weights)
 }
 
 const tinygltf::Accessor * GLTFMeshBuilder::readPositions(int accessorId, StridedBuffer<float> & positions) {
-    // Read the attribute.
-    _accessorReader.readAccessor(accessorId, positions.vec);
-
-    // Three floats per position
-    positions.width = 3;
+    // Read the attribute. Three floats per position
+    readAttribute(accessorId, 3, positions);
 
     // Store the accessor so that we can calculate the bounding box from it.
     return &(_model->accessors[accessorId]);
 }
 
 void GLTFMeshBuilder::readNormals(int accessorId, StridedBuffer<float> & normals) {
-    // Read the attribute.
-    _accessorReader.readAccessor(accessorId, normals.vec);
-
-    // Three floats per normal
-    normals.width = 3;
+    // Read the attribute. Three floats per normal
+    readAttribute(accessorId, 3, normals);
 }
 
 void GLTFMeshBuilder::readTangents(int accessorId, StridedBuffer<float> & tangents) {
-    // Read the attribute.
-    _accessorReader.readAccessor(accessorId, tangents.vec);
-
     // PhysRay tangents have type float3,
     // but GLTF tangents have type VEC4, where the w component is a
     // sign value indicating handedness of the tangent basis.
     // Use a component count of 3 and a stride of 4
     // to skip the w component.
-    tangents.width = 4;
+    readAttribute(accessorId, 4, tangents);
+}
+
+void GLTFMeshBuilder::readAttribute(int accessorId, uint16_t width, StridedBuffer<float> & attribute) {
+    attribute.clear();
+    attribute.width = width;
+
+    // Tightly packed floats are exactly what is uploaded to GPU,
+    // so reference them in place instead of copying the whole attribute.
+    auto view = _accessorReader.viewAccessor<float>(accessorId);
+    if (!view.empty() && view.packed() && view.width == width) {
+        attribute.view     = view.data;
+        attribute.viewSize = view.count * view.width;
+        return;
+    }
+
+    // Anything else is converted to floats.
+    _accessorReader.readAccessor(accessorId, attribute.vec);
+}
+
+void GLTFMeshBuilder::readMorphTargets(const tinygltf::Primitive & primitive, const MeshData & meshData, MorphTargetData & morphData) {
+    const size_t vertexCount = meshData.positions.count();
+
+    // Copy the original attributes as vec3, which is what the morph targets displace.
+    // Tangents are vec4 in glTF, the w component is dropped.
+    auto copyVec3 = [&](const StridedBuffer<float> & attribute, std::vector<float> & result) {
+        result.clear();
+        if (attribute.count() != vertexCount || attribute.width < 3) return;
+        result.reserve(vertexCount * 3);
+        for (size_t i = 0; i < vertexCount; ++i) {
+            const float * v = attribute.data() + i * attribute.width;
+            result.insert(result.end(), v, v + 3);
+        }
+    };
+    copyVec3(meshData.positions, morphData.origAttribs.positions);
+    copyVec3(meshData.normals, morphData.origAttribs.normals);
+    copyVec3(meshData.tangents, morphData.origAttribs.tangents);
+    morphData.origAttribs.count = vertexCount;
+
+    // Read the displacements of each target.
+    morphData.targets.resize(primitive.targets.size());
+    for (size_t t = 0; t < primitive.targets.size(); ++t) {
+        auto & target = morphData.targets[t];
+        target.count  = vertexCount;
+        for (const auto & [name, accessorId] : primitive.targets[t]) {
+            if (name == "POSITION") {
+                readTargetAttribute(accessorId, target.positions, target.positionIndices);
+            } else if (name == "NORMAL") {
+                readTargetAttribute(accessorId, target.normals, target.normalIndices);
+            } else if (name == "TANGENT") {
+                readTargetAttribute(accessorId, target.tangents, target.tangentIndices);
+            } else {
+                PH_LOGW("Unsupported morph target attribute type '%s'", name.c_str());
+            }
+        }
+    }
+}
+
+void GLTFMeshBuilder::readTargetAttribute(int accessorId, std::vector<float> & values, std::vector<uint32_t> & indices) {
+    const tinygltf::Accessor & accessor = _model->accessors[accessorId];
+    if (AccessorReader::getComponentCount(accessor) != 3) {
+        PH_LOGW("Morph target attribute has %zu components, instead of 3. The attribute is ignored.", AccessorReader::getComponentCount(accessor));
+        return;
+    }
+
+    // Targets often displace a small part of the mesh only. Keep sparse accessors sparse, instead of expanding them to all
+    // vertices. Anything else is read densely, and made sparse when the deltas are built.
+    if (_accessorReader.readSparseAccessor(accessor, indices, values)) return;
+    _accessorReader.readAccessor(accessor, values);
 }
 
 Eigen::AlignedBox3f GLTFMeshBuilder::toAlignedBox(const tinygltf::Accessor & accessor, const StridedBuffer<float> & positions) {
@@ -369,9 +436,9 @@ Eigen::AlignedBox3f GLTFMeshBuilder::toAlignedBox(const tinygltf::Accessor & acc
                 std::size_t positionStartIndex = positionIndex * positions.width;
 
                 // Determine the min for each dimension.
-                min.x() = std::min(min.x(), positions.vec[positionStartIndex + 0]);
-                min.y() = std::min(min.y(), positions.vec[positionStartIndex + 1]);
-                min.z() = std::min(min.z(), positions.vec[positionStartIndex + 2]);
+                min.x() = std::min(min.x(), positions.data()[positionStartIndex + 0]);
+                min.y() = std::min(min.y(), positions.data()[positionStartIndex + 1]);
+                min.z() = std::min(min.z(), positions.data()[positionStartIndex + 2]);
             }
         }
     }
@@ -401,9 +468,9 @@ Eigen::AlignedBox3f GLTFMeshBuilder::toAlignedBox(const tinygltf::Accessor & acc
                 std::size_t positionStartIndex = positionIndex * positions.width;
 
                 // Determine the max for each dimension.
-                max.x() = std::max(max.x(), positions.vec[positionStartIndex + 0]);
-                max.y() = std::max(max.y(), positions.vec[positionStartIndex + 1]);
-                max.z() = std::max(max.z(), positions.vec[positionStartIndex + 2]);
+                max.x() = std::max(max.x(), positions.data()[positionStartIndex + 0]);
+                max.y() = std::max(max.y(), positions.data()[positionStartIndex + 1]);
+                max.z() = std::max(max.z(), positions.data()[positionStartIndex + 2]);
             }
         }
     }
@@ -415,6 +482,20 @@ Eigen::AlignedBox3f GLTFMeshBuilder::toAlignedBox(const tinygltf::Accessor & acc
 void GLTFMeshBuilder::MeshData::append(GLTFMeshBuilder::MeshData & input) {
     PH_ASSERT(positions.empty() == indices.empty());
     PH_ASSERT(!input.positions.empty());
+
+    // The first primitive is taken over as is. So a mesh made of one primitive
+    // keeps viewing its attributes in the tinygltf buffers, all the way to upload.
+    if (positions.empty()) {
+        *this = std::move(input);
+        return;
+    }
+
+    // Merging primitives needs the data in vectors.
+    positions.materialize();
+    normals.materialize();
+    texCoords.materialize();
+    tangents.materialize();
+
     uint32_t vertexBase = (uint32_t) positions.count();
 
     if (input.indices.empty()) {
@@ -435,14 +516,14 @@ void GLTFMeshBuilder::MeshData::append(GLTFMeshBuilder::MeshData & input) {
         PH_ASSERT(positions.empty());
         positions.width = input.positions.width;
     }
-    positions.vec.insert(positions.vec.end(), input.positions.vec.begin(), input.positions.vec.end());
+    positions.vec.insert(positions.vec.end(), input.positions.data(), input.positions.data() + input.positions.size());
 
     PH_ASSERT(input.normals.count() == input.positions.count());
     if (normals.width != input.normals.width) {
         PH_ASSERT(normals.empty());
         normals.width = input.normals.width;
     }
-    normals.vec.insert(normals.vec.end(), input.normals.vec.begin(), input.normals.vec.end());
+    normals.vec.insert(normals.vec.end(), input.normals.data(), input.normals.data() + input.normals.size());
 
     if (input.texCoords.empty()) {
         if (!texCoords.empty()) {
@@ -459,7 +540,7 @@ void GLTFMeshBuilder::MeshData::append(GLTFMeshBuilder::MeshData & input) {
             texCoords.width = input.texCoords.width;
         }
         if (!texCoords.empty()) { PH_ASSERT(texCoords.width == input.texCoords.width); }
-        texCoords.vec.insert(texCoords.vec.end(), input.texCoords.vec.begin(), input.texCoords.vec.end());
+        texCoords.vec.insert(texCoords.vec.end(), input.texCoords.data(), input.texCoords.data() + input.texCoords.size());
         PH_ASSERT(input.texCoords.count() == input.positions.count());
     }
 
@@ -478,14 +559,14 @@ void GLTFMeshBuilder::MeshData::append(GLTFMeshBuilder::MeshData & input) {
             tangents.width = input.tangents.width;
         }
         if (tangents.width == input.tangents.width) {
-            tangents.vec.insert(tangents.vec.end(), input.tangents.vec.begin(), input.tangents.vec.end());
+            tangents.vec.insert(tangents.vec.end(), input.tangents.data(), input.tangents.data() + input.tangents.size());
         } else {
             PH_LOGW("Mesh includes primitives with mixed tangent strides: %d and %d", tangents.width, input.tangents.width);
             tangents.vec.reserve(tangents.vec.size() + tangents.width * input.tangents.count());
             auto width = std::min(tangents.width, input.tangents.width);
             auto count = input.tangents.count();
             for (size_t i = 0; i < count; i++) {
-                for (size_t j = 0; j < width; j++) { tangents.vec.push_back(input.tangents.vec[i * input.tangents.width + j]); }
+                for (size_t j = 0; j < width; j++) { tangents.vec.push_back(input.tangents.data()[i * input.tangents.width + j]); }
                 for (size_t j = width; j < tangents.width; j++) { tangents.vec.push_back(0); }
             }
         }
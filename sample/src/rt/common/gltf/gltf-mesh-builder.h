@@ -24,8 +24,8 @@ namespace gltf {
  */
 class GLTFMeshBuilder {
 public:
-    GLTFMeshBuilder(const tinygltf::Model * model, skinning::SkinMap * skinnedMeshes, MorphTargetMap *, SceneBuildBuffers *)
-        : _model(model), _accessorReader(model), _skinnedMeshes(skinnedMeshes) {} //, _morphTargets(morphTargets), _sbb(sbb) {};
+    GLTFMeshBuilder(const tinygltf::Model * model, skinning::SkinMap * skinnedMeshes, SceneBuildBuffers *)
+        : _model(model), _accessorReader(model), _skinnedMeshes(skinnedMeshes) {} //, _sbb(sbb) {};
 
     /**
      *
@@ -37,15 +37,39 @@ public:
      */
     const tinygltf::Model * getModel() const { return _model; }
 
+    /**
+     * Attribute data of a mesh, owned in vec, or viewed in place in the
+     * tinygltf buffer when the accessor needs no conversion. A view is only
+     * valid while the model is alive, and is read only: call materialize()
+     * before modifying vec.
+     */
     template<typename T>
     struct StridedBuffer {
         std::vector<T> vec;
-        uint16_t       width = 1;
+        uint16_t       width    = 1;
+        const T *      view     = nullptr; ///< tightly packed data in the tinygltf buffer. Used instead of vec when not null.
+        size_t         viewSize = 0;       ///< number of components in view.
         uint16_t       stride() const { return width * sizeof(T); };
-        T *            data() { return vec.data(); };
-        size_t         size() const { return vec.size(); };
-        bool           empty() const { return vec.empty(); };
-        size_t         count() const { return vec.size() / width; };
+        const T *      data() const { return view ? view : vec.data(); };
+        size_t         size() const { return view ? viewSize : vec.size(); };
+        bool           empty() const { return 0 == size(); };
+        size_t         count() const { return size() / width; };
+
+        /**
+         * Copies viewed data into vec, so it can be modified.
+         */
+        void materialize() {
+            if (!view) return;
+            vec.assign(view, view + viewSize);
+            view     = nullptr;
+            viewSize = 0;
+        }
+
+        void clear() {
+            vec.clear();
+            view     = nullptr;
+            viewSize = 0;
+        }
     };
 
     struct MeshData {
@@ -55,6 +79,14 @@ public:
         StridedBuffer<float>    texCoords;
         StridedBuffer<float>    tangents;
 
+        /**
+         * Appends a primitive to the mesh. Data of the input might be moved
+         * out, so it should not be used afterwards.
+         *
+         * Only the first primitive keeps its views. Appending a second one
+         * copies all attributes into vectors, so meshes made of several
+         * primitives still hold a full copy of their vertex data.
+         */
         void append(MeshData & input);
     };
 
@@ -66,9 +98,11 @@ public:
      * @param bbox Stores the bounding box of the mesh.
      * Note that this does NOT take into account the skin and will therefore be
      * inaccurate for a skinned mesh.
+     * @param morphData Stores the morph targets of the primitive, if not null.
      * @return true if successfully converted, false otherwise.
      */
-    bool build(const tinygltf::Primitive & primitive, MeshData & meshData, Eigen::AlignedBox3f & bbox, skinning::SkinningData & skinData);
+    bool build(const tinygltf::Primitive & primitive, MeshData & meshData, Eigen::AlignedBox3f & bbox, skinning::SkinningData & skinData,
+               MorphTargetData * morphData);
 
 private:
     /**
@@ -106,8 +140,25 @@ private:
 
     void readTangents(int accessorId, StridedBuffer<float> & tangents);
 
+    /**
+     * Reads a float attribute of the given width. The attribute is viewed in
+     * place if it is tightly packed floats, and copied to the vector otherwise.
+     */
+    void readAttribute(int accessorId, uint16_t width, StridedBuffer<float> & attribute);
+
+    /**
+     * Reads the morph targets of the primitive, along with the original
+     * attributes they displace. Must be called after the mesh data is complete.
+     */
+    void readMorphTargets(const tinygltf::Primitive & primitive, const MeshData & meshData, MorphTargetData & morphData);
+
+    /**
+     * Reads one attribute of a morph target as vec3. Sparse accessors stay
+     * sparse: only the displaced vertices and their values are read.
+     */
+    void readTargetAttribute(int accessorId, std::vector<float> & values, std::vector<uint32_t> & indices);
+
     skinning::SkinMap * _skinnedMeshes;
-    // MorphTargetMap *    _morphTargets;
     // SceneBuildBuffers * _sbb;
 };
 
@@ -12,7 +12,10 @@
 #include "physray-type-converter.h"
 #include "mesh-utils.h"
 #include "../simpleApp.h"
+#include "../thread-pool.h"
 
+#include <algorithm>
+#include <chrono>
 #include <limits>
 #include <string>
 #include <vector>
@@ -44,9 +47,9 @@ static void buildNodeGraph(const tinygltf::Model * model, SceneAsset * sceneAsse
 
 GLTFSceneAssetBuilder::GLTFSceneAssetBuilder(ph::AssetSystem * assetSys, TextureCache * textureCache, sg::Graph * graph, const tinygltf::Model * model,
                                              const std::string & assetBaseDirectory, skinning::SkinMap * skinnedMeshes, MorphTargetManager * morphTargetManager,
-                                             SceneBuildBuffers * sbb, bool createGeomLights)
+                                             SceneBuildBuffers * sbb, bool createGeomLights, bool parallel)
     : _assetSys(assetSys), _textureCache(textureCache), _graph(graph), _model(model), _assetBaseDirectory(assetBaseDirectory), _accessorReader(model),
-      _skinnedMeshes(skinnedMeshes), _morphTargetManager(morphTargetManager), _sbb(sbb), _createGeomLights(createGeomLights) {
+      _skinnedMeshes(skinnedMeshes), _morphTargetManager(morphTargetManager), _sbb(sbb), _createGeomLights(createGeomLights), _parallel(parallel) {
     // convert all of the resource objects first.
     convertResources();
 }
@@ -91,47 +94,77 @@ std::shared_ptr<SceneAsset> GLTFSceneAssetBuilder::build() {
 }
 
 void GLTFSceneAssetBuilder::convertResources() {
+    using namespace std::chrono;
+
     // Prepare the images for use by ph.
     // Stores the images in the gltf file.
     // We only need this long enough to load the materials.
     PH_LOGI("[GLTF] converting images....");
+    auto                      begin = high_resolution_clock::now();
     std::vector<ph::RawImage> images;
-    convertImages(images);
+    std::vector<std::string>  imagePaths;
+    convertImages(images, imagePaths);
+    auto imagesDone = high_resolution_clock::now();
 
     // Create the materials used to color the mesh views.
     PH_LOGI("[GLTF] converting materials....");
-    convertMaterials(images);
+    convertMaterials(images, imagePaths);
+    auto materialsDone = high_resolution_clock::now();
 
     // Parse the PhysRay meshes.
     PH_LOGI("[GLTF] converting meshes....");
     convertMeshes();
+    auto meshesDone = high_resolution_clock::now();
+
+    PH_LOGI("[GLTF] resources converted%s: images = %s, materials = %s, meshes = %s.", _parallel ? " (parallel)" : "",
+            ns2str(duration_cast<nanoseconds>(imagesDone - begin).count()).c_str(),
+            ns2str(duration_cast<nanoseconds>(materialsDone - imagesDone).count()).c_str(),
+            ns2str(duration_cast<nanoseconds>(meshesDone - materialsDone).count()).c_str());
 }
 
-void GLTFSceneAssetBuilder::convertImages(std::vector<ph::RawImage> & images) {
+void GLTFSceneAssetBuilder::convertImages(std::vector<ph::RawImage> & images, std::vector<std::string> & imagePaths) {
     // Load all the backing images.
     GLTFImageBuilder imageBuilder(_assetSys, _assetBaseDirectory);
 
     // Instantiate all the PhysRay image objects that will be loaded into.
     images.resize(_model->images.size());
 
-    // Iterate all the gltf images.
-    for (std::size_t index = 0; index < _model->images.size(); ++index) {
-        // Fetch the image to be loaded.
-        const tinygltf::Image & image = _model->images[index];
-
-        // Load the image into the matching PhysRay object.
-        imageBuilder.build(image, images[index]);
+    // Images in files of their own are loaded by the texture cache in background, after the scene is built. Only
+    // decode the ones embedded in the model, and the ones spliced into ORM maps.
+    imagePaths.resize(_model->images.size());
+    std::vector<bool> decode(_model->images.size());
+    GLTFMaterialBuilder::markSplicedImages(*_model, decode);
+    for (std::size_t index = 0; index < imagePaths.size(); ++index) {
+        imagePaths[index] = imageBuilder.getAssetPath(_model->images[index]);
+        if (imagePaths[index].empty()) decode[index] = true;
     }
+
+    // Decoding images is pure CPU work and each image goes to its own slot. So they can be decoded concurrently.
+    auto loadImages = [&](size_t begin, size_t end) {
+        for (std::size_t index = begin; index < end; ++index) {
+            if (!decode[index]) continue;
+
+            // Fetch the image to be loaded.
+            const tinygltf::Image & image = _model->images[index];
+
+            // Load the image into the matching PhysRay object.
+            imageBuilder.build(image, images[index]);
+        }
+    };
+    if (_parallel)
+        ThreadPool::shared().parallelFor(images.size(), 1, loadImages);
+    else
+        loadImages(0, images.size());
 }
 
-void GLTFSceneAssetBuilder::convertMaterials(const std::vector<ph::RawImage> & images) {
+void GLTFSceneAssetBuilder::convertMaterials(const std::vector<ph::RawImage> & images, const std::vector<std::string> & imagePaths) {
     // Make sure collection of materials is big enough to hold everything.
     _materials.reserve(_model->materials.size());
 
     // Create a builder to create each material.
-    GLTFMaterialBuilder builder(_textureCache, &_graph->scene(), _model, &images);
+    GLTFMaterialBuilder builder(_textureCache, &_graph->scene(), _model, &images, &imagePaths);
 
-    // Iterate materials.
+    // Iterate materials. Note that this is always done on the loading thread, since it creates textures and materials.
     for (std::size_t materialId = 0; materialId < _model->materials.size(); ++materialId) {
         // Fetch the material to be converted.
         const tinygltf::Material & material = _model->materials[materialId];
@@ -151,156 +184,200 @@ void GLTFSceneAssetBuilder::convertMeshes() {
     // Ensure there is a slot for each mesh.
     _meshToPrimitives.resize(_model->meshes.size());
 
-    // Create the object that will build each mesh.
-    GLTFMeshBuilder builder(_model, _skinnedMeshes, _morphTargetManager->getMorphTargets(), _sbb);
-
-    // Iterate all meshes.
-    for (std::size_t meshId = 0; meshId < _model->meshes.size(); ++meshId) {
-        // Fetch the tinygltf mesh to be converted.
-        const tinygltf::Mesh & mesh = _model->meshes[meshId];
-
-        // Get this mesh's list of converted PhysRay meshes.
-        std::vector<PrimitiveData> & primitives = _meshToPrimitives[meshId];
-
-        // Ensure there is enough space for all primitives.
-        primitives.reserve(mesh.primitives.size());
-
-        GLTFMeshBuilder::MeshData           meshData;
-        std::vector<skinning::SkinningData> primitiveSkinningData;
-
-        // Iterate the mesh's list of primitives.
-        for (std::size_t primitiveIndex = 0; primitiveIndex < mesh.primitives.size(); ++primitiveIndex) {
-            // Fetch the primitive to be converted.
-            const tinygltf::Primitive & primitive = mesh.primitives[primitiveIndex];
-
-            PrimitiveData             primitiveData;
-            GLTFMeshBuilder::MeshData meshPrimitiveData;
-            skinning::SkinningData    skinningData;
-
-            // If conversion succeeded, record it.
-            if (builder.build(primitive, meshPrimitiveData, primitiveData.bbox, skinningData)) {
-                // Store subset data
-                primitiveData.subset.material   = getMaterial(primitive.material);
-                primitiveData.subset.indexBase  = meshData.indices.count();
-                primitiveData.subset.indexCount = meshPrimitiveData.indices.count();
-
-                // Store vertex offsets for this primitive within the mesh
-                skinningData.submeshOffset = meshData.positions.count();
-                skinningData.submeshSize   = meshPrimitiveData.positions.count();
-
-                // Add meshPrimitivData to meshData
-                meshData.append(meshPrimitiveData);
-
-                // Save it to the set of PhysRay meshes for this tiny gltf mesh.
-                primitives.push_back(primitiveData);
-
-                // Save SkinningData to vector
-                primitiveSkinningData.emplace_back(skinningData);
-
-                // TODO: Move and reenable morphTargets
-                /*
-                // Add morph weights
-                if (_morphTargetManager) {
-                    std::vector<float> floatWeights;
-                    size_t             numWeights = mesh.weights.size();
-                    floatWeights.resize(numWeights);
-                    for (size_t i = 0; i < numWeights; i++) { floatWeights[i] = float(mesh.weights[i]); }
-                    _morphTargetManager->setWeights(primitiveData.mesh, floatWeights);
-                }
-                */
-
-                // If conversion failed, fire a warning and skip.
-            } else {
-                PH_LOGW("Primitive number %zu of mesh %zu not supported.", primitiveIndex, meshId);
-            }
+    // Meshes are converted in batches: vertex data of a batch is extracted in parallel, then uploaded and turned into
+    // PhysRay meshes one by one on this thread. Batching bounds the amount of CPU side vertex data alive at any moment.
+    const size_t               batchSize = _parallel ? (ThreadPool::shared().threadCount() + 1) * 4 : 1;
+    std::vector<ExtractedMesh> batch(std::min(batchSize, _model->meshes.size()));
+    for (std::size_t first = 0; first < _model->meshes.size(); first += batchSize) {
+        std::size_t count   = std::min(batchSize, _model->meshes.size() - first);
+        auto        extract = [&](size_t begin, size_t end) {
+            // Create the object that will build each mesh. One per chunk, since the builder is not thread safe.
+            GLTFMeshBuilder builder(_model, _skinnedMeshes, _sbb);
+            for (size_t i = begin; i < end; ++i) extractMesh(builder, first + i, batch[i]);
+        };
+        if (_parallel)
+            ThreadPool::shared().parallelFor(count, 1, extract);
+        else
+            extract(0, count);
+
+        for (std::size_t i = 0; i < count; ++i) {
+            createMesh(first + i, batch[i]);
+            batch[i] = {}; // release CPU side data as soon as possible.
         }
+    }
+}
 
-        ph::rt::Mesh::CreateParameters parameters = {};
-
-        parameters.vertexCount = meshData.positions.count();
-        // parameters.vertices.position.buffer = _sbb->uploadData(meshData.positions.data(), meshData.positions.size());
-        ConstRange<float, size_t> pos(meshData.positions.data(), meshData.positions.size());
-        parameters.vertices.position.buffer = _sbb->allocatePermanentBuffer<float>(pos, formatstr("%s:position", mesh.name.c_str()))->buffer;
-        parameters.vertices.position.stride = meshData.positions.stride();
-        parameters.vertices.position.format = VK_FORMAT_R32G32B32_SFLOAT;
-
-        PH_ASSERT(meshData.normals.count() == parameters.vertexCount);
-        // parameters.vertices.normal.buffer = _sbb->uploadData(meshData.normals.data(), meshData.normals.size());
-        ConstRange<float, size_t> norm(meshData.normals.data(), meshData.normals.size());
-        parameters.vertices.normal.buffer = _sbb->allocatePermanentBuffer<float>(norm, formatstr("%s:normal", mesh.name.c_str()))->buffer;
-        parameters.vertices.normal.stride = meshData.normals.stride();
-        parameters.vertices.normal.format = VK_FORMAT_R32G32B32_SFLOAT;
-
-        if (!meshData.texCoords.empty()) {
-            PH_ASSERT(meshData.texCoords.count() == parameters.vertexCount);
-            // parameters.vertices.texcoord.buffer = _sbb->uploadData(meshData.texCoords.data(), meshData.texCoords.size());
-            ConstRange<float, size_t> texs(meshData.texCoords.data(), meshData.texCoords.size());
-            parameters.vertices.texcoord.buffer = _sbb->allocatePermanentBuffer<float>(texs, formatstr("%s:texcoord", mesh.name.c_str()))->buffer;
-            parameters.vertices.texcoord.stride = meshData.texCoords.stride();
-            parameters.vertices.texcoord.format = VK_FORMAT_R32G32_SFLOAT;
-        }
+void GLTFSceneAssetBuilder::extractMesh(GLTFMeshBuilder & builder, std::size_t meshId, ExtractedMesh & result) const {
+    // Fetch the tinygltf mesh to be converted.
+    const tinygltf::Mesh & mesh = _model->meshes[meshId];
+
+    // Ensure there is enough space for all primitives.
+    result.primitives.reserve(mesh.primitives.size());
+    result.materialIds.reserve(mesh.primitives.size());
+    result.skinningData.reserve(mesh.primitives.size());
+
+    // Morph targets displace the whole mesh. So once any primitive has them, all primitives keep their original attributes.
+    const bool morphed =
+        _morphTargetManager && std::any_of(mesh.primitives.begin(), mesh.primitives.end(), [](const auto & p) { return !p.targets.empty(); });
+
+    // Iterate the mesh's list of primitives.
+    for (std::size_t primitiveIndex = 0; primitiveIndex < mesh.primitives.size(); ++primitiveIndex) {
+        // Fetch the primitive to be converted.
+        const tinygltf::Primitive & primitive = mesh.primitives[primitiveIndex];
+
+        PrimitiveData             primitiveData;
+        GLTFMeshBuilder::MeshData meshPrimitiveData;
+        skinning::SkinningData    skinningData;
+        MorphTargetData           morphData;
+
+        // If conversion succeeded, record it.
+        if (builder.build(primitive, meshPrimitiveData, primitiveData.bbox, skinningData, morphed ? &morphData : nullptr)) {
+            // Store subset data. Material is resolved later in createMesh(), on the loading thread.
+            primitiveData.subset.indexBase  = result.meshData.indices.count();
+            primitiveData.subset.indexCount = meshPrimitiveData.indices.count();
+
+            // Store vertex offsets for this primitive within the mesh
+            skinningData.submeshOffset = result.meshData.positions.count();
+            skinningData.submeshSize   = meshPrimitiveData.positions.count();
+
+            // Add meshPrimitivData to meshData
+            result.meshData.append(meshPrimitiveData);
+
+            // Save it to the set of PhysRay meshes for this tiny gltf mesh.
+            result.primitives.push_back(primitiveData);
+            result.materialIds.push_back(primitive.material);
 
-        if (!meshData.tangents.empty()) {
-            PH_ASSERT(meshData.tangents.count() == parameters.vertexCount);
-            // parameters.vertices.tangent.buffer = _sbb->uploadData(meshData.tangents.data(), meshData.tangents.size());
-            ConstRange<float, size_t> tans(meshData.tangents.data(), meshData.tangents.size());
-            parameters.vertices.tangent.buffer = _sbb->allocatePermanentBuffer<float>(tans, formatstr("%s:tangent", mesh.name.c_str()))->buffer;
-            parameters.vertices.tangent.stride = meshData.tangents.stride();
-            parameters.vertices.tangent.format = VK_FORMAT_R32G32B32_SFLOAT;
+            // Save SkinningData to vector
+            result.skinningData.emplace_back(skinningData);
+
+            // Add morph targets. Their vertices are moved to where the primitive is in the mesh.
+            if (morphed) result.morphData.append(morphData, skinningData.submeshOffset);
+
+            // If conversion failed, fire a warning and skip.
+        } else {
+            PH_LOGW("Primitive number %zu of mesh %zu not supported.", primitiveIndex, meshId);
         }
+    }
+}
 
-        if (!meshData.indices.empty()) {
-            if (parameters.vertexCount <= 0xFFFF) {
-                // convert to 16-bit index buffer to save memory footprint.
-                std::vector<uint16_t> idx16;
-                idx16.reserve(meshData.indices.size());
-                for (auto idx : meshData.indices.vec) {
-                    PH_ASSERT(idx < 0x10000);
-                    idx16.push_back((uint16_t) idx);
-                }
-                parameters.indexBuffer = _sbb->allocatePermanentBuffer<uint16_t>(idx16, formatstr("%s:indices", mesh.name.c_str()))->buffer;
-                parameters.indexCount  = meshData.indices.count();
-                parameters.indexStride = 2;
-            } else {
-                ConstRange<uint32_t, size_t> inds(meshData.indices.data(), meshData.indices.size());
-                parameters.indexBuffer = _sbb->allocatePermanentBuffer<uint32_t>(inds, formatstr("%s:indices", mesh.name.c_str()))->buffer;
-                parameters.indexCount  = meshData.indices.count();
-                parameters.indexStride = meshData.indices.stride();
+void GLTFSceneAssetBuilder::createMesh(std::size_t meshId, ExtractedMesh & extracted) {
+    // Fetch the tinygltf mesh to be converted.
+    const tinygltf::Mesh & mesh = _model->meshes[meshId];
+
+    // Resolve materials. This might lazily create the default material, so it has to be done here.
+    for (size_t i = 0; i < extracted.primitives.size(); ++i) extracted.primitives[i].subset.material = getMaterial(extracted.materialIds[i]);
+
+    ph::rt::Mesh::CreateParameters parameters = {};
+
+    parameters.vertexCount = extracted.meshData.positions.count();
+    // parameters.vertices.position.buffer = _sbb->uploadData(extracted.meshData.positions.data(), extracted.meshData.positions.size());
+    ConstRange<float, size_t> pos(extracted.meshData.positions.data(), extracted.meshData.positions.size());
+    auto positionRange                  = _sbb->allocatePermanentRange<float>(pos, formatstr("%s:position", mesh.name.c_str()));
+    parameters.vertices.position.buffer = positionRange.buffer;
+    parameters.vertices.position.offset = positionRange.offset;
+    parameters.vertices.position.stride = extracted.meshData.positions.stride();
+    parameters.vertices.position.format = VK_FORMAT_R32G32B32_SFLOAT;
+
+    PH_ASSERT(extracted.meshData.normals.count() == parameters.vertexCount);
+    // parameters.vertices.normal.buffer = _sbb->uploadData(extracted.meshData.normals.data(), extracted.meshData.normals.size());
+    ConstRange<float, size_t> norm(extracted.meshData.normals.data(), extracted.meshData.normals.size());
+    auto normalRange                  = _sbb->allocatePermanentRange<float>(norm, formatstr("%s:normal", mesh.name.c_str()));
+    parameters.vertices.normal.buffer = normalRange.buffer;
+    parameters.vertices.normal.offset = normalRange.offset;
+    parameters.vertices.normal.stride = extracted.meshData.normals.stride();
+    parameters.vertices.normal.format = VK_FORMAT_R32G32B32_SFLOAT;
+
+    if (!extracted.meshData.texCoords.empty()) {
+        PH_ASSERT(extracted.meshData.texCoords.count() == parameters.vertexCount);
+        // parameters.vertices.texcoord.buffer = _sbb->uploadData(extracted.meshData.texCoords.data(), extracted.meshData.texCoords.size());
+        ConstRange<float, size_t> texs(extracted.meshData.texCoords.data(), extracted.meshData.texCoords.size());
+        auto texcoordRange                  = _sbb->allocatePermanentRange<float>(texs, formatstr("%s:texcoord", mesh.name.c_str()));
+        parameters.vertices.texcoord.buffer = texcoordRange.buffer;
+        parameters.vertices.texcoord.offset = texcoordRange.offset;
+        parameters.vertices.texcoord.stride = extracted.meshData.texCoords.stride();
+        parameters.vertices.texcoord.format = VK_FORMAT_R32G32_SFLOAT;
+    }
+
+    if (!extracted.meshData.tangents.empty()) {
+        PH_ASSERT(extracted.meshData.tangents.count() == parameters.vertexCount);
+        // parameters.vertices.tangent.buffer = _sbb->uploadData(extracted.meshData.tangents.data(), extracted.meshData.tangents.size());
+        ConstRange<float, size_t> tans(extracted.meshData.tangents.data(), extracted.meshData.tangents.size());
+        auto tangentRange                  = _sbb->allocatePermanentRange<float>(tans, formatstr("%s:tangent", mesh.name.c_str()));
+        parameters.vertices.tangent.buffer = tangentRange.buffer;
+        parameters.vertices.tangent.offset = tangentRange.offset;
+        parameters.vertices.tangent.stride = extracted.meshData.tangents.stride();
+        parameters.vertices.tangent.format = VK_FORMAT_R32G32B32_SFLOAT;
+    }
+
+    if (!extracted.meshData.indices.empty()) {
+        if (parameters.vertexCount <= 0xFFFF) {
+            // convert to 16-bit index buffer to save memory footprint.
+            std::vector<uint16_t> idx16;
+            idx16.reserve(extracted.meshData.indices.size());
+            for (auto idx : extracted.meshData.indices.vec) {
+                PH_ASSERT(idx < 0x10000);
+                idx16.push_back((uint16_t) idx);
             }
+            auto indexRange        = _sbb->allocatePermanentRange<uint16_t>(idx16, formatstr("%s:indices", mesh.name.c_str()));
+            parameters.indexBuffer = indexRange.buffer;
+            parameters.indexOffset = indexRange.offset;
+            parameters.indexCount  = extracted.meshData.indices.count();
+            parameters.indexStride = 2;
+        } else {
+            ConstRange<uint32_t, size_t> inds(extracted.meshData.indices.data(), extracted.meshData.indices.size());
+            auto indexRange        = _sbb->allocatePermanentRange<uint32_t>(inds, formatstr("%s:indices", mesh.name.c_str()));
+            parameters.indexBuffer = indexRange.buffer;
+            parameters.indexOffset = indexRange.offset;
+            parameters.indexCount  = extracted.meshData.indices.count();
+            parameters.indexStride = extracted.meshData.indices.stride();
         }
+    }
 
-        // Create the mesh and save it to the primitives' data
-        PH_DLOGI("Creating mesh %s with %zu indices and %zu vertices", mesh.name.c_str(), parameters.indexCount, parameters.vertexCount);
-        auto phMesh  = _graph->world().createMesh(parameters);
-        phMesh->name = mesh.name.c_str();
-
-        // Check if this primitive has skinning data & add it to _skinnedMeshes if it does
-        if (_skinnedMeshes) {
-            for (size_t i = 0; i < primitives.size(); i++) {
-                primitives[i].mesh = phMesh;
-
-                // Check if there are joints.
-                const auto & joints = primitiveSkinningData[i].joints;
-                if (joints.empty()) continue;
-
-                // Check if joints are incomplete.
-                const auto & skinPositions = primitiveSkinningData[i].origPositions;
-                if (joints.size() / 4 != skinPositions.size() / 3) {
-                    PH_LOGW("Incomplete joints."); // Log what went wrong.
-                    continue;
-                }
-
-                // Check if weights are incomplete.
-                const auto & weights = primitiveSkinningData[i].weights;
-                if (weights.size() / 4 != skinPositions.size() / 3) {
-                    PH_LOGW("Incomplete weights."); // Log what went wrong.
-                    continue;
-                }
+    // Create the mesh and save it to the primitives' data
+    PH_DLOGI("Creating mesh %s with %zu indices and %zu vertices", mesh.name.c_str(), parameters.indexCount, parameters.vertexCount);
+    auto phMesh  = _graph->world().createMesh(parameters);
+    phMesh->name = mesh.name.c_str();
+
+    // Check if this primitive has skinning data & add it to _skinnedMeshes if it does
+    if (_skinnedMeshes) {
+        for (size_t i = 0; i < extracted.primitives.size(); i++) {
+            extracted.primitives[i].mesh = phMesh;
+
+            // Check if there are joints.
+            const auto & joints = extracted.skinningData[i].joints;
+            if (joints.empty()) continue;
+
+            // Check if joints are incomplete.
+            const auto & skinPositions = extracted.skinningData[i].origPositions;
+            if (joints.size() / 4 != skinPositions.size() / 3) {
+                PH_LOGW("Incomplete joints."); // Log what went wrong.
+                continue;
+            }
 
-                _skinnedMeshes->emplace(std::make_pair(phMesh, primitiveSkinningData));
+            // Check if weights are incomplete.
+            const auto & weights = extracted.skinningData[i].weights;
+            if (weights.size() / 4 != skinPositions.size() / 3) {
+                PH_LOGW("Incomplete weights."); // Log what went wrong.
+                continue;
             }
+
+            _skinnedMeshes->emplace(std::make_pair(phMesh, extracted.skinningData));
         }
     }
+
+    // Hand the morph targets over to the manager, with the default weights of the mesh.
+    if (_morphTargetManager && !extracted.morphData.targets.empty()) {
+        std::vector<float> weights(extracted.morphData.targets.size(), 0.0f);
+        if (mesh.weights.size() == weights.size())
+            std::transform(mesh.weights.begin(), mesh.weights.end(), weights.begin(), [](double w) { return (float) w; });
+        else if (!mesh.weights.empty())
+            PH_LOGW("Mesh %s has %zu weights, but %zu morph targets. Default weights are ignored.", mesh.name.c_str(), mesh.weights.size(), weights.size());
+        (*_morphTargetManager->getMorphTargets())[phMesh] = std::move(extracted.morphData);
+        _morphTargetManager->setWeights(phMesh, weights);
+    }
+
+    // Save it to the set of PhysRay meshes for this tiny gltf mesh.
+    _meshToPrimitives[meshId] = std::move(extracted.primitives);
 }
 
 ph::rt::Material * GLTFSceneAssetBuilder::getDefaultMaterial() {
@@ -10,6 +10,7 @@
 #include <ph/rt-utils.h>
 
 #include "accessor-reader.h"
+#include "gltf-mesh-builder.h"
 #include "../scene-asset.h"
 #include "../texture-cache.h"
 #include "../skinning.h"
@@ -37,10 +38,12 @@ public:
      * being instantiated in scene.
      * @param assetBaseDirectory The path holding the directory where
      * the gltf file is located. Is used to resolve relative paths.
+     * @param parallel Decode images and extract mesh data on multiple threads.
+     * Materials and GPU resources are always created on the calling thread.
      */
     GLTFSceneAssetBuilder(ph::AssetSystem * assetSys, TextureCache * textureCache, sg::Graph * graph, const tinygltf::Model * model,
                           const std::string & assetBaseDirectory, skinning::SkinMap * skinnedMeshes, MorphTargetManager * morphTargetManager,
-                          SceneBuildBuffers * sbb, bool createGeomLights);
+                          SceneBuildBuffers * sbb, bool createGeomLights, bool parallel = true);
 
     /**
      * Destructor.
@@ -86,6 +89,38 @@ private:
         Eigen::AlignedBox3f bbox;
     };
 
+    /**
+     * CPU side data extracted from all primitives of one tiny gltf mesh.
+     * Produced by extractMesh(), which touches no GPU or scene objects,
+     * so multiple meshes can be extracted concurrently.
+     */
+    struct ExtractedMesh {
+        /**
+         * Vertex and index data of all primitives, appended together.
+         */
+        GLTFMeshBuilder::MeshData meshData;
+
+        /**
+         * Converted primitives. Mesh and material are not assigned yet.
+         */
+        std::vector<PrimitiveData> primitives;
+
+        /**
+         * Tiny gltf material id of each converted primitive.
+         */
+        std::vector<int> materialIds;
+
+        /**
+         * Skinning data of each converted primitive.
+         */
+        std::vector<skinning::SkinningData> skinningData;
+
+        /**
+         * Morph targets of all converted primitives, merged like meshData.
+         */
+        MorphTargetData morphData;
+    };
+
     /**
      * The main asset system to load files from.
      */
@@ -156,18 +191,23 @@ private:
 
     /**
      * Converts all tiny gltf images to their PhysRay equivelant and then
-     * saves them to the given collection
+     * saves them to the given collection. Images stored in files of their
+     * own are left empty, and streamed in by the texture cache later, unless
+     * their pixels are needed to build the materials.
      * @param images The collection the generated images will be saved to.
+     * @param imagePaths Stores the asset path of each image. Empty for
+     * images embedded in the model.
      */
-    void convertImages(std::vector<ph::RawImage> & images);
+    void convertImages(std::vector<ph::RawImage> & images, std::vector<std::string> & imagePaths);
 
     /**
      * Converts all tiny gltf materials to their PhysRay equivelant and then
      * saves them to the materials variable.
      * @param images Collection of gltf images loaded to ph,
      * indexed by image id.
+     * @param imagePaths Asset path of each image, indexed by image id.
      */
-    void convertMaterials(const std::vector<ph::RawImage> & images);
+    void convertMaterials(const std::vector<ph::RawImage> & images, const std::vector<std::string> & imagePaths);
 
     /**
      * Converts all tiny gltf meshes to a list of the equivelant PhysRay meshes.
@@ -176,6 +216,18 @@ private:
      */
     void convertMeshes();
 
+    /**
+     * Extracts vertex and index data of all primitives of a tiny gltf mesh.
+     * This method is thread safe, as long as each thread uses its own mesh builder.
+     */
+    void extractMesh(GLTFMeshBuilder & builder, std::size_t meshId, ExtractedMesh & result) const;
+
+    /**
+     * Uploads extracted mesh data to GPU and creates the PhysRay mesh out of it.
+     * Must be called on the loading thread.
+     */
+    void createMesh(std::size_t meshId, ExtractedMesh & extracted);
+
     /**
      * @return The default material used if no material is provided,
      * lazy initializes it if necessary.
@@ -230,6 +282,11 @@ private:
     void addNodeLight(SceneAsset * sceneAsset, sg::Node * phNode, int lightId);
 
     bool _createGeomLights;
+
+    /**
+     * Convert images and meshes on multiple threads.
+     */
+    bool _parallel;
 };
 
 } // namespace gltf
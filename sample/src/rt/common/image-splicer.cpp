@@ -7,8 +7,98 @@
  */
 #include "pch.h"
 #include "image-splicer.h"
+#include "thread-pool.h"
 
 #include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+    #include <emmintrin.h>
+    #define SPLICE_SSE2 1
+#elif defined(__ARM_NEON)
+    #include <arm_neon.h>
+    #define SPLICE_NEON 1
+#endif
+
+namespace {
+
+// RGBA8 pixels are handled as little endian 32-bit integers, with channel c in bits [8c, 8c + 8). Moving a channel
+// from one pixel position to another is then a shift plus a mask, which works the same for 4 pixels in a SIMD register.
+
+// How one source moves some of its channels into the destination pixel: dst |= ((src << left) >> right) & mask.
+struct Term {
+    uint32_t left;
+    uint32_t right;
+    uint32_t mask;
+};
+
+// A source image, shared by all channels reading from it.
+struct Source {
+    const ph::ImageProxy * proxy;
+    ph::ColorFormat        format;
+    bool                   rgba8;
+    bool                   sameWidth;
+    uint32_t               channels = 0; // bit mask of source channels in use.
+    std::vector<size_t>    xmap;         // source x of each destination x. Empty if the source has the same width.
+    std::vector<Term>      terms;
+};
+
+// Apply one term to a whole row.
+void spliceRow(uint8_t * dst, const uint8_t * src, size_t width, const Term & t) {
+    size_t x = 0;
+#if SPLICE_SSE2
+    __m128i mask  = _mm_set1_epi32((int) t.mask);
+    __m128i left  = _mm_cvtsi32_si128((int) t.left);
+    __m128i right = _mm_cvtsi32_si128((int) t.right);
+    for (; x + 4 <= width; x += 4) {
+        __m128i s = _mm_srl_epi32(_mm_sll_epi32(_mm_loadu_si128((const __m128i *) (src + x * 4)), left), right);
+        __m128i d = _mm_loadu_si128((const __m128i *) (dst + x * 4));
+        _mm_storeu_si128((__m128i *) (dst + x * 4), _mm_or_si128(d, _mm_and_si128(s, mask)));
+    }
+#elif SPLICE_NEON
+    uint32x4_t mask  = vdupq_n_u32(t.mask);
+    int32x4_t  left  = vdupq_n_s32((int32_t) t.left);
+    int32x4_t  right = vdupq_n_s32(-(int32_t) t.right); // negative count shifts to the right.
+    for (; x + 4 <= width; x += 4) {
+        uint32x4_t s = vshlq_u32(vshlq_u32(vreinterpretq_u32_u8(vld1q_u8(src + x * 4)), left), right);
+        uint32x4_t d = vreinterpretq_u32_u8(vld1q_u8(dst + x * 4));
+        vst1q_u8(dst + x * 4, vreinterpretq_u8_u32(vorrq_u32(d, vandq_u32(s, mask))));
+    }
+#endif
+    for (; x < width; ++x) {
+        uint32_t s, d;
+        memcpy(&s, src + x * 4, 4);
+        memcpy(&d, dst + x * 4, 4);
+        d |= ((s << t.left) >> t.right) & t.mask;
+        memcpy(dst + x * 4, &d, 4);
+    }
+}
+
+// Get row (y, z) of the source, resampled to the destination size, as RGBA8 pixels. For RGBA8 sources of the same
+// width, this is a pointer into the source image. Or else, the row is converted into the scratch buffer.
+const uint8_t * fetchRow(const Source & s, size_t y, size_t z, size_t width, size_t height, size_t depth, std::vector<uint8_t> & scratch) {
+    const auto &    p   = *s.proxy;
+    const uint8_t * row = p.pixel(0, 0, 0, y * p.height() / height, z * p.depth() / depth);
+    if (s.rgba8 && s.sameWidth) return row;
+
+    scratch.resize(width * 4);
+    ph::ColorFormat format = s.format;
+    size_t          step   = p.step();
+    for (size_t x = 0; x < width; ++x) {
+        const uint8_t * pixel = row + (s.sameWidth ? x : s.xmap[x]) * step;
+        uint8_t *       out   = scratch.data() + x * 4;
+        if (s.rgba8) {
+            memcpy(out, pixel, 4);
+        } else {
+            // Use format to convert used channels to normalized unsigned bytes.
+            for (uint8_t c = 0; c < 4; ++c)
+                if (s.channels & (1u << c)) out[c] = format.getPixelChannelByte(pixel, c);
+        }
+    }
+    return scratch.data();
+}
+
+} // namespace
 
 ImageSplicer::Channel::Channel(): _imageProxy(nullptr), _imageChannel(0), _defaultValue(0) {
     //
@@ -56,47 +146,6 @@ std::array<size_t, 3> ImageSplicer::Channel::getSize() const {
     }
 }
 
-std::function<uint8_t(size_t x, size_t y, size_t z)> ImageSplicer::Channel::getValueFunction() const {
-    // If we have an image proxy to query.
-    if (_imageProxy != nullptr) {
-        // Create local scope copy of image proxy so we can pass it to lambda.
-        const ph::ImageProxy * imageProxy = _imageProxy;
-
-        // Create local scope copy of image channel so we can pass it to lambda.
-        uint8_t imageChannel = _imageChannel;
-
-        // If image proxy uses RGBA8 format, as per the result.
-        if (_imageProxy->format() == ph::ColorFormat::RGBA_8_8_8_8_UNORM()) {
-            return [imageProxy, imageChannel](size_t x, size_t y, size_t z) {
-                // Get the pixel at the desired coordinates.
-                const uint8_t * pixel = imageProxy->pixel(0, 0, x, y, z);
-
-                // Return the value of the desired channel.
-                return pixel[imageChannel];
-            };
-
-            // If image uses an alternate format.
-        } else {
-            return [imageProxy, imageChannel](size_t x, size_t y, size_t z) {
-                // Get the pixel at the desired coordinates.
-                const uint8_t * pixel = imageProxy->pixel(0, 0, x, y, z);
-
-                // Return the value of the desired channel.
-                // Use format to convert it to a normalized unsigned byte.
-                return imageProxy->format().getPixelChannelByte(pixel, imageChannel);
-            };
-        }
-
-        // If we don't have an image.
-    } else {
-        // Create local scope copy of default value so we can pass it to lambda.
-        uint8_t defaultValue = _defaultValue;
-
-        // Then return a function that will always return the same value.
-        return [defaultValue](size_t, size_t, size_t) { return defaultValue; };
-    }
-}
-
 ImageSplicer::ImageSplicer() {
     //
 }
@@ -107,36 +156,66 @@ ph::RawImage ImageSplicer::build(size_t width, size_t height, size_t depth) cons
 
     // Allocate the combined image.
     ph::RawImage splicedImage(imagePlaneDesc);
+    if (0 == width || 0 == height || 0 == depth) return splicedImage;
 
-    // Iterate each channel and copy their contents.
+    // Channels without image are baked into one constant pixel value. Channels with image are grouped by their source
+    // image, so each source is read only once per row.
+    uint32_t            constant = 0;
+    std::vector<Source> sources;
     for (size_t channelIndex = 0; channelIndex < _channels.size(); ++channelIndex) {
-        // Get current channel to be spliced into the result.
-        const Channel & sourceChannel = _channels[channelIndex];
-
-        // Get the backing image.
-        const ph::ImageProxy * sourceImageProxy = sourceChannel.imageProxy();
-
-        // If channel has an image to transfer.
-        if (sourceImageProxy != nullptr) {
-            // If source and destination sizes match.
-            if (((size_t) sourceImageProxy->width()) == width && ((size_t) sourceImageProxy->height()) == height &&
-                ((size_t) sourceImageProxy->depth()) == depth) {
-                // Splice using the option that doesn't waste time on relative position calculations.
-                spliceSameSize(splicedImage, channelIndex, sourceImageProxy, sourceChannel.imageChannel());
-
-                // If source and destination sizes are different.
-            } else {
-                // Splice using the option which can convert between relative sizes.
-                spliceDifferentSize(splicedImage, channelIndex, sourceImageProxy, sourceChannel.imageChannel());
+        const Channel &        channel = _channels[channelIndex];
+        const ph::ImageProxy * proxy   = channel.imageProxy();
+        if (proxy == nullptr) {
+            constant |= uint32_t(channel.defaultValue()) << (channelIndex * 8);
+            continue;
+        }
+        PH_ASSERT(channel.imageChannel() < 4);
+
+        auto source = std::find_if(sources.begin(), sources.end(), [&](const Source & s) { return s.proxy == proxy; });
+        if (source == sources.end()) {
+            Source s {proxy, proxy->format(), proxy->format() == ph::ColorFormat::RGBA_8_8_8_8_UNORM(), proxy->width() == width, 0, {}, {}};
+            if (!s.sameWidth) {
+                // Separable resampling: the source x of each column is the same for all rows.
+                s.xmap.resize(width);
+                for (size_t x = 0; x < width; ++x) s.xmap[x] = x * proxy->width() / width;
             }
-
-            // If channel doesn't have an image to be transfered.
-        } else {
-            // Transfer the channel's default value.
-            spliceDefaultValue(splicedImage, channelIndex, sourceChannel.defaultValue());
+            sources.push_back(std::move(s));
+            source = sources.end() - 1;
         }
+        source->channels |= 1u << channel.imageChannel();
+
+        // Channels moved by the same distance share one term.
+        int      distance = (int) channelIndex - (int) channel.imageChannel();
+        uint32_t left     = (uint32_t) std::max(distance, 0) * 8;
+        uint32_t right    = (uint32_t) std::max(-distance, 0) * 8;
+        uint32_t mask     = 0xFFu << (channelIndex * 8);
+        auto     term     = std::find_if(source->terms.begin(), source->terms.end(), [&](const Term & t) { return t.left == left && t.right == right; });
+        if (term == source->terms.end())
+            source->terms.push_back({left, right, mask});
+        else
+            term->mask |= mask;
     }
 
+    // Rows are independent of each other. Split them across threads, with enough pixels in each chunk to amortize
+    // the scheduling cost.
+    const ph::ImageDesc & destinationDesc = splicedImage.desc();
+    uint8_t *             destinationData = splicedImage.data();
+    size_t                rows            = height * depth;
+    size_t                grain           = std::max<size_t>(1, 64 * 1024 / width);
+    ThreadPool::shared().parallelFor(rows, grain, [&](size_t begin, size_t end) {
+        std::vector<std::vector<uint8_t>> scratch(sources.size());
+        for (size_t r = begin; r < end; ++r) {
+            size_t    y   = r % height;
+            size_t    z   = r / height;
+            uint8_t * dst = destinationData + destinationDesc.pixel(0, 0, 0, y, z);
+            for (size_t x = 0; x < width; ++x) memcpy(dst + x * 4, &constant, 4);
+            for (size_t i = 0; i < sources.size(); ++i) {
+                const uint8_t * src = fetchRow(sources[i], y, z, width, height, depth, scratch[i]);
+                for (const auto & t : sources[i].terms) spliceRow(dst, src, width, t);
+            }
+        }
+    });
+
     return splicedImage;
 }
 
@@ -168,146 +247,3 @@ std::array<size_t, 3> ImageSplicer::getCombinedImageSize() const {
 
     return size;
 }
-
-void ImageSplicer::spliceDefaultValue(ph::RawImage & destinationImage, size_t destinationChannelIndex, uint8_t defaultValue) const {
-    // Get the image array we are filling.
-    uint8_t * destinationData = destinationImage.data();
-
-    // Total number of bytes in the destination array.
-    size_t destinationSize = destinationImage.size();
-
-    // Iterate all RGBA8 pixels and assign default value to the desired channel.
-    // Channel index points to the absolute channel being modified.
-    // Is incremented by the number of channels in each pixel each loop.
-    // Will terminate when we have modified all pixels.
-    for (size_t absoluteDestinationChannelIndex = destinationChannelIndex; absoluteDestinationChannelIndex < destinationSize;
-         absoluteDestinationChannelIndex += 4) {
-        destinationData[absoluteDestinationChannelIndex] = defaultValue;
-    }
-}
-
-void ImageSplicer::spliceSameSize(ph::RawImage & destinationImage, size_t destinationChannelIndex, const ph::ImageProxy * sourceImageProxy,
-                                  uint8_t sourceChannelIndex) const {
-    // Get the image array we are filling.
-    uint8_t * destinationData = destinationImage.data();
-
-    // Check whether source image is using RGBA8U format.
-    // Allows for an optimization if it's true since we don't have to convert formats and coordinates.
-    // This is the fastest splice method.
-    if (sourceImageProxy->format() == ph::ColorFormat::RGBA_8_8_8_8_UNORM()) {
-        // Total number of bytes in the destination array.
-        size_t destinationSize = destinationImage.size();
-
-        // Get the image array we are copying from.
-        const uint8_t * sourceData = sourceImageProxy->data;
-
-        // Iterate all pixels.
-        // pixelStartIndex refers to the index of the first channel of the current pixel being iterated.
-        for (size_t pixelStartIndex = 0; pixelStartIndex < destinationSize; pixelStartIndex += 4) {
-            // Pixel being copied to.
-            uint8_t * destinationPixel = destinationData + pixelStartIndex;
-
-            // Pixel being copied from.
-            const uint8_t * sourcePixel = sourceData + pixelStartIndex;
-
-            // Transfer the pixel channel byte.
-            destinationPixel[destinationChannelIndex] = sourcePixel[sourceChannelIndex];
-        }
-
-        // If formats are different.
-    } else {
-        // Get size of each dimension.
-        size_t width  = (size_t) destinationImage.width();
-        size_t height = (size_t) destinationImage.height();
-        size_t depth  = (size_t) destinationImage.depth();
-
-        // Description of the image being copied into.
-        const ph::ImageDesc & destinationDesc = destinationImage.desc();
-
-        // Format of the image being copied from.
-        ph::ColorFormat sourceColorFormat = sourceImageProxy->format();
-
-        // Iterate all pixels across all dimensions.
-        for (size_t x = 0; x < width; ++x) {
-            for (size_t y = 0; y < height; ++y) {
-                for (size_t z = 0; z < depth; ++z) {
-                    // Pixel being copied to.
-                    uint8_t * destinationPixel = destinationData + destinationDesc.pixel(0, 0, x, y, z);
-
-                    // Pixel being copied from.
-                    const uint8_t * sourcePixel = sourceImageProxy->pixel(0, 0, x, y, z);
-
-                    // Get value of desired channel and convert it to byte format.
-                    uint8_t sourceChannelValue = sourceColorFormat.getPixelChannelByte(sourcePixel, sourceChannelIndex);
-
-                    // Transfer the pixel channel byte.
-                    destinationPixel[destinationChannelIndex] = sourceChannelValue;
-                }
-            }
-        }
-    }
-}
-
-void ImageSplicer::spliceDifferentSize(ph::RawImage & destinationImage, size_t destinationChannelIndex, const ph::ImageProxy * sourceImageProxy,
-                                       uint8_t sourceChannelIndex) const {
-    // Get the image array we are filling.
-    uint8_t * destinationData = destinationImage.data();
-
-    // Get size of each dimension in destination.
-    size_t destinationWidth  = (size_t) destinationImage.width();
-    size_t destinationHeight = (size_t) destinationImage.height();
-    size_t destinationDepth  = (size_t) destinationImage.depth();
-
-    // Description of the image being copied into.
-    const ph::ImageDesc & destinationDesc = destinationImage.desc();
-
-    // Get size of each dimension in source.
-    size_t sourceWidth  = (size_t) sourceImageProxy->width();
-    size_t sourceHeight = (size_t) sourceImageProxy->height();
-    size_t sourceDepth  = (size_t) sourceImageProxy->depth();
-
-    // Format of the image being copied from.
-    ph::ColorFormat sourceColorFormat = sourceImageProxy->format();
-
-    // Whether source image is using RGBA8U format.
-    const bool sameFormat = sourceColorFormat == ph::ColorFormat::RGBA_8_8_8_8_UNORM();
-
-    // Iterate all pixels across all dimensions.
-    // Iterate across x dimension.
-    for (size_t destinationX = 0; destinationX < destinationWidth; ++destinationX) {
-        // Source x coordinate in the same relative position as the destination x coordinate.
-        size_t sourceX = destinationX * sourceWidth / destinationWidth;
-
-        // Iterate across y dimension.
-        for (size_t destinationY = 0; destinationY < destinationHeight; ++destinationY) {
-            // Source y coordinate in the same relative position as the destination y coordinate.
-            size_t sourceY = destinationY * sourceHeight / destinationHeight;
-
-            // Iterate across z dimension.
-            for (size_t destinationZ = 0; destinationZ < destinationDepth; ++destinationZ) {
-                // Source z coordinate in the same relative position as the destination z coordinate.
-                size_t sourceZ = destinationZ * sourceDepth / destinationDepth;
-
-                // Pixel being copied to.
-                uint8_t * destinationPixel = destinationData + destinationDesc.pixel(0, 0, destinationX, destinationY, destinationZ);
-
-                // Pixel being copied from.
-                const uint8_t * sourcePixel = sourceImageProxy->pixel(0, 0, sourceX, sourceY, sourceZ);
-
-                // If pixels are using the same format.
-                if (sameFormat) {
-                    // We can just get the byte value directly.
-                    destinationPixel[destinationChannelIndex] = sourcePixel[sourceChannelIndex];
-
-                    // If pixels are using different formats.
-                } else {
-                    // Get value of desired channel and convert it to byte format.
-                    uint8_t sourceChannelValue = sourceColorFormat.getPixelChannelByte(sourcePixel, sourceChannelIndex);
-
-                    // Transfer the pixel channel byte.
-                    destinationPixel[destinationChannelIndex] = sourceChannelValue;
-                }
-            }
-        }
-    }
-}
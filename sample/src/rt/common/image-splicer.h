@@ -80,15 +80,14 @@ public:
         /// Convenience function to get size of the image backing this channel.
         /// @return Size of the image, {1, 1, 1} if image is null.
         std::array<size_t, 3> getSize() const;
-
-        /// @return A function that will return the value of this channel at each coordinate.
-        std::function<uint8_t(size_t x, size_t y, size_t z)> getValueFunction() const;
     };
 
     ///
     ImageSplicer();
     ~ImageSplicer() = default;
 
+    /// The image is built row by row, with all 4 channels written in the same pass. Rows are split across threads of
+    /// the shared thread pool. Source images of different size are resampled with nearest neighbor filtering.
     /// @param width Width of the final image.
     /// @param height Height of the final image.
     /// @param depth Depth of the final image.
@@ -119,29 +118,4 @@ private:
 
     // @return The largest value of each dimension for all channels.
     std::array<size_t, 3> getCombinedImageSize() const;
-
-    /// Called when source image is empty.
-    /// Transfers default value to all pixels on the given channel.
-    /// @param destinationImage The image being modified.
-    /// @param destinationChannelIndex The channel in each pixel to modify.
-    /// @param defaultValue Value to assign to channelIndex of each pixel.
-    void spliceDefaultValue(ph::RawImage & destinationImage, size_t destinationChannelIndex, uint8_t defaultValue) const;
-
-    /// Called when destination and source images have the same size.
-    /// Copies source channel of source image to destination channel of destination image.
-    /// @param destinationImage The image being modified.
-    /// @param channelIndex The channel in each pixel to modify.
-    /// @param sourceImageProxy Image being copied to destination image.
-    /// @param sourceChannelIndex The channel in each pixel to copy.
-    void spliceSameSize(ph::RawImage & destinationImage, size_t destinationChannelIndex, const ph::ImageProxy * sourceImageProxy,
-                        uint8_t sourceChannelIndex) const;
-
-    /// Called when destination and source images have different sizes.
-    /// Copies source channel of source image to destination channel of destination image.
-    /// @param destinationImage The image being modified.
-    /// @param channelIndex The channel in each pixel to modify.
-    /// @param sourceImageProxy Image being copied to destination image.
-    /// @param sourceChannelIndex The channel in each pixel to copy.
-    void spliceDifferentSize(ph::RawImage & destinationImage, size_t destinationChannelIndex, const ph::ImageProxy * sourceImageProxy,
-                             uint8_t sourceChannelIndex) const;
 };
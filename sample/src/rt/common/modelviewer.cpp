@@ -27,7 +27,7 @@ using namespace ph::rt;
 
 // ---------------------------------------------------------------------------------------------------------------------
 //
-ModelViewer::ModelViewer(SimpleApp & app, const Options & o): SimpleScene(app), options(o), skinningManager(app.dev().vgi()), sbb(app.dev()) {
+ModelViewer::ModelViewer(SimpleApp & app, const Options & o): SimpleScene(app), options(o), skinningManager(app.dev().vgi(), o.batchedSkinning), sbb(app.dev()) {
 
     // create main color pass
     recreateColorRenderPass();
@@ -46,6 +46,8 @@ ModelViewer::ModelViewer(SimpleApp & app, const Options & o): SimpleScene(app),
 
     // Initialize texture cache so that images can be reused.
     textureCache.reset(new TextureCache(&dev().graphicsQ(), assetSys, shadowMapFormat, shadowMapSize));
+    textureCache->setBudget(size_t(o.textureBudgetMB) << 20);
+    textureCache->setUploadBudget(size_t(o.textureUploadBudgetMB) << 20);
 
     // create RT world instance
     auto wcp = World::WorldCreateParameters {&dev().graphicsQ(), std::vector<std::string> {std::string(ASSET_FOLDER)},
@@ -53,6 +55,10 @@ ModelViewer::ModelViewer(SimpleApp & app, const Options & o): SimpleScene(app),
                                              true,    // GPU timestamps.
                                              app.cp().rayQuery ? World::WorldCreateParameters::KHR_RAY_QUERY : World::WorldCreateParameters::AABB_GPU};
     world    = World::createWorld(wcp);
+    if (o.cpuSkinning) skinningManager.setBackend(skinning::SkinningBackend::CPU);
+    if (o.dualQuaternionSkinning) skinningManager.setMode(skinning::SkinningMode::DUAL_QUATERNION);
+    if (o.cpuMorphTargets) morphTargetManager.setMode(MorphMode::CPU);
+    if (o.quantizedMorphTargets) morphTargetManager.setDeltaFormat(MorphDeltaFormat::SNORM10);
     resetScene();
     // pause the animation if asked.
     if (!o.animated) setAnimated(false);
@@ -64,12 +70,28 @@ void ModelViewer::resetScene() {
     cameras.clear();
     lights.clear();
 
+    // Async texture callbacks might refer to materials of the old scene, which are about to be pruned.
+    textureCache->cancelCallbacks();
+
+    // Remember maps of all materials, so the ones deleted by prune() can give back their texture references.
+    std::unordered_map<rt::Material *, rt::Material::Desc> materials;
+    for (auto m : world->materials()) materials.emplace(m, m->desc());
+
+    // The mixer holds pointers to nodes of the old graph.
+    animationMixer.clear();
+
+    // Morph targets refer to meshes of the old scene, which are about to be pruned.
+    morphTargetManager.clear();
+
     // Create new scene and graph (delete old one first)
     delete graph;
     world->deleteScene(scene);
     world->prune(); // release unused resources.
+    for (auto m : world->materials()) materials.erase(m);
+    for (const auto & m : materials) textureCache->release(m.second);
     scene = world->createScene({});
     graph = new sg::Graph(*scene);
+    graph->setTransformUpdateMode(options.sceneGraphMode);
 
     // initialize debug scene manager
     if (options.enableDebugGeometry) {
@@ -441,6 +463,9 @@ void ModelViewer::setupShadowRenderPack() {
 void ModelViewer::update() {
     if (_renderPackDirty) recreateMainRenderPack();
 
+    // Swap in textures that finished loading in background.
+    textureCache->update();
+
     // Update first person controller and node, only when the first person camera is selected.
     if (0 == selectedCameraIndex) {
         // Update the camera controller.
@@ -465,7 +490,7 @@ void ModelViewer::update() {
     // auto                      startAnim = std::chrono::high_resolution_clock::now();
 
     // Update the animations.
-    if (animated() && !animations.empty()) {
+    if (animated() && (!animations.empty() || animationMixer.getLayerCount() > 0)) {
         bool running = false;
         for (auto & a : animations) {
             // Check if any animation is playing. Check this before ticking for the current frame,
@@ -474,6 +499,11 @@ void ModelViewer::update() {
             if (!running && a->getPlayCount() < a->getRepeatCount()) running = true;
             a->tick(app().gameTime().sinceLastUpdate);
         }
+        for (size_t i = 0; i < animationMixer.getLayerCount(); ++i) {
+            const auto & a = animationMixer.getTimeline(i);
+            if (!running && a->getPlayCount() < a->getRepeatCount()) running = true;
+        }
+        animationMixer.tick(app().gameTime().sinceLastUpdate);
         if (!running)
             loop().requestForQuit();
         else
@@ -550,8 +580,9 @@ VkImageLayout ModelViewer::record(const SimpleRenderLoop::RecordParameters & rp)
 }
 
 bool ModelViewer::accumDirty() {
+    // Textures loading in background still change the look of the scene.
     return (0 == options.accum || animated() || _lastCameraPosition != firstPersonController.position() ||
-            _lastCameraRotation != firstPersonController.angle());
+            _lastCameraRotation != firstPersonController.angle() || textureCache->pendingCount() > 0 || textureCache->streamingCount() > 0);
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -564,8 +595,22 @@ void ModelViewer::recordOffscreenPass(const PassParameters & p) {
     auto   frameCounter = renderLoop.frameCounter();
     auto   safeFrame    = renderLoop.safeFrame();
     world->updateFrameCounter(frameCounter, safeFrame);
-    skinningManager.record(renderLoop, p.cb);
-    graph->refreshSceneGpuData(p.cb);
+    {
+        // Timed on both CPU and GPU, to compare the morph target backends.
+        SimpleCpuFrameTimes::ScopedTimer c(app().cpuTimes(), "MorphTargets");
+        AsyncTimestamps::ScopedQuery     q(app().gpuTimes(), p.cb, "MorphTargets");
+        morphTargetManager.record(renderLoop, p.cb);
+    }
+    {
+        // Timed on both CPU and GPU, to compare the skinning backends.
+        SimpleCpuFrameTimes::ScopedTimer c(app().cpuTimes(), "Skinning");
+        AsyncTimestamps::ScopedQuery     q(app().gpuTimes(), p.cb, "Skinning");
+        skinningManager.record(renderLoop, p.cb);
+    }
+    {
+        SimpleCpuFrameTimes::ScopedTimer c(app().cpuTimes(), "RefreshSceneGpuData");
+        graph->refreshSceneGpuData(p.cb);
+    }
 
     if (options.isPathTraced()) {
         // render the scene with path tracer.
@@ -916,8 +961,21 @@ sg::Node * ModelViewer::loadObj(const LoadOptions & o, Eigen::AlignedBox3f & bbo
 //
 std::shared_ptr<const SceneAsset> ModelViewer::loadGltf(const LoadOptions & o) {
     // load GLTF scene
-    GLTFSceneReader sceneReader(assetSys, textureCache.get(), graph, skinningManager.skinDataMap(), &morphTargetManager, &sbb, o.createGeomLights);
-    std::shared_ptr<const SceneAsset> sceneAsset = sceneReader.read(o.model);
+    GLTFSceneReader sceneReader(assetSys, textureCache.get(), graph, skinningManager.skinDataMap(), &morphTargetManager, &sbb, o.createGeomLights,
+                                options.parallelAssetConversion);
+    std::shared_ptr<const SceneAsset> sceneAsset;
+    {
+        // Upload all mesh data in one batch, instead of one GPU round trip per buffer.
+        // If reading fails, drop the batch instead of flushing it, since the flush could throw again while unwinding.
+        sbb.beginBatch();
+        try {
+            sceneAsset = sceneReader.read(o.model);
+        } catch (...) {
+            sbb.discardBatch();
+            throw;
+        }
+        sbb.endBatch();
+    }
 
     // Add contents to the scene.
     loadSceneAsset(o, sceneAsset.get());
@@ -942,6 +1000,9 @@ void ModelViewer::loadSceneAsset(const LoadOptions & o, const SceneAsset * scene
 }
 
 void ModelViewer::addModelAnimations(const LoadOptions & o, const SceneAsset * sceneAsset) {
+    // Remember where the animations of this model start.
+    const size_t first = animations.size();
+
     // Get the name mapping of all animations.
     auto nameToAnimations = sceneAsset->getNameToAnimations();
 
@@ -1014,6 +1075,12 @@ void ModelViewer::addModelAnimations(const LoadOptions & o, const SceneAsset * s
         repeatCount = ::animations::Timeline::REPEAT_COUNT_INDEFINITE;
     }
     for (auto & timeline : animations) { timeline->setRepeatCount(repeatCount); }
+
+    // Move the animations of this model to the mixer, so that the ones targeting the same nodes are blended together.
+    if (options.blendAnimations) {
+        for (size_t i = first; i < animations.size(); ++i) animationMixer.addLayer(animations[i]);
+        animations.erase(animations.begin() + (ptrdiff_t) first, animations.end());
+    }
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -1458,6 +1525,8 @@ void ModelViewer::describeImguiUI() {
         auto scenePerf = scene->perfStats();
         ImGui::Text("Active Instance Count = %zu", scenePerf.instanceCount);
         ImGui::Text("Active triangle Count = %zu", scenePerf.triangleCount);
+        ImGui::Text("Flushed Entity Count  = %zu", graph->flushStats().entities);
+        ImGui::Text("Transform Update Time = %s (%zu nodes)", ns2str(graph->flushStats().updateNs).c_str(), graph->flushStats().updated);
         ImGui::BeginTable("Ray Tracing GPU Perf", 3, ImGuiTableFlags_Borders);
         for (const auto & i : scenePerf.gpuTimestamps) { drawPerfRow(0, i.name, i.durationNs, frameDuration.gpu.average); }
         for (const auto & i : pathTracingRenderPack->perfStats().gpuTimestamps) { drawPerfRow(0, i.name, i.durationNs, frameDuration.gpu.average); }
@@ -4,6 +4,7 @@
 
 #pragma once
 #include <ph/rt-utils.h>
+#include "animations/animation-mixer.h"
 #include "animations/timeline.h"
 #include "first-person-controller.h"
 #include "scene-asset.h"
@@ -39,6 +40,38 @@ struct ModelViewer : SimpleScene {
         // Set to true to create a set of debug geometries.
         bool enableDebugGeometry = false;
 
+        /// Specify how the scene graph updates world transforms of its nodes.
+        sg::Graph::TransformUpdateMode sceneGraphMode = sg::Graph::TransformUpdateMode::HIERARCHICAL;
+
+        /// Set to true to decode images and extract mesh data on multiple threads when loading scene assets.
+        bool parallelAssetConversion = true;
+
+        /// Set to true to skin all skinned meshes with a few dispatches on shared buffers, instead of one dispatch per submesh.
+        bool batchedSkinning = true;
+
+        /// Set to true to skin meshes on CPU worker threads, instead of the compute shader.
+        bool cpuSkinning = false;
+
+        /// Set to true to skin meshes with dual quaternions, instead of linear blend skinning.
+        bool dualQuaternionSkinning = false;
+
+        /// Set to true to apply morph targets on CPU worker threads, instead of the compute shader.
+        bool cpuMorphTargets = false;
+
+        /// Set to true to store morph target deltas as 10-bit integers, instead of half floats. Saves memory, but is lossy.
+        bool quantizedMorphTargets = false;
+
+        /// Set to true to play the animations of loaded models through the animation mixer, instead of ticking them one
+        /// after another. Use this when several animations of a model target the same nodes.
+        bool blendAnimations = false;
+
+        /// GPU memory budget of the texture cache, in MB. Unreferenced textures are evicted to stay within it. 0 means no limit.
+        uint32_t textureBudgetMB = 0;
+
+        /// Bytes of texture mip levels uploaded per frame, in MB. Textures loaded asynchronously are streamed in, smallest
+        /// levels first, under this budget. 0 means no limit: textures are uploaded with all their levels at once.
+        uint32_t textureUploadBudgetMB = 0;
+
         enum class RenderPackMode {
             RAST,       // rasterizer
             PT,         // path tracer
@@ -130,6 +163,10 @@ struct ModelViewer : SimpleScene {
     /// Animations being played.
     std::vector<std::shared_ptr<::animations::Timeline>> animations;
 
+    /// Animations being blended together. Ticked after the ones in the list above. Use this, instead of the list above,
+    /// when more than one animation targets the same nodes.
+    ::animations::AnimationMixer animationMixer;
+
     struct PassParameters {
         VkCommandBuffer                             cb {};
         const ph::va::SimpleSwapchain::BackBuffer & bb;
@@ -4,69 +4,298 @@
 
 #include "pch.h"
 #include "morphtargets.h"
+#include "thread-pool.h"
 #include "ui.h" // for imgui
 
+#include <bitset>
+#include <limits>
+#include <numeric>
+
 #include <cmrc/cmrc.hpp>
 CMRC_DECLARE(sampleasset);
 
 // ---------------------------------------------------------------------------------------------------------------------
 // PRIVATE FUNCTIONS
 
+// One displacement of one vertex by one target, before it's encoded.
+struct Delta {
+    uint32_t        target;
+    Eigen::Vector3f attribs[3]; // position, normal and tangent
+};
+
+/// Walks the values of one attribute of a target, and the vertex each of them displaces.
+struct AttributeCursor {
+    const std::vector<float> *    values;
+    const std::vector<uint32_t> * indices;
+    size_t                        count = 0;
+    size_t                        k     = 0;
+
+    AttributeCursor(const std::vector<float> & v, const std::vector<uint32_t> & i): values(&v), indices(&i), count(v.size() / 3) {}
+
+    /// Vertex displaced by the current value. Past the end, it is beyond any vertex of the mesh.
+    size_t vertex() const { return k >= count ? std::numeric_limits<size_t>::max() : indices->empty() ? k : (*indices)[k]; }
+};
+
+/// Call proc(vertex, delta) for each non-zero displacement of all targets of the mesh. Sparse attributes are walked
+/// through their indices. Dense ones get sparse here: vertices that a target leaves untouched are skipped.
+template<typename PROC>
+static void forEachDelta(const MorphTargetData & morphData, PROC && proc) {
+    const size_t vertexCount = morphData.origAttribs.positions.size() / 3;
+    const size_t targetCount = std::min<size_t>(morphData.targets.size(), MORPH_DELTA_TARGET_MASK + 1);
+    for (size_t t = 0; t < targetCount; ++t) {
+        const auto &    target     = morphData.targets[t];
+        AttributeCursor cursors[3] = {{target.positions, target.positionIndices}, {target.normals, target.normalIndices}, {target.tangents, target.tangentIndices}};
+        for (auto & c : cursors) {
+            if (c.indices->empty() || c.indices->size() == c.count) continue;
+            PH_LOGW("Morph target %zu has %zu indices, but %zu displacements. The attribute is ignored.", t, c.indices->size(), c.count);
+            c.count = 0;
+        }
+
+        // Merge the attributes by vertex. Sparse indices are in increasing order, so this visits each vertex once.
+        for (;;) {
+            const size_t v = std::min({cursors[0].vertex(), cursors[1].vertex(), cursors[2].vertex()});
+            if (v >= vertexCount) break;
+            Delta d;
+            d.target = (uint32_t) t;
+            for (int a = 0; a < 3; ++a) {
+                auto & c = cursors[a];
+                if (c.vertex() == v) {
+                    d.attribs[a] = Eigen::Map<const Eigen::Vector3f>(&(*c.values)[c.k * 3]);
+                    ++c.k;
+                } else {
+                    d.attribs[a] = Eigen::Vector3f::Zero();
+                }
+            }
+            if (d.attribs[0].isZero(0.0f) && d.attribs[1].isZero(0.0f) && d.attribs[2].isZero(0.0f)) continue;
+            proc(v, d);
+        }
+    }
+}
+
+/// Appends one attribute of a target of the next primitive. The attribute stays dense only when both sides are dense.
+/// A missing attribute counts as dense zeros.
+static void appendAttribute(std::vector<float> & values, std::vector<uint32_t> & indices, const std::vector<float> & inputValues,
+                            const std::vector<uint32_t> & inputIndices, size_t vertexBase, size_t inputVertexCount) {
+    const bool dense      = indices.empty() && (values.empty() || values.size() == vertexBase * 3);
+    const bool inputDense = inputIndices.empty() && (inputValues.empty() || inputValues.size() == inputVertexCount * 3);
+    if (dense && inputDense) {
+        if (values.empty() && inputValues.empty()) return;
+        values.resize(vertexBase * 3, 0.0f);
+        if (inputValues.empty())
+            values.resize((vertexBase + inputVertexCount) * 3, 0.0f);
+        else
+            values.insert(values.end(), inputValues.begin(), inputValues.end());
+        return;
+    }
+
+    // Make existing values sparse, then append the indices of the input, moved to where the primitive is in the mesh.
+    if (indices.empty()) {
+        indices.resize(values.size() / 3);
+        std::iota(indices.begin(), indices.end(), 0u);
+    }
+    const size_t inputCount = inputValues.size() / 3;
+    for (size_t k = 0; k < inputCount; ++k) indices.push_back((uint32_t) (vertexBase + (inputIndices.empty() ? k : inputIndices[k])));
+    values.insert(values.end(), inputValues.begin(), inputValues.end());
+}
+
+void MorphTargetData::append(MorphTargetData & input, size_t vertexBase) {
+    // The first primitive is taken over as is.
+    if (origAttribs.positions.empty()) {
+        *this = std::move(input);
+        return;
+    }
+    PH_ASSERT(origAttribs.positions.size() == vertexBase * 3);
+    const size_t inputVertexCount = input.origAttribs.positions.size() / 3;
+
+    // Original attributes. Missing ones are filled with zeros.
+    auto appendOrig = [&](std::vector<float> & values, const std::vector<float> & inputValues) {
+        values.resize(vertexBase * 3, 0.0f);
+        if (inputValues.size() == inputVertexCount * 3)
+            values.insert(values.end(), inputValues.begin(), inputValues.end());
+        else
+            values.resize((vertexBase + inputVertexCount) * 3, 0.0f);
+    };
+    appendOrig(origAttribs.positions, input.origAttribs.positions);
+    appendOrig(origAttribs.normals, input.origAttribs.normals);
+    appendOrig(origAttribs.tangents, input.origAttribs.tangents);
+    origAttribs.count = vertexBase + inputVertexCount;
+
+    // glTF requires all primitives of a mesh to have the same targets. Missing ones don't displace anything.
+    if (input.targets.size() != targets.size()) {
+        PH_LOGW("Primitives of the mesh have different numbers of morph targets: %zu and %zu.", targets.size(), input.targets.size());
+        const size_t count = std::max(targets.size(), input.targets.size());
+        targets.resize(count);
+        input.targets.resize(count);
+    }
+    for (size_t t = 0; t < targets.size(); ++t) {
+        auto &       target = targets[t];
+        const auto & in     = input.targets[t];
+        appendAttribute(target.positions, target.positionIndices, in.positions, in.positionIndices, vertexBase, inputVertexCount);
+        appendAttribute(target.normals, target.normalIndices, in.normals, in.normalIndices, vertexBase, inputVertexCount);
+        appendAttribute(target.tangents, target.tangentIndices, in.tangents, in.tangentIndices, vertexBase, inputVertexCount);
+        target.count = vertexBase + inputVertexCount;
+    }
+}
+
+/// Same as packHalf2x16() in GLSL.
+static uint32_t packHalf2x16(float x, float y) {
+    return (uint32_t) Eigen::half_impl::float_to_half_rtne(x).x | ((uint32_t) Eigen::half_impl::float_to_half_rtne(y).x << 16);
+}
+
+/// Same as unpackHalf2x16() in GLSL.
+static Eigen::Vector2f unpackHalf2x16(uint32_t w) {
+    return {Eigen::half_impl::half_to_float(Eigen::half_impl::raw_uint16_to_half((unsigned short) (w & 0xFFFF))),
+            Eigen::half_impl::half_to_float(Eigen::half_impl::raw_uint16_to_half((unsigned short) (w >> 16)))};
+}
+
+static uint32_t packSnorm10(const Eigen::Vector3f & v, float scale) {
+    uint32_t w = 0;
+    for (int i = 0; i < 3; ++i) {
+        int q = (int) std::lround(std::clamp(v[i] / scale, -1.0f, 1.0f) * 511.0f);
+        w |= ((uint32_t) q & 0x3FF) << (i * 10);
+    }
+    return w;
+}
+
+/// Number of stream words of one attribute.
+static uint32_t wordsPerAttribute(MorphDeltaFormat format) { return MorphDeltaFormat::FLOAT16 == format ? 2 : 1; }
+
+/// Decode one attribute of a delta, and move the cursor to the next one. Same as readAttribute() in morph-targets.comp.
+static Eigen::Vector3f readAttribute(const uint32_t *& cursor, MorphDeltaFormat format, float scale) {
+    if (MorphDeltaFormat::FLOAT16 == format) {
+        Eigen::Vector2f xy = unpackHalf2x16(cursor[0]);
+        Eigen::Vector2f z  = unpackHalf2x16(cursor[1]);
+        cursor += 2;
+        return {xy.x(), xy.y(), z.x()};
+    }
+    uint32_t w = *cursor++;
+    // Sign extend the 10-bit integers.
+    Eigen::Vector3f q((float) ((int32_t) (w << 22) >> 22), (float) ((int32_t) (w << 12) >> 22), (float) ((int32_t) (w << 2) >> 22));
+    return q * (scale / 511.0f);
+}
+
+/// Copy original attributes of vertices in range [begin, end) of the mesh to the layout used by the morph shader.
+static void copyVertices(const MorphTargetData & morphData, size_t begin, size_t end, rt::device::MorphVertex * output) {
+    const auto & orig        = morphData.origAttribs;
+    const bool   hasNormals  = orig.normals.size() == orig.positions.size();
+    const bool   hasTangents = orig.tangents.size() == orig.positions.size();
+    for (size_t v = begin; v < end; ++v) {
+        auto & out   = output[v];
+        out.position = Eigen::Map<const Eigen::Vector3f>(&orig.positions[v * 3]);
+        out.normal   = Eigen::Vector3f::Zero();
+        out.tangent  = Eigen::Vector3f::Zero();
+        if (hasNormals) out.normal = Eigen::Map<const Eigen::Vector3f>(&orig.normals[v * 3]);
+        if (hasTangents) out.tangent = Eigen::Map<const Eigen::Vector3f>(&orig.tangents[v * 3]);
+    }
+}
+
+/// Morph vertices in range [begin, end) of the mesh. Same math as morph-targets.comp: each vertex walks its own deltas
+/// only, and skips the ones of zero weight targets.
+static void morphVertices(const MorphTargetData & morphData, size_t begin, size_t end, rt::device::MorphVertex * output) {
+    copyVertices(morphData, begin, end, output);
+    const auto     format = morphData.deltaFormat;
+    const uint32_t stride = wordsPerAttribute(format);
+    for (size_t v = begin; v < end; ++v) {
+        auto &           out    = output[v];
+        const uint32_t * cursor = morphData.deltas.data() + morphData.deltaRanges[v];
+        const uint32_t * last   = morphData.deltas.data() + morphData.deltaRanges[v + 1];
+        while (cursor < last) {
+            uint32_t header = *cursor++;
+            uint32_t target = header & MORPH_DELTA_TARGET_MASK;
+            float    w      = morphData.weights[target];
+            if (0.0f == w) {
+                cursor += stride * std::bitset<3>(header >> 16).count();
+                continue;
+            }
+            const auto & scale = morphData.deltaScales[target].scale;
+            if (header & MORPH_DELTA_POSITION) out.position += w * readAttribute(cursor, format, scale.x());
+            if (header & MORPH_DELTA_NORMAL) out.normal += w * readAttribute(cursor, format, scale.y());
+            if (header & MORPH_DELTA_TANGENT) out.tangent += w * readAttribute(cursor, format, scale.z());
+        }
+    }
+}
+
+static VkDescriptorBufferInfo getDescriptor(const BufferObject & bufferObj) { return {bufferObj.buffer, 0, bufferObj.size}; }
+
 // TODO: This currently assumes that everything will have vertex, normal, and tangent data. May need
 //       to change this so that the other cases (i.e. vertex only, vertex/normal) are handled.
-void MorphTargetManager::allocateBuffers(MorphTargetData morphData, MorphTargetBuffer & morphBuffer) {
+void MorphTargetManager::allocateBuffers(MorphTargetData & morphData, MorphTargetBuffer & morphBuffer) {
     const auto & vgi = _vsp->vgi();
 
     // Allocate input/output vertex buffers
-    std::vector<rt::device::Vertex> vertexData;
-    auto                            origAttrs = morphData.origAttribs;
-
-    // Allocate input/output Vertex data buffers
-    for (size_t i = 0; i < origAttrs.positions.size(); i += 3) {
-        rt::device::Vertex v = {};
-        v.position           = rt::device::vec3(origAttrs.positions[i], origAttrs.positions[i + 1], origAttrs.positions[i + 2]);
-        v.normal             = rt::device::vec3(origAttrs.normals[i], origAttrs.normals[i + 1], origAttrs.normals[i + 2]);
-        v.tangent            = rt::device::vec3(origAttrs.tangents[i], origAttrs.tangents[i + 1], origAttrs.tangents[i + 2]);
-        vertexData.emplace_back(v);
-    }
-    ConstRange<rt::device::Vertex> vData(vertexData);
+    const size_t                         vertexCount = morphData.origAttribs.positions.size() / 3;
+    std::vector<rt::device::MorphVertex> vertexData(vertexCount);
+    copyVertices(morphData, 0, vertexCount, vertexData.data());
+    ConstRange<rt::device::MorphVertex> vData(vertexData);
     morphBuffer.inputVertexBuffer.allocate(vgi, vData);
     morphBuffer.outputVertexBuffer.allocate(vgi, vData);
 
     // Allocate weights buffer
-    PH_ASSERT(morphData.weights.size() == morphData.targets.size());
+    PH_ASSERT(morphData.weights.size() == morphData.targetCount());
     ConstRange<float> wData(morphData.weights);
     morphBuffer.weightsBuffer.allocate(vgi, wData);
 
-    // Allocate the targets buffer
-    auto                            targets = morphData.targets;
-    std::vector<rt::device::Vertex> targetData;
-    for (size_t i = 0; i < targets.size(); i++) {
-        for (size_t j = 0; j < targets[i].positions.size(); j += 3) {
-            rt::device::Vertex t = {};
-            t.position           = rt::device::vec3(targets[i].positions[j], targets[i].positions[j + 1], targets[i].positions[j + 2]);
-            t.normal             = rt::device::vec3(targets[i].normals[j], targets[i].normals[j + 1], targets[i].normals[j + 2]);
-            t.tangent            = rt::device::vec3(targets[i].tangents[j], targets[i].tangents[j + 1], targets[i].tangents[j + 2]);
-            targetData.emplace_back(t);
-        }
-    }
-
-    ConstRange<rt::device::Vertex> tData(targetData);
-    morphBuffer.targetsBuffer.allocate(vgi, tData);
+    // Allocate the sparse targets
+    morphBuffer.deltasBuffer.allocate(vgi, ConstRange<uint32_t>(morphData.deltas));
+    morphBuffer.deltaRangesBuffer.allocate(vgi, ConstRange<uint32_t>(morphData.deltaRanges));
+    morphBuffer.deltaScalesBuffer.allocate(vgi, ConstRange<rt::device::MorphDeltaScale>(morphData.deltaScales));
+}
 
-    // Sync the buffers to the gpu
-    ph::va::SingleUseCommandPool pool(*_vsp);
-    pool.syncExec([&](auto cb) {
-        morphBuffer.inputVertexBuffer.sync2gpu(cb);
-        morphBuffer.outputVertexBuffer.sync2gpu(cb);
-        morphBuffer.weightsBuffer.sync2gpu(cb);
-        morphBuffer.targetsBuffer.sync2gpu(cb);
+void MorphTargetManager::buildDeltas(MorphTargetData & morphData, MorphDeltaFormat format) {
+    const size_t   vertexCount = morphData.origAttribs.positions.size() / 3;
+    const uint32_t stride      = wordsPerAttribute(format);
+    morphData.deltaFormat      = format;
+
+    // Deltas store their target in the low 16 bits of the header. Targets beyond that are dropped by forEachDelta().
+    if (morphData.targets.size() > MORPH_DELTA_TARGET_MASK + 1)
+        PH_LOGW("The mesh has %zu morph targets, but only the first %u are supported. The rest are ignored.", morphData.targets.size(),
+                MORPH_DELTA_TARGET_MASK + 1);
+
+    // Find the quantization scales of each target, and count words of each vertex.
+    rt::device::MorphDeltaScale zero;
+    zero.scale   = rt::device::vec3::Zero();
+    zero.padding = 0.0f;
+    morphData.deltaScales.assign(morphData.targets.size(), zero);
+    morphData.deltaRanges.assign(vertexCount + 1, 0);
+    forEachDelta(morphData, [&](size_t v, const Delta & d) {
+        auto & scale = morphData.deltaScales[d.target].scale;
+        for (int a = 0; a < 3; ++a) {
+            if (d.attribs[a].isZero(0.0f)) continue;
+            scale[a] = std::max(scale[a], d.attribs[a].cwiseAbs().maxCoeff());
+            morphData.deltaRanges[v + 1] += stride;
+        }
+        morphData.deltaRanges[v + 1] += 1; // header
     });
-}
+    for (auto & s : morphData.deltaScales) s.scale = s.scale.unaryExpr([](float x) { return x > 0.0f ? x : 1.0f; });
+
+    // Turn the counts into ranges.
+    for (size_t v = 0; v < vertexCount; ++v) morphData.deltaRanges[v + 1] += morphData.deltaRanges[v];
+
+    // Encode deltas to their vertices. Within each vertex, deltas stay in target order.
+    std::vector<uint32_t> cursors(morphData.deltaRanges.begin(), morphData.deltaRanges.end() - 1);
+    morphData.deltas.resize(morphData.deltaRanges.back());
+    forEachDelta(morphData, [&](size_t v, const Delta & d) {
+        uint32_t * header = &morphData.deltas[cursors[v]++];
+        *header           = d.target;
+        for (int a = 0; a < 3; ++a) {
+            if (d.attribs[a].isZero(0.0f)) continue;
+            *header |= MORPH_DELTA_POSITION << a;
+            const auto & x = d.attribs[a];
+            if (MorphDeltaFormat::FLOAT16 == format) {
+                morphData.deltas[cursors[v]++] = packHalf2x16(x.x(), x.y());
+                morphData.deltas[cursors[v]++] = packHalf2x16(x.z(), 0.0f);
+            } else {
+                morphData.deltas[cursors[v]++] = packSnorm10(x, morphData.deltaScales[d.target].scale[a]);
+            }
+        }
+    });
+
+    const size_t denseCount = morphData.targets.size() * vertexCount;
+    PH_LOGV("%zu morph targets of %zu vertices are stored in %zu bytes (%zu bytes as full vertices).", morphData.targets.size(), vertexCount,
+            morphData.deltas.size() * sizeof(uint32_t), denseCount * sizeof(rt::device::MorphVertex));
 
-void MorphTargetManager::cleanupApps() {
-    for (auto & app : _appsToCleanup) app.cleanup();
-    _appsToCleanup.clear();
+    // The delta stream is all that is needed from now on. Don't keep the loaded targets next to it.
+    std::vector<MorphTargetData::TargetAttribs>().swap(morphData.targets);
 }
 
 AutoHandle<VkShaderModule> MorphTargetManager::createShader(const ConstRange<uint8_t> & data, const char * name) {
@@ -80,21 +309,35 @@ AutoHandle<VkShaderModule> MorphTargetManager::createShader(const ConstRange<uin
     } catch (...) { return {}; }
 }
 
-void MorphTargetManager::initGPUMorphTargets() {
-    // TODO: Is there any case where this has to be checked again here?
-    // Ensure we have morph target data
-    // if (_morphTargets.empty()) {
-    //    PH_LOGE("initGPUMorphTargets - Cannot initialize Morph Targets if _morphTargets is empty."
-    //            " _morphMode will be set to OFF.");
-    //    _morphMode = MorphMode::OFF;
-    //    return;
-    //}
-
-    // Allocate buffers for each mesh with morph targets
+void MorphTargetManager::initMorphTargets() {
+    // Allocate buffers for each mesh with morph targets, that is loaded since last call. Both CPU and GPU path write to
+    // the output vertex buffer.
+    std::vector<ph::rt::Mesh *> added;
     for (auto & [mesh, morphData] : _morphTargets) {
-        MorphTargetBuffer & mb = _morphBuffers[mesh];
-        allocateBuffers(morphData, mb);
+        if (!morphData.deltaRanges.empty()) continue; // already done.
+        buildDeltas(morphData, _deltaFormat);
+        if (morphData.deltas.empty()) continue; // nothing to morph.
+        allocateBuffers(morphData, _morphBuffers[mesh]);
+        added.push_back(mesh);
     }
+
+    // Sync all new buffers to the gpu with one submission.
+    if (!added.empty()) {
+        ph::va::SingleUseCommandPool pool(*_vsp);
+        pool.syncExec([&](auto cb) {
+            for (auto mesh : added) {
+                auto & mb = _morphBuffers[mesh];
+                mb.inputVertexBuffer.sync2gpu(cb);
+                mb.outputVertexBuffer.sync2gpu(cb);
+                mb.weightsBuffer.sync2gpu(cb);
+                mb.deltasBuffer.sync2gpu(cb);
+                mb.deltaRangesBuffer.sync2gpu(cb);
+                mb.deltaScalesBuffer.sync2gpu(cb);
+            }
+        });
+    }
+
+    _initialized = true;
 }
 
 std::vector<uint8_t> MorphTargetManager::loadEmbeddedResource(const std::string & name, bool quiet) {
@@ -115,6 +358,11 @@ void MorphTargetManager::loadMorphTargetShader() {
         auto shader = createShader(blob, "morph-targets.spirv");
         if (shader) {
             _shaderModule = shader;
+            va::SimpleCompute::ConstructParameters cp {_vsp->vgi()};
+            cp.cs = _shaderModule;
+            for (size_t i = 0; i < 6; ++i) cp.bindings[i] = {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1};
+            cp.pushConstantsSize = sizeof(rt::device::MorphConstants);
+            _compute             = new SimpleCompute(cp);
         } else {
             PH_LOGE("The morph target shader embedded resource was located but could not be loaded."
                     " _morphMode will be set to OFF.");
@@ -127,127 +375,62 @@ void MorphTargetManager::loadMorphTargetShader() {
     }
 }
 
-void MorphTargetManager::morphTargetsCPU() {
-    PH_THROW("obsolete");
-    // for (auto & [mesh, morphData] : _morphTargets) {
-    //     if (morphData.dirty) {
-    //         std::vector<float> newPositions;
-    //         std::vector<float> newNormals;
-    //         std::vector<float> newTangents;
-    //         int                posCount = int(morphData.origAttribs.positions.size());
-    //         // Assumes that if original data had normals and tangents,
-    //         // all the targets should too. If this isn't the case, it will probably crash
-    //         bool hasNormals  = morphData.origAttribs.normals.size() > 0;
-    //         bool hasTangents = morphData.origAttribs.tangents.size() > 0;
-    //         newPositions.resize(posCount);
-    //         if (hasNormals) newNormals.resize(posCount);
-    //         if (hasTangents) newTangents.resize(posCount);
-    //         int targetCount = int(morphData.weights.size());
-    //         for (int i = 0; i < posCount; i++) { // TODO: Flip these loops so that we can optimize the weight == 0 case?
-    //             newPositions[i] = morphData.origAttribs.positions[i];
-    //             if (hasNormals) newNormals[i] = morphData.origAttribs.normals[i];
-    //             if (hasTangents) newTangents[i] = morphData.origAttribs.tangents[i];
-    //             for (int j = 0; j < targetCount; j++) { // TODO: Flip these loops so that we can optimize the weight == 0 case?
-    //                 newPositions[i] += morphData.weights[j] * morphData.targets[j].positions[i];
-    //                 if (hasNormals) newNormals[i] += morphData.weights[j] * morphData.targets[j].normals[i];
-    //                 if (hasTangents) newTangents[i] += morphData.weights[j] * morphData.targets[j].tangents[i];
-    //             }
-    //         }
-
-    //         ph::rt::Mesh::MorphParameters mp;
-    //         mp.positions = {(const float *) newPositions.data(), 3 * sizeof(float)};
-    //         if (hasNormals) mp.normals = {(const float *) newNormals.data(), 3 * sizeof(float)};
-    //         if (hasTangents) mp.tangents = {(const float *) newTangents.data(), 3 * sizeof(float)};
-
-    //         mesh->morph(mp);
-
-    //         morphData.dirty = false;
-    //     }
-    // }
+void MorphTargetManager::morphTargetsCPU(DeferredHostOperation & dho, VkCommandBuffer cb) {
+    va::beginVkDebugLabel(cb, "cpu morph targets");
+    auto & pool = ThreadPool::shared();
+    for (auto mesh : _dirtyMeshes) {
+        const auto & morphData   = _morphTargets[mesh];
+        const size_t vertexCount = morphData.deltaRanges.size() - 1;
+
+        // Morph the vertices on all threads, then copy them to the ring.
+        _cpuVertices.resize(vertexCount);
+        pool.parallelFor(vertexCount, 4096, [&](size_t begin, size_t end) { morphVertices(morphData, begin, end, _cpuVertices.data()); });
+        _stagingRing->cmdUploadToGpu(dho, cb, _morphBuffers[mesh].outputVertexBuffer.g.buffer, 0, _cpuVertices);
+    }
+    va::endVkDebugLabel(cb);
 }
 
-void MorphTargetManager::morphTargetsGPU() {
-    for (auto & [mesh, morphData] : _morphTargets) {
-
-        // Temp code for running the ComputeShader code for this mesh, a shared pool/command buffer will
-        // be used in the near future once the larger code refactoring is complete
-        ph::va::SingleUseCommandPool pool(*_vsp);
-        auto                         cb = pool.create();
-
-        // Update the weights buffer
-        if (morphData.dirty) {
-            ConstRange<float> crWeights(morphData.weights);
-            _morphBuffers[mesh].weightsBuffer.update(0, crWeights);
-            _morphBuffers[mesh].weightsBuffer.sync2gpu(cb);
-        }
-
-        // Set up a VkDescriptorBufferInfo for this mesh
-        std::vector<VkDescriptorBufferInfo> descBufInfos = {
-            {
-                /*.buffer = */ _morphBuffers[mesh].inputVertexBuffer.g.buffer,
-                /*.offset = */ 0,
-                /*.range = */ _morphBuffers[mesh].inputVertexBuffer.g.size,
-            },
-            {
-                /*.buffer = */ _morphBuffers[mesh].outputVertexBuffer.g.buffer,
-                /*.offset = */ 0,
-                /*.range = */ _morphBuffers[mesh].outputVertexBuffer.g.size,
-            },
-            {
-                /*.buffer = */ _morphBuffers[mesh].weightsBuffer.g.buffer,
-                /*.offset = */ 0,
-                /*.range = */ _morphBuffers[mesh].weightsBuffer.g.size,
-            },
-            {
-                /*.buffer = */ _morphBuffers[mesh].targetsBuffer.g.buffer,
-                /*.offset = */ 0,
-                /*.range = */ _morphBuffers[mesh].targetsBuffer.g.size,
-            },
-        };
-
-        // Set up the MinimalComputeApplication for the morph targets
-        _appsToCleanup.push_back(_vsp->vgi().device);
-        MinimalComputeApplication & app = _appsToCleanup.back();
-        app.createDesriptorSetLayout((int) descBufInfos.size());
-        app.createDescriptorSet(descBufInfos);
-
-        // Load the compute shader used for morph targets
-        PH_REQUIRE(!_shaderModule.empty());
-        auto ssci = ph::va::util::shaderStageCreateInfo(_shaderModule.get(), VK_SHADER_STAGE_COMPUTE_BIT);
-        app.createComputePipeline(ssci);
-
-        // Bind, dispatch, and excute the pipeline
-        app.bindAndDispatch(cb, _morphBuffers[mesh].inputVertexBuffer.size());
-
-        // TODO: need to hook up with the new dynamic scene interface
-        // // Use the buffers version of morph() to update the mesh
-        // ph::rt::Mesh::VertexBuffer vb = {};
-        // vb.buffer                     = _morphBuffers[mesh].outputVertexBuffer.g.buffer;
-        // vb.stride                     = sizeof(rt::device::Vertex);
-        // vb.vertexCount                = _morphBuffers[mesh].outputVertexBuffer.g.size / vb.stride;
-        // vb.offset                     = 0;
-        // vb.offsets                    = {offsetof(device::Vertex, position), offsetof(device::Vertex, normal)};
-        // mesh->morph(vb, cb);
-        // pool.finish(cb);
-        // mesh->syncVertexFromBuffer();
+void MorphTargetManager::morphTargetsGPU(DeferredHostOperation & dho, VkCommandBuffer cb) {
+    va::beginVkDebugLabel(cb, "gpu morph targets");
+
+    // Upload weights of all dirty meshes, then wait for all of them at once.
+    for (auto mesh : _dirtyMeshes) _stagingRing->cmdUploadToGpu(dho, cb, _morphBuffers[mesh].weightsBuffer.g.buffer, 0, _morphTargets[mesh].weights);
+    VkMemoryBarrier mBarrier = {.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                .pNext         = nullptr,
+                                .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                                .dstAccessMask = VK_ACCESS_SHADER_READ_BIT};
+    vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &mBarrier, 0, nullptr, 0, nullptr);
+
+    // One dispatch per mesh. All dispatches are recorded to the same command buffer.
+    for (auto mesh : _dirtyMeshes) {
+        auto & mb = _morphBuffers[mesh];
+        auto   pc = rt::device::MorphConstants {(uint32_t) _morphTargets[mesh].deltaFormat};
+        auto   dp = SimpleCompute::DispatchParameters {dho, cb};
+        dp.bindings[0] = std::vector<VkDescriptorBufferInfo> {getDescriptor(mb.inputVertexBuffer.g)};
+        dp.bindings[1] = std::vector<VkDescriptorBufferInfo> {getDescriptor(mb.outputVertexBuffer.g)};
+        dp.bindings[2] = std::vector<VkDescriptorBufferInfo> {getDescriptor(mb.weightsBuffer.g)};
+        dp.bindings[3] = std::vector<VkDescriptorBufferInfo> {getDescriptor(mb.deltasBuffer.g)};
+        dp.bindings[4] = std::vector<VkDescriptorBufferInfo> {getDescriptor(mb.deltaRangesBuffer.g)};
+        dp.bindings[5] = std::vector<VkDescriptorBufferInfo> {getDescriptor(mb.deltaScalesBuffer.g)};
+        dp.width       = _morphTargets[mesh].deltaRanges.size() - 1;
+        dp.setPushConstants(pc);
+        _compute->dispatch(dp);
     }
+
+    va::endVkDebugLabel(cb);
 }
 
-// TODO: FINISH MODIFYING THIS FUNCTION
 bool MorphTargetManager::reinitializeMorphTargets() {
-    if (_morphTargets.empty()) {
-        PH_LOGI("MorphTargetsManager cannot be initialized without _morphTargets having valid "
-                "data. _morphMode will be set to OFF and Morph Targets will not run.");
-        _morphMode = MorphMode::OFF;
-        return false;
-    }
+    // Nothing to morph yet. Keep the mode, so that morph targets of models loaded later still run.
+    if (_morphTargets.empty()) return false;
 
-    if (_morphMode == MorphMode::GPU) {
-        loadMorphTargetShader();
-        initGPUMorphTargets();
-    }
+    if (_morphMode == MorphMode::GPU && !_compute) loadMorphTargetShader();
+    if (_morphMode != MorphMode::OFF) initMorphTargets();
+
+    // Morph all meshes in the new mode.
+    for (auto & kv : _morphTargets) kv.second.dirty = true;
 
-    return true;
+    return _morphMode != MorphMode::OFF;
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -257,24 +440,21 @@ void MorphTargetManager::describeImguiUI(MorphMode & settableMorphModeOption) {
     if (ImGui::TreeNode("Morph Mode")) {
         if (ImGui::BeginListBox("", ImVec2(0, 4 * ImGui::GetTextLineHeightWithSpacing()))) {
             if (ImGui::Selectable("Off", _morphMode == MorphMode::OFF)) {
-                _morphMode = settableMorphModeOption = MorphMode::OFF;
+                setMode(MorphMode::OFF);
+                settableMorphModeOption = _morphMode;
                 // DEBUG
                 PH_LOGI("Morph Mode = OFF");
             }
             if (ImGui::Selectable("CPU", _morphMode == MorphMode::CPU)) {
-                _morphMode = settableMorphModeOption = MorphMode::CPU;
-                bool success                         = reinitializeMorphTargets();
-                if (!success) { _morphMode = settableMorphModeOption = MorphMode::OFF; }
+                setMode(MorphMode::CPU);
+                settableMorphModeOption = _morphMode;
                 // DEBUG
                 std::string modeStr = _morphMode == MorphMode::OFF ? "OFF" : "CPU";
                 PH_LOGI("Morph Mode = " + modeStr);
             }
             if (ImGui::Selectable("GPU", _morphMode == MorphMode::GPU)) {
-                _morphMode = settableMorphModeOption = MorphMode::GPU;
-                if (!_gpuInitialized) {
-                    bool success = reinitializeMorphTargets();
-                    if (!success) { _morphMode = settableMorphModeOption = MorphMode::OFF; }
-                }
+                setMode(MorphMode::GPU);
+                settableMorphModeOption = _morphMode;
                 // DEBUG
                 std::string modeStr = _morphMode == MorphMode::OFF ? "OFF" : "GPU";
                 PH_LOGI("Morph Mode = " + modeStr);
@@ -300,17 +480,14 @@ void MorphTargetManager::initializeMorphTargets(VulkanSubmissionProxy * vsp) {
                                      "for the VulkanSubmissionProxy.");
     }
     _vsp = vsp;
-    if (_morphTargets.empty()) {
-        PH_LOGI("MorphTargetsManager cannot be initialized without _morphTargets having valid "
-                "data. _morphMode will be set to OFF and Morph Targets will not run.");
-        _morphMode = MorphMode::OFF;
-        return;
-    }
+    if (!_stagingRing) _stagingRing.reset(new StagingRing(_vsp->vgi()));
+    reinitializeMorphTargets();
+}
 
-    if (_morphMode == MorphMode::GPU) {
-        loadMorphTargetShader();
-        initGPUMorphTargets();
-    }
+void MorphTargetManager::setMode(MorphMode mode) {
+    if (mode == _morphMode) return;
+    _morphMode = mode;
+    if (_vsp) reinitializeMorphTargets();
 }
 
 bool MorphTargetManager::setWeights(ph::rt::Mesh * mesh, const std::vector<float> & weights) {
@@ -322,12 +499,12 @@ bool MorphTargetManager::setWeights(ph::rt::Mesh * mesh, const std::vector<float
 
         // Already set
         if (morphTargetData.weights.size() == weights.size()) {
-            morphTargetData.dirty   = morphTargetData.weights != weights;
+            morphTargetData.dirty |= morphTargetData.weights != weights;
             morphTargetData.weights = weights;
             return true;
         }
 
-        size_t numTargets = morphTargetData.targets.size();
+        size_t numTargets = morphTargetData.targetCount();
 
         // No morph target data
         if (numTargets <= 0) return false;
@@ -344,11 +521,50 @@ bool MorphTargetManager::setWeights(ph::rt::Mesh * mesh, const std::vector<float
     }
 }
 
-void MorphTargetManager::update(bool) {
-    if (_morphMode == MorphMode::CPU) {
-        morphTargetsCPU();
-    } else if (_morphMode == MorphMode::GPU) {
-        morphTargetsGPU();
-        cleanupApps();
+void MorphTargetManager::clear() {
+    _morphTargets.clear();
+    _morphBuffers.clear();
+    _dirtyMeshes.clear();
+}
+
+void MorphTargetManager::record(DeferredHostOperation & dho, VkCommandBuffer cb) {
+    if (MorphMode::OFF == _morphMode || !_initialized) return;
+    if (MorphMode::GPU == _morphMode && !_compute) return;
+
+    // Collect meshes whose weights have changed.
+    _dirtyMeshes.clear();
+    for (auto & [mesh, morphData] : _morphTargets) {
+        if (morphData.dirty && _morphBuffers.count(mesh)) _dirtyMeshes.push_back(mesh);
     }
+    if (_dirtyMeshes.empty()) return;
+
+    if (MorphMode::CPU == _morphMode)
+        morphTargetsCPU(dho, cb);
+    else
+        morphTargetsGPU(dho, cb);
+
+    // Make sure the morphed vertices are ready before they are read by the BLAS builder.
+    VkMemoryBarrier mBarrier = {.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                .pNext         = nullptr,
+                                .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                                .dstAccessMask = VK_ACCESS_SHADER_READ_BIT};
+    vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &mBarrier,
+                         0, nullptr, 0, nullptr);
+
+    // Call mesh.morph() to add the meshes to the queue of modified meshes that need to be processed
+    for (auto mesh : _dirtyMeshes) {
+        VkBuffer outputBuffer = _morphBuffers[mesh].outputVertexBuffer.g.buffer;
+        auto     stride       = (uint16_t) sizeof(rt::device::MorphVertex);
+        auto     vi           = Mesh::VertexInput {
+            .position = Mesh::VertexElement(outputBuffer, offsetof(rt::device::MorphVertex, position), stride),
+            .normal   = Mesh::VertexElement(outputBuffer, offsetof(rt::device::MorphVertex, normal), stride),
+        };
+        if (!_morphTargets[mesh].origAttribs.tangents.empty())
+            vi.tangent = Mesh::VertexElement(outputBuffer, offsetof(rt::device::MorphVertex, tangent), stride);
+        mesh->morph(vi);
+        _morphTargets[mesh].dirty = false;
+    }
+
+    // Staging space used by this frame can be reclaimed once GPU is done with it.
+    _stagingRing->endFrame(dho);
 }
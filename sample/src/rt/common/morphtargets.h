@@ -5,7 +5,7 @@
 #pragma once
 
 #include <ph/rt-utils.h>
-#include "3rdparty/vulkan_minimal_compute/computeApplication.inl"
+#include "staging-ring.h"
 #include "shader/morph-targets.glsl"
 
 using namespace ph;
@@ -14,8 +14,14 @@ using namespace ph::va;
 
 enum MorphMode {
     OFF,
-    CPU,
-    GPU,
+    CPU, // worker threads, then the result is uploaded to GPU
+    GPU, // compute shader
+};
+
+// How morph target deltas are encoded. See morph-targets.glsl for details.
+enum class MorphDeltaFormat {
+    FLOAT16 = MORPH_DELTA_FLOAT16, // half precision floats
+    SNORM10 = MORPH_DELTA_SNORM10, // 10-bit integers, scaled per target. Smallest, but lossy.
 };
 
 // Target data for a given mesh
@@ -26,9 +32,15 @@ struct MorphTargetData {
         std::vector<float> normals;
         std::vector<float> tangents;
         size_t             count; // position count - not sure if this is needed?
+
+        // Vertices displaced by each attribute above, in increasing order. Same as the indices of a glTF sparse
+        // accessor. Empty means the attribute is dense: its k-th value displaces the k-th vertex.
+        std::vector<uint32_t> positionIndices;
+        std::vector<uint32_t> normalIndices;
+        std::vector<uint32_t> tangentIndices;
     };
 
-    // target ID, target attribs
+    // target ID, target attribs. Released once encoded to deltas.
     std::vector<TargetAttribs> targets;
 
     TargetAttribs origAttribs;
@@ -36,15 +48,32 @@ struct MorphTargetData {
     // Indexed by target ID
     std::vector<float> weights;
 
-    bool dirty;
+    bool dirty = true;
+
+    // Non-zero displacements of all targets, sorted by vertex and encoded in deltaFormat. Built from targets by
+    // MorphTargetManager.
+    std::vector<uint32_t>                    deltas;
+    std::vector<rt::device::MorphDeltaScale> deltaScales; // indexed by target ID
+    MorphDeltaFormat                         deltaFormat = MorphDeltaFormat::FLOAT16;
+
+    // Deltas of vertex i are in word range [deltaRanges[i], deltaRanges[i + 1]) of the delta stream.
+    std::vector<uint32_t> deltaRanges;
+
+    // Number of targets. Still valid after the targets are released.
+    size_t targetCount() const { return deltaRanges.empty() ? targets.size() : deltaScales.size(); }
+
+    // Appends morph targets of the next primitive of the mesh. The primitive starts at vertex vertexBase of the mesh.
+    void append(MorphTargetData & input, size_t vertexBase);
 };
 
 struct MorphTargetBuffer {
     // Static buffers
-    va::StagedBufferObject<VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, rt::device::Vertex> inputVertexBuffer;
-    va::StagedBufferObject<VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, rt::device::Vertex> outputVertexBuffer;
-    va::StagedBufferObject<VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, float>              weightsBuffer;
-    va::StagedBufferObject<VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, rt::device::Vertex> targetsBuffer;
+    va::StagedBufferObject<VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, rt::device::MorphVertex>     inputVertexBuffer;
+    va::StagedBufferObject<VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, rt::device::MorphVertex>     outputVertexBuffer;
+    va::StagedBufferObject<VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, float>                       weightsBuffer;
+    va::StagedBufferObject<VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, uint32_t>                    deltasBuffer;
+    va::StagedBufferObject<VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, uint32_t>                    deltaRangesBuffer;
+    va::StagedBufferObject<VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, rt::device::MorphDeltaScale> deltaScalesBuffer;
 
     PH_NO_COPY(MorphTargetBuffer);
     PH_NO_MOVE(MorphTargetBuffer);
@@ -55,7 +84,9 @@ struct MorphTargetBuffer {
         inputVertexBuffer.clear();
         outputVertexBuffer.clear();
         weightsBuffer.clear();
-        targetsBuffer.clear();
+        deltasBuffer.clear();
+        deltaRangesBuffer.clear();
+        deltaScalesBuffer.clear();
     }
 };
 
@@ -66,26 +97,26 @@ struct MorphTargetManager {
 
     MorphTargetManager() = default;
 
-    ~MorphTargetManager() { cleanupApps(); }
+    ~MorphTargetManager() { safeDelete(_compute); }
 
 private:
     // TODO: This currently assumes that everything will have vertex, normal, and tangent data. This
     //       needs to be changed so that the other cases (i.e. vertex only, vertex/normal) are handled.
-    void allocateBuffers(MorphTargetData morphData, MorphTargetBuffer & morphBuffer);
+    void allocateBuffers(MorphTargetData & morphData, MorphTargetBuffer & morphBuffer);
 
-    void cleanupApps();
+    static void buildDeltas(MorphTargetData & morphData, MorphDeltaFormat format);
 
     AutoHandle<VkShaderModule> createShader(const ConstRange<uint8_t> & data, const char * name);
 
-    void initGPUMorphTargets();
+    void initMorphTargets();
 
     std::vector<uint8_t> loadEmbeddedResource(const std::string & name, bool quiet);
 
     void loadMorphTargetShader();
 
-    void morphTargetsCPU();
+    void morphTargetsCPU(DeferredHostOperation & dho, VkCommandBuffer cb);
 
-    void morphTargetsGPU();
+    void morphTargetsGPU(DeferredHostOperation & dho, VkCommandBuffer cb);
 
     bool reinitializeMorphTargets();
 
@@ -98,18 +129,36 @@ public:
 
     void initializeMorphTargets(VulkanSubmissionProxy * vsp);
 
+    /// Select where morph targets are applied. Takes effect on next call to record().
+    void setMode(MorphMode mode);
+
+    /// Select how morph target deltas are stored, on both CPU and GPU. Must be called before initializeMorphTargets().
+    void setDeltaFormat(MorphDeltaFormat format) {
+        PH_ASSERT(!_initialized);
+        _deltaFormat = format;
+    }
+
     bool setWeights(ph::rt::Mesh * mesh, const std::vector<float> & weights);
 
-    void update(bool);
+    /// Forget all meshes and release their buffers. Call this when the meshes are deleted, after GPU is done with them.
+    void clear();
+
+    /// Record commands to morph all meshes whose weights have changed since last call. All meshes share the command
+    /// buffer, and all per-frame uploads go through one staging ring.
+    void record(DeferredHostOperation & dho, VkCommandBuffer cb);
 
 private:
-    MorphTargetMap                         _morphTargets;
-    MorphBufferMap                         _morphBuffers;
-    MorphMode                              _morphMode;
-    VulkanSubmissionProxy *                _vsp = nullptr;
-    std::vector<MinimalComputeApplication> _appsToCleanup;
-    va::AutoHandle<VkShaderModule>         _shaderModule;
-    bool                                   _gpuInitialized = false;
+    MorphTargetMap                       _morphTargets;
+    MorphBufferMap                       _morphBuffers;
+    MorphMode                            _morphMode   = MorphMode::GPU;
+    MorphDeltaFormat                     _deltaFormat = MorphDeltaFormat::FLOAT16;
+    VulkanSubmissionProxy *              _vsp         = nullptr;
+    va::AutoHandle<VkShaderModule>       _shaderModule;
+    va::SimpleCompute *                  _compute = nullptr;
+    std::unique_ptr<StagingRing>         _stagingRing; ///< staging space of per-frame weight and vertex uploads.
+    bool                                 _initialized = false;
+    std::vector<ph::rt::Mesh *>          _dirtyMeshes; ///< meshes to morph in current frame.
+    std::vector<rt::device::MorphVertex> _cpuVertices; ///< scratch buffer of morphed vertices of one mesh.
 
     std::vector<float> empty;
 };
\ No newline at end of file
@@ -0,0 +1,159 @@
+/*****************************************************************************
+ * Copyright (C) 2020 - 2024 OPPO. All rights reserved.
+ *******************************************************************************/
+
+#pragma once
+
+#include <ph/va.h>
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+
+/// A ring of persistently mapped host buffers to read back images from GPU without stalling the render loop.
+///
+/// This is a replacement of ph::va::readBaseImagePixels() for images that are read back every frame. Instead of
+/// submitting a copy and waiting for it on the spot, the copy is recorded into the frame's own command buffer. The
+/// buffer is marked ready via DeferredHostOperation::deferUntilGPUWorkIsDone(), and handed over by the next drain() call,
+/// a few frames later. Images are always handed over in the order they are read back.
+///
+/// Typical usage:
+///
+///     // when recording the frame
+///     ring.cmdReadback(dho, cb, image, layout, format, width, height, frameIndex);
+///     // once per frame, outside of recording
+///     ring.drain([](ph::RawImage && image, uint64_t frameIndex) { ... });
+///     // before quitting, or before the render loop is destroyed
+///     device.waitIdle();
+///     ring.flush([](ph::RawImage && image, uint64_t frameIndex) { ... });
+class ReadbackRing {
+public:
+    struct Stats {
+        uint64_t readbacks = 0; ///< number of images read back through the ring.
+        uint64_t stalls    = 0; ///< number of times the ring is full, and we have to wait for GPU to catch up.
+    };
+
+    /// @param slotCount Number of host buffers. It should be larger than max number of in-flight frames of the render
+    ///                  loop. Or else, the ring is always full and every readback stalls.
+    ReadbackRing(const ph::va::VulkanGlobalInfo & vgi, size_t slotCount): _ring(std::make_shared<Ring>(vgi, slotCount)) {}
+
+    PH_NO_COPY(ReadbackRing);
+    PH_DEFAULT_MOVE(ReadbackRing);
+
+    /// Record command to copy base level of the image to the next free slot of the ring.
+    /// @param layout Layout of the image at this point of the command buffer. The image is put back to this layout after
+    ///               the copy. The image must be created with VK_IMAGE_USAGE_TRANSFER_SRC_BIT.
+    void cmdReadback(ph::va::DeferredHostOperation & dho, VkCommandBuffer cb, VkImage image, VkImageLayout layout, VkFormat format, uint32_t width,
+                     uint32_t height, uint64_t frameIndex) {
+        auto & r = *_ring;
+        if (r.pending.size() == r.slots.size()) {
+            // The ring is full. This happens only if the caller has not called drain() for a while. Wait for GPU to
+            // finish all submitted work, and move the oldest image out of the ring, to be handed over by next drain().
+            ++r.stats.stalls;
+            PH_VA_REQUIRE(ph::va::threadSafeDeviceWaitIdle(r.vgi.device));
+            auto & oldest = *r.pending.front();
+            r.pending.pop_front();
+            r.evicted.push_back({oldest.toRawImage(), oldest.frameIndex});
+            oldest.busy = false;
+        }
+
+        auto & slot = r.acquire(ph::ImagePlaneDesc::make(ph::va::colorFormatFromVK(format), width, height));
+        slot.frameIndex = frameIndex;
+
+        auto & desc   = slot.desc;
+        auto   region = VkBufferImageCopy {};
+        // Buffer row length is in unit of pixels, while plane pitch is in unit of bytes.
+        region.bufferRowLength  = desc.pitch / desc.step;
+        region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        region.imageExtent      = {width, height, 1};
+        ph::va::setImageLayout(cb, image, layout, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, ph::va::firstSubImageRange());
+        vkCmdCopyImageToBuffer(cb, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot.buffer.buffer, 1, &region);
+        ph::va::setImageLayout(cb, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, layout, ph::va::firstSubImageRange());
+        ++r.stats.readbacks;
+
+        // The job holds a reference to the ring, so the buffer stays alive until GPU is done with it. The generation
+        // check skips jobs of slots that have been handed over by flush() already.
+        dho.deferUntilGPUWorkIsDone([ring = _ring, s = &slot, generation = slot.generation]() {
+            if (s->generation == generation) s->ready = true;
+        });
+    }
+
+    /// Hand over all images that are done by GPU, in the order of cmdReadback() calls.
+    /// @param proc Callback of the form void(ph::RawImage &&, uint64_t frameIndex).
+    template<typename PROC>
+    void drain(PROC && proc) {
+        auto & r = *_ring;
+        for (auto & e : r.evicted) proc(std::move(e.first), e.second);
+        r.evicted.clear();
+        while (!r.pending.empty() && r.pending.front()->ready) {
+            auto & slot = *r.pending.front();
+            r.pending.pop_front();
+            proc(slot.toRawImage(), slot.frameIndex);
+            slot.busy = false;
+        }
+    }
+
+    /// Hand over all pending images, regardless of their state. The caller must make sure GPU is idle.
+    template<typename PROC>
+    void flush(PROC && proc) {
+        for (auto s : _ring->pending) s->ready = true;
+        drain(proc);
+    }
+
+    const Stats & stats() const { return _ring->stats; }
+
+private:
+    using Mapped = ph::va::BufferObject::MappedResult<uint8_t>;
+
+    struct Slot {
+        ph::va::BufferObject    buffer;
+        std::unique_ptr<Mapped> mapped;
+        ph::ImagePlaneDesc      desc;
+        uint64_t                frameIndex = 0;
+        uint64_t                generation = 0; ///< bumped each time the slot is reused.
+        bool                    busy       = false;
+        bool                    ready      = false;
+
+        Slot(): buffer(VK_BUFFER_USAGE_TRANSFER_DST_BIT, ph::va::DeviceMemoryUsage::CPU_ONLY) {}
+
+        ~Slot() {
+            // unmap before the buffer is released.
+            mapped.reset();
+        }
+
+        ph::RawImage toRawImage() const { return ph::RawImage(ph::ImageDesc(desc), mapped->range.data(), desc.size); }
+    };
+
+    struct Ring {
+        const ph::va::VulkanGlobalInfo &               vgi;
+        std::vector<std::unique_ptr<Slot>>             slots;
+        std::deque<Slot *>                             pending; ///< slots in use, in the order of cmdReadback() calls.
+        std::vector<std::pair<ph::RawImage, uint64_t>> evicted; ///< images moved out of a full ring, older than all pending ones.
+        size_t                                         next = 0;
+        Stats                                          stats;
+
+        Ring(const ph::va::VulkanGlobalInfo & vgi_, size_t slotCount): vgi(vgi_) {
+            for (size_t i = 0; i < std::max<size_t>(slotCount, 1); ++i) slots.emplace_back(new Slot());
+        }
+
+        Slot & acquire(const ph::ImagePlaneDesc & desc) {
+            // Slots are used in round robin fashion, so the next one is always the least recently used.
+            auto & slot = *slots[next];
+            next        = (next + 1) % slots.size();
+            PH_ASSERT(!slot.busy);
+            if (slot.buffer.size < desc.size) {
+                slot.mapped.reset();
+                slot.buffer.allocate(vgi, desc.size, "readback ring");
+                slot.mapped.reset(new Mapped(slot.buffer.map<uint8_t>()));
+            }
+            slot.desc  = desc;
+            slot.busy  = true;
+            slot.ready = false;
+            ++slot.generation;
+            pending.push_back(&slot);
+            return slot;
+        }
+    };
+
+    std::shared_ptr<Ring> _ring;
+};
@@ -7,11 +7,55 @@
 #include <ph/va.h>
 
 class SceneBuildBuffers : public ph::va::DeferredHostOperation {
+public:
+    /// Usage flags of permanent buffers, unless specified otherwise.
+    static constexpr VkBufferUsageFlags DEFAULT_USAGE =
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+    /// A range of data in a permanent GPU buffer.
+    struct BufferRange {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        uint64_t offset = 0;
+    };
+
+private:
+    /// Size of each CPU side staging buffer in batched mode.
+    static constexpr size_t STAGING_BLOCK_SIZE = 64 * 1024 * 1024;
+
+    /// Pending uploads are flushed automatically, once total size of staging buffers goes beyond this limit.
+    static constexpr size_t STAGING_BUDGET = 4 * STAGING_BLOCK_SIZE;
+
+    /// Size of each GPU buffer that permanent ranges are sub-allocated from.
+    static constexpr size_t ARENA_BLOCK_SIZE = 64 * 1024 * 1024;
+
+    /// Alignment of sub-allocated ranges. 256 is the max value of minStorageBufferOffsetAlignment allowed by the spec.
+    static constexpr size_t ARENA_ALIGNMENT = 256;
+
+    /// A buffer that is filled from the beginning to the end.
+    struct Block {
+        ph::va::BufferObject buffer;
+        size_t               used = 0;
+        Block(VkBufferUsageFlags usage, ph::va::DeviceMemoryUsage memory): buffer(usage, memory) {}
+    };
+
+    /// A pending copy from staging block to permanent buffer.
+    struct Copy {
+        size_t       staging; ///< index of the staging block
+        VkBufferCopy region;
+        VkBuffer     dst;
+    };
+
     std::list<ph::va::BufferObject>    _buffers;
     ph::va::VulkanSubmissionProxy &    _vsp;
     std::vector<std::function<void()>> _deferredJobs;
     bool                               _finished = false;
 
+    // Batched mode states.
+    int                _batchDepth = 0;
+    std::vector<Block> _staging;
+    std::vector<Copy>  _copies;
+    std::list<Block>   _arena;
+
 public:
     SceneBuildBuffers(ph::va::SimpleVulkanDevice & dev): DeferredHostOperation(dev.vgi()), _vsp(dev.graphicsQ()) {};
 
@@ -19,6 +63,10 @@ public:
 
     void finish() {
         PH_REQUIRE(!_finished);
+
+        // make sure all uploads are done before running deferred jobs.
+        flush();
+
         _finished = true;
 
         // run all deferred job
@@ -32,7 +80,65 @@ public:
         _deferredJobs.push_back(std::move(func));
     }
 
-    template<typename T, VkBufferUsageFlags USAGE = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT>
+    /// Enter batched mode: uploads are no longer submitted to GPU one by one. Instead, they are packed into large staging
+    /// buffers, then copied to their permanent buffers by one command buffer submitted in flush(). Calls can be nested.
+    ///
+    /// Content of buffers allocated in batched mode is undefined until the batch ends or flush() is called.
+    void beginBatch() {
+        PH_REQUIRE(!_finished);
+        ++_batchDepth;
+    }
+
+    /// Leave batched mode. Flush all pending uploads when the outermost batch ends.
+    void endBatch() {
+        PH_REQUIRE(_batchDepth > 0);
+        if (0 == --_batchDepth) flush();
+    }
+
+    /// Leave batched mode without uploading anything. Pending uploads are dropped when the outermost batch ends, so
+    /// buffers allocated in the batch keep undefined content. Meant for error paths, where flushing to GPU could throw
+    /// again.
+    void discardBatch() {
+        PH_REQUIRE(_batchDepth > 0);
+        if (0 == --_batchDepth) {
+            _copies.clear();
+            _staging.clear();
+        }
+    }
+
+    bool batched() const { return _batchDepth > 0; }
+
+    /// Submit all pending uploads to GPU in one command buffer, then wait for them to finish.
+    void flush() {
+        if (_copies.empty()) {
+            _staging.clear();
+            return;
+        }
+
+        ph::va::SingleUseCommandPool pool(_vsp);
+        pool.syncExec([&](auto cb) {
+            // Issue one copy command for each run of regions that shares the same source and destination buffers.
+            std::vector<VkBufferCopy> regions;
+            for (size_t i = 0; i < _copies.size(); ++i) {
+                const auto & c = _copies[i];
+                regions.push_back(c.region);
+                bool last = (i + 1 == _copies.size()) || _copies[i + 1].staging != c.staging || _copies[i + 1].dst != c.dst;
+                if (last) {
+                    vkCmdCopyBuffer(cb, _staging[c.staging].buffer.buffer, c.dst, (uint32_t) regions.size(), regions.data());
+                    regions.clear();
+                }
+            }
+        });
+
+        size_t stagingSize = 0;
+        for (const auto & s : _staging) stagingSize += s.used;
+        PH_LOGI("Upload %zu buffers (%zu bytes) to GPU in one batch.", _copies.size(), stagingSize);
+
+        _copies.clear();
+        _staging.clear();
+    }
+
+    template<typename T, VkBufferUsageFlags USAGE = DEFAULT_USAGE>
     ph::va::BufferObject * allocatePermanentBuffer(ph::ConstRange<T> data, const char * name = nullptr) {
         PH_REQUIRE(!_finished);
 
@@ -40,28 +146,84 @@ public:
 
         uint32_t size = (uint32_t) (data.size() * sizeof(T));
 
-        // copy data to scratch buffer
-        auto scratch = ph::va::BufferObject(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, ph::va::DeviceMemoryUsage::CPU_ONLY, 0);
-        scratch.allocate(_vsp.vgi(), size, "scratch buffer");
-        {
-            const auto & mapped = scratch.map<uint8_t>();
-            memcpy(mapped.range.data(), data.data(), size);
-        }
-
         // allocate permanent buffer
         auto & permanent = _buffers.emplace_front(USAGE);
         permanent.allocate(_vsp.vgi(), size, name);
 
-        // copy data from scratch buffer to permanent buffer
-        ph::va::SingleUseCommandPool pool(_vsp);
-        pool.syncExec([&](auto cb) {
-            auto region      = VkBufferCopy {};
-            region.srcOffset = 0;
-            region.dstOffset = 0;
-            region.size      = size;
-            vkCmdCopyBuffer(cb, scratch.buffer, permanent.buffer, 1, &region);
-        });
+        upload(data.data(), size, permanent.buffer, 0);
         PH_LOGI("Upload %s to GPU buffer: handle=0x%" PRIx64 "", name, (uint64_t) permanent.buffer);
         return &permanent;
     }
-};
\ No newline at end of file
+
+    /// Allocate a range of permanent buffer with default usage and upload data to it.
+    ///
+    /// In batched mode, small ranges are sub-allocated from a few large GPU buffers, instead of creating one buffer
+    /// for each of them. Otherwise, this is the same as allocatePermanentBuffer().
+    template<typename T>
+    BufferRange allocatePermanentRange(ph::ConstRange<T> data, const char * name = nullptr) {
+        PH_REQUIRE(!_finished);
+
+        size_t size = data.size() * sizeof(T);
+        if (!batched() || size > ARENA_BLOCK_SIZE / 4) return {allocatePermanentBuffer<T>(data, name)->buffer, 0};
+
+        // find room in the current arena block, or start a new one.
+        size_t offset = _arena.empty() ? ARENA_BLOCK_SIZE : ph::nextMultiple(_arena.front().used, ARENA_ALIGNMENT);
+        if (offset + size > ARENA_BLOCK_SIZE) {
+            auto & block = _arena.emplace_front(DEFAULT_USAGE, ph::va::DeviceMemoryUsage::GPU_ONLY);
+            block.buffer.allocate(_vsp.vgi(), ARENA_BLOCK_SIZE, "scene build arena");
+            offset = 0;
+        }
+        auto & block = _arena.front();
+        block.used   = offset + size;
+
+        upload(data.data(), size, block.buffer.buffer, offset);
+        return {block.buffer.buffer, offset};
+    }
+
+private:
+    void upload(const void * data, size_t size, VkBuffer dst, size_t dstOffset) {
+        if (0 == size) return;
+
+        if (!batched()) {
+            // copy data to scratch buffer
+            auto scratch = ph::va::BufferObject(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, ph::va::DeviceMemoryUsage::CPU_ONLY, 0);
+            scratch.allocate(_vsp.vgi(), size, "scratch buffer");
+            {
+                const auto & mapped = scratch.map<uint8_t>();
+                memcpy(mapped.range.data(), data, size);
+            }
+
+            // copy data from scratch buffer to permanent buffer
+            ph::va::SingleUseCommandPool pool(_vsp);
+            pool.syncExec([&](auto cb) {
+                auto region      = VkBufferCopy {};
+                region.srcOffset = 0;
+                region.dstOffset = dstOffset;
+                region.size      = size;
+                vkCmdCopyBuffer(cb, scratch.buffer, dst, 1, &region);
+            });
+            return;
+        }
+
+        // find room in the current staging block, or start a new one. Oversized uploads get a dedicated block.
+        if (_staging.empty() || _staging.back().used + size > _staging.back().buffer.size) {
+            if (_staging.size() * STAGING_BLOCK_SIZE >= STAGING_BUDGET) flush();
+            auto & block = _staging.emplace_back(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, ph::va::DeviceMemoryUsage::CPU_ONLY);
+            block.buffer.allocate(_vsp.vgi(), std::max(size, STAGING_BLOCK_SIZE), "staging buffer");
+        }
+        auto & block = _staging.back();
+        {
+            const auto & mapped = block.buffer.map<uint8_t>(block.used, size);
+            memcpy(mapped.range.data(), data, size);
+        }
+
+        auto region      = VkBufferCopy {};
+        region.srcOffset = block.used;
+        region.dstOffset = dstOffset;
+        region.size      = size;
+        _copies.push_back({_staging.size() - 1, region, dst});
+
+        // keep staging offsets 16-byte aligned.
+        block.used = ph::nextMultiple(block.used + size, (size_t) 16);
+    }
+};
@@ -4,7 +4,10 @@
 
 #include "pch.h"
 #include "scene-graph.h"
+#include "thread-pool.h"
 
+#include <atomic>
+#include <chrono>
 #include <queue>
 #include <stack>
 
@@ -14,6 +17,140 @@ using namespace ph::rt;
 
 namespace sg {
 
+// ---------------------------------------------------------------------------------------------------------------------
+/// Fixed size block allocator for scene graph nodes.
+///
+/// Nodes are carved out of 64KB blocks that are aligned to their own size, so the owning block of any node can be
+/// found by masking its address. Free slots are kept in an intrusive doubly linked list. When the last live node of a
+/// block is released, the whole block is returned to the system at once. Since nodes of the same subtree are usually
+/// created together (like when loading a glTF scene), deleting a subtree tends to release whole blocks. One empty block
+/// is kept as a spare, so creating and deleting a node at a block boundary doesn't go to the system every time.
+class NodePool {
+public:
+    NodePool() = default;
+
+    ~NodePool() {
+        PH_ASSERT(0 == _live);
+        while (_blocks) releaseBlock(_blocks);
+        if (_spare) destroyBlock(_spare);
+    }
+
+    PH_NO_COPY_NO_MOVE(NodePool);
+
+    void * allocate() {
+        void * p;
+        if (_freeSlots) {
+            // reuse a free slot.
+            auto slot = _freeSlots;
+            unlinkSlot(slot);
+            p = slot;
+        } else {
+            // bump allocate from the newest block. Create a new block if it is full.
+            if (!_blocks || _blocks->bumped == SLOTS_PER_BLOCK) allocateBlock();
+            p = slotAddress(_blocks, _blocks->bumped++);
+        }
+        ++blockOf(p)->live;
+        ++_live;
+        return p;
+    }
+
+    void free(void * p) {
+        if (!p) return;
+        auto block = blockOf(p);
+        PH_ASSERT(block->live > 0);
+        --_live;
+        if (0 == --block->live) {
+            // The block is empty now. Release it in one shot, or keep it as the spare block if there's none. All other
+            // allocated slots of the block are in the free list, so unlink them first.
+            for (size_t i = 0; i < block->bumped; ++i) {
+                auto s = (Slot *) slotAddress(block, i);
+                if (s != p) unlinkSlot(s);
+            }
+            if (_spare) {
+                releaseBlock(block);
+            } else {
+                unlinkBlock(block);
+                block->bumped = 0;
+                _spare        = block;
+            }
+        } else {
+            linkSlot((Slot *) p);
+        }
+    }
+
+private:
+    struct Block {
+        Block * prev   = nullptr;
+        Block * next   = nullptr;
+        size_t  live   = 0; // number of allocated slots in the block
+        size_t  bumped = 0; // number of slots that have been handed out at least once.
+    };
+
+    struct Slot {
+        Slot * prev;
+        Slot * next;
+    };
+
+    static constexpr size_t BLOCK_BYTES     = 64 * 1024;
+    static constexpr size_t SLOT_ALIGN      = std::max(alignof(Node), alignof(Slot));
+    static constexpr size_t HEADER_BYTES    = (sizeof(Block) + SLOT_ALIGN - 1) / SLOT_ALIGN * SLOT_ALIGN;
+    static constexpr size_t SLOT_BYTES      = (std::max(sizeof(Node), sizeof(Slot)) + SLOT_ALIGN - 1) / SLOT_ALIGN * SLOT_ALIGN;
+    static constexpr size_t SLOTS_PER_BLOCK = (BLOCK_BYTES - HEADER_BYTES) / SLOT_BYTES;
+    static_assert(SLOTS_PER_BLOCK > 0);
+
+    Block * _blocks    = nullptr; // list of all blocks. The first one is the block being bump allocated.
+    Slot *  _freeSlots = nullptr; // list of all free slots.
+    Block * _spare     = nullptr; // an empty block that is not in the block list, reused by the next allocateBlock().
+    size_t  _live      = 0;
+
+    static Block * blockOf(void * p) { return (Block *) ((uintptr_t) p & ~(uintptr_t) (BLOCK_BYTES - 1)); }
+
+    static void * slotAddress(Block * b, size_t i) { return (uint8_t *) b + HEADER_BYTES + i * SLOT_BYTES; }
+
+    void allocateBlock() {
+        Block * b;
+        if (_spare) {
+            b      = _spare;
+            _spare = nullptr;
+        } else {
+            b = new (::operator new(BLOCK_BYTES, std::align_val_t(BLOCK_BYTES))) Block();
+        }
+        b->prev = nullptr;
+        b->next = _blocks;
+        if (_blocks) _blocks->prev = b;
+        _blocks = b;
+    }
+
+    void unlinkBlock(Block * b) {
+        if (b->prev) b->prev->next = b->next;
+        if (b->next) b->next->prev = b->prev;
+        if (_blocks == b) _blocks = b->next;
+    }
+
+    void releaseBlock(Block * b) {
+        unlinkBlock(b);
+        destroyBlock(b);
+    }
+
+    static void destroyBlock(Block * b) {
+        b->~Block();
+        ::operator delete(b, std::align_val_t(BLOCK_BYTES));
+    }
+
+    void linkSlot(Slot * s) {
+        s->prev = nullptr;
+        s->next = _freeSlots;
+        if (_freeSlots) _freeSlots->prev = s;
+        _freeSlots = s;
+    }
+
+    void unlinkSlot(Slot * s) {
+        if (s->prev) s->prev->next = s->next;
+        if (s->next) s->next->prev = s->prev;
+        if (_freeSlots == s) _freeSlots = s->next;
+    }
+};
+
 // ---------------------------------------------------------------------------------------------------------------------
 //
 Node::Node(Graph & graph, Node * parent): _graph(graph), _parent(parent) {
@@ -26,24 +163,48 @@ Node::Node(Graph & graph, Node * parent): _graph(graph), _parent(parent) {
     }
 
     // Record this as a child in its parent.
-    if (_parent) {
-        PH_ASSERT(_parent->_children.end() == std::find(_parent->_children.begin(), _parent->_children.end(), this));
-        _parent->_children.push_back(this);
-    }
+    if (_parent) linkToParent();
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
 //
 Node::~Node() {
     // remove from parent's children list.
-    if (_parent) {
-        PH_ASSERT(1 == std::count(_parent->_children.begin(), _parent->_children.end(), this));
-        _parent->_children.remove(this);
-    }
+    if (_parent) unlinkFromParent();
 
     detachAllComponents();
 }
 
+// ---------------------------------------------------------------------------------------------------------------------
+//
+void Node::linkToParent() {
+    PH_ASSERT(_parent && !_prevSibling && !_nextSibling);
+    _prevSibling = _parent->_lastChild;
+    if (_prevSibling)
+        _prevSibling->_nextSibling = this;
+    else
+        _parent->_firstChild = this;
+    _parent->_lastChild = this;
+    ++_parent->_childCount;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+void Node::unlinkFromParent() {
+    PH_ASSERT(_parent && _parent->_childCount > 0);
+    if (_prevSibling)
+        _prevSibling->_nextSibling = _nextSibling;
+    else
+        _parent->_firstChild = _nextSibling;
+    if (_nextSibling)
+        _nextSibling->_prevSibling = _prevSibling;
+    else
+        _parent->_lastChild = _prevSibling;
+    _prevSibling = nullptr;
+    _nextSibling = nullptr;
+    --_parent->_childCount;
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 //
 void Node::setParent(Node * parent) {
@@ -73,17 +234,19 @@ void Node::setParent(Node * parent) {
     PH_ASSERT(parent != _parent);
 
     // remove from old parent's children list.
-    auto iter = std::find(_parent->_children.begin(), _parent->_children.end(), this);
-    PH_ASSERT(iter != _parent->_children.end());
-    _parent->_children.erase(iter);
+    unlinkFromParent();
 
     // add to new parent
     _parent = (Node *) parent;
-    PH_ASSERT(_parent->_children.end() == std::find(_parent->_children.begin(), _parent->_children.end(), this));
-    _parent->_children.push_back(this);
+    linkToParent();
+    _graph.onTopologyChanged();
 
     // mark world transform as dirty
     setWorldTransformDirty();
+
+    // The subtree could have been dirty already, so it is not stamped by the call above. Stamp it anyway, so that
+    // the new ancestors know something changed in their subtrees.
+    propagateVersion(++_graph._transformVersion);
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -96,7 +259,12 @@ int64_t Node::attachComponent(Model * m, uint32_t mask) {
         return 0;
     }
     auto entity = scene().addModel(*m, mask);
-    if (entity) _models.push_back({m, entity});
+    if (entity) {
+        _models.push_back({m, entity});
+        _graph.onModelsChanged();
+        // make sure the new entity receives the node's world transform.
+        _graph.markSubtreeForFlush(this);
+    }
     return entity;
 }
 
@@ -112,13 +280,16 @@ void Node::detachComponent(Model * m) {
     PH_ASSERT(iter->second);
     scene().deleteEntity(iter->second);
     _models.erase(iter);
+    _graph.onModelsChanged();
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
 //
 void Node::detachAllModels() {
+    if (_models.empty()) return;
     for (auto & m : _models) scene().deleteEntity(m.second);
     _models.clear();
+    _graph.onModelsChanged();
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -133,6 +304,8 @@ void Node::attachComponent(Light * l) {
     auto entity = scene().addLight(*l);
     if (!entity) return;
     _lights.push_back({l, entity});
+    // make sure the new entity receives the node's world transform.
+    _graph.markSubtreeForFlush(this);
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -171,6 +344,7 @@ void Node::setTransform(const Transform & transform) {
 
     // Record the new value of the transform.
     _local2Parent = transform;
+    _graph.onLocalTransformChanged(this);
 
     // Record that the world transforms of this node and its children
     // will need to be updated before we use them again.
@@ -212,21 +386,37 @@ void Node::setVisible(bool v) {
 // ---------------------------------------------------------------------------------------------------------------------
 //
 void Node::setWorldTransformDirty() {
+    // The whole subtree needs to be flushed to the scene, regardless of current state of the dirty flag, since
+    // the dirty flag could have been cleared by a worldTransform() call w/o flushing.
+    _graph.markSubtreeForFlush(this);
+
     // If this node is already dirty, nothing to do.
     // Even if a descendant became clean later on,
     // it would update this node to become clean too while cleaning itself,
     // so it wouldn't still be marked dirty.
     if (_worldTransformDirty) { return; }
 
-    // set the whole subtree dirty
-    bfsTraverseNodeGraph([](Node * n) -> TraverseAction {
+    // set the whole subtree dirty, and stamp it with a new version. Nodes that are dirty already keep their version,
+    // since nobody has seen their current world transform yet.
+    uint64_t version = ++_graph._transformVersion;
+    bfsTraverseNodeGraph([version](Node * n) -> TraverseAction {
         if (n->_worldTransformDirty)
             return TraverseAction::SKIP_SUBTREE;
         else {
             n->_worldTransformDirty = true;
+            n->_worldVersion        = version;
+            n->_subtreeVersion      = version;
             return TraverseAction::CONTINUE;
         }
     });
+    propagateVersion(version);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+void Node::propagateVersion(uint64_t version) {
+    _worldVersion = version;
+    for (Node * n = this; n; n = n->_parent) n->_subtreeVersion = version;
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -303,7 +493,7 @@ void Node::recalculateWorldTransform() const {
 
 // ---------------------------------------------------------------------------------------------------------------------
 //
-Graph::Graph(Scene & scene): _scene(scene) {
+Graph::Graph(Scene & scene): _scene(scene), _pool(new NodePool()) {
     // set name of root node
     _root.name = "root";
 }
@@ -324,14 +514,21 @@ Node * Graph::createNode(Node * parent) {
         return nullptr;
     }
     // create new node
-    auto n = new Node(*this, parent);
-    if (!n) return nullptr;
+    auto mem = _pool->allocate();
+    Node * n;
+    try {
+        n = new (mem) Node(*this, parent);
+    } catch (...) {
+        _pool->free(mem);
+        throw;
+    }
 
     // new node is always in identity transform.
     n->setTransform({});
 
     // done
-    n->_iter = _nodes.insert(_nodes.end(), n);
+    ++_nodeCount;
+    onTopologyChanged();
     return n;
 }
 
@@ -352,23 +549,228 @@ void Graph::deleteNodeAndSubtree(Node *& node) {
         return Node::TraverseAction::CONTINUE;
     });
 
+    // Drop the doomed nodes from the pending flush list, in one pass over the list. Only nodes flagged with
+    // _flushPending are in the list, i.e. nodes whose transform was set since the last flush. An animated subtree may
+    // have most of its nodes in there, so removing them one by one would be quadratic. The root node is never deleted,
+    // so it stays in the list.
+    size_t pending = 0;
+    for (auto c : toBeDeleted) {
+        if (c != &_root && c->_flushPending) {
+            c->_flushPending = false;
+            ++pending;
+        }
+    }
+    if (pending > 0) _pendingFlush.erase(std::remove_if(_pendingFlush.begin(), _pendingFlush.end(), [](Node * n) { return !n->_flushPending; }), _pendingFlush.end());
+
     /// Now delete all nodes in the deletion list, in reversed order. Ignore the scene root node.
     for (auto iter = toBeDeleted.rbegin(); iter != toBeDeleted.rend(); ++iter) {
         Node * c = *iter;
         if (c != &_root) {
-            _nodes.erase(c->_iter);
-            delete c;
+            c->~Node();
+            _pool->free(c);
+            --_nodeCount;
         }
     }
 
+    onTopologyChanged();
+
     // The target node is deleted, reset the parameter pointer to null.
     if (node != &_root) node = nullptr;
 }
 
+// ---------------------------------------------------------------------------------------------------------------------
+//
+void Graph::setTransformUpdateMode(TransformUpdateMode mode) {
+    if (mode == _transformUpdateMode) return;
+    _transformUpdateMode = mode;
+    // Release the flat hierarchy. It'll be rebuilt on next refresh, if needed.
+    _flat.clear();
+    _flat.nodes.shrink_to_fit();
+    _flat.parents.shrink_to_fit();
+    _flat.local.shrink_to_fit();
+    _flat.world.shrink_to_fit();
+    _flat.dirty.shrink_to_fit();
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+uint64_t Graph::nextTopologyVersion() {
+    static std::atomic<uint64_t> counter {0};
+    return ++counter;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+void Graph::rebuildFlatHierarchy() {
+    _flat.clear();
+    auto count = _nodeCount + 1; // +1 for the root node.
+    _flat.nodes.reserve(count);
+    _flat.parents.reserve(count);
+    _flat.local.reserve(count);
+    _flat.world.reserve(count);
+    _flat.dirty.reserve(count);
+
+    // BFS traversal guarantees that parent is always stored in front of its children.
+    _root.bfsTraverseNodeGraph([&](Node * n) {
+        n->_flatIndex = _flat.nodes.size();
+        _flat.nodes.push_back(n);
+        _flat.parents.push_back(n->_parent ? n->_parent->_flatIndex : SIZE_MAX);
+        _flat.local.push_back(n->_local2Parent);
+        _flat.world.emplace_back();
+        _flat.dirty.push_back(1); // everything needs update after rebuild.
+        return Node::TraverseAction::CONTINUE;
+    });
+    PH_ASSERT(_flat.nodes.size() == count);
+
+    _flat.firstDirty    = 0;
+    _flat.topologyDirty = false;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+void Graph::updateFlatWorldTransforms() {
+    if (_flat.topologyDirty) rebuildFlatHierarchy();
+
+    // Nodes in front of the first dirty one are all clean, and so are their world transforms, since children are
+    // always stored after their parents. Skip them, and skip the whole update if nothing is dirty.
+    const size_t count = _flat.nodes.size();
+    const size_t first = _flat.firstDirty;
+    _flat.firstDirty   = SIZE_MAX;
+    if (first >= count) {
+        _flushStats.updated = 0;
+        return;
+    }
+
+    const size_t *    parents = _flat.parents.data();
+    const Transform * local   = _flat.local.data();
+    Transform *       world   = _flat.world.data();
+    uint8_t *         dirty   = _flat.dirty.data();
+
+    // Pass 1: linear walk through the array to propagate dirty flags and update world transforms. Since parent is
+    // always in front of its children, the parent's world transform is always up to date when the child is visited.
+    for (size_t i = first; i < count; ++i) {
+        auto p = parents[i];
+        if (SIZE_MAX == p) {
+            if (dirty[i]) world[i] = local[i];
+        } else {
+            dirty[i] |= dirty[p];
+            if (dirty[i]) world[i] = world[p] * local[i];
+        }
+    }
+
+    // Pass 2: write the result back to dirty nodes.
+    size_t updated = 0;
+    for (size_t i = first; i < count; ++i) {
+        if (!dirty[i]) continue;
+        auto n                  = _flat.nodes[i];
+        n->_local2World         = world[i];
+        n->_worldTransformDirty = false;
+        dirty[i]                = 0;
+        ++updated;
+    }
+    _flushStats.updated = updated;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+void Graph::updateWorldTransformsInParallel() {
+    if (_pendingFlush.empty()) return;
+
+    // Collect top level dirty subtrees. Skip the ones that are nested in another pending subtree, so that each node is
+    // visited by one thread only.
+    std::vector<Node *> subtrees;
+    subtrees.reserve(_pendingFlush.size());
+    for (auto n : _pendingFlush) {
+        bool nested = false;
+        for (auto p = n->_parent; p && !nested; p = p->_parent) nested = p->_flushPending;
+        if (nested) continue;
+        // Bring the parent chain up to date first, since it is shared by all threads.
+        if (n->_parent) n->_parent->updateWorldTransform();
+        subtrees.push_back(n);
+    }
+
+    // A handful of big subtrees (like the whole scene under one moving root) won't spread well across threads. So
+    // split the subtrees level by level, updating the split points on the calling thread, until there are enough
+    // jobs to keep all threads busy.
+    auto & pool   = ThreadPool::shared();
+    size_t target = (pool.threadCount() + 1) * 4;
+    for (int level = 0; level < 4 && subtrees.size() < target; ++level) {
+        std::vector<Node *> next;
+        next.reserve(subtrees.size() * 2);
+        for (auto n : subtrees) {
+            if (!n->_firstChild) {
+                next.push_back(n);
+                continue;
+            }
+            if (n->_worldTransformDirty) n->recalculateWorldTransform();
+            for (auto c : n->children()) next.push_back(c);
+        }
+        subtrees.swap(next);
+    }
+
+    // Update the subtrees concurrently. Nodes in different subtrees never overlap, and their ancestors are all up to
+    // date by now. So no synchronization is needed.
+    std::atomic<size_t> updated {0};
+    pool.parallelFor(subtrees.size(), 1, [&](size_t begin, size_t end) {
+        size_t              count = 0;
+        std::vector<Node *> stack;
+        for (size_t i = begin; i < end; ++i) {
+            stack.push_back(subtrees[i]);
+            while (!stack.empty()) {
+                auto n = stack.back();
+                stack.pop_back();
+                if (n->_worldTransformDirty) {
+                    n->recalculateWorldTransform();
+                    ++count;
+                }
+                for (auto c = n->_firstChild; c; c = c->_nextSibling) stack.push_back(c);
+            }
+        }
+        updated += count;
+    });
+    _flushStats.updated = updated;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+void Graph::flushDirtyTransforms() {
+    _flushStats = {};
+
+    // Bring all world transforms up to date in batch, before flushing them to the scene. The update is timed on its
+    // own, so the modes can be compared on large graphs, without the cost of the flush.
+    auto updateStart = std::chrono::high_resolution_clock::now();
+    if (TransformUpdateMode::FLAT == _transformUpdateMode)
+        updateFlatWorldTransforms();
+    else if (TransformUpdateMode::PARALLEL == _transformUpdateMode)
+        updateWorldTransformsInParallel();
+    _flushStats.updateNs = (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - updateStart).count();
+
+    if (_pendingFlush.empty()) return;
+
+    // Bump the flush counter, so we can tell which nodes are already flushed in this round. This is to avoid flushing
+    // the same node multiple times, when both the node and one of its ancestors are in the pending list.
+    ++_flushCounter;
+
+    for (auto root : _pendingFlush) {
+        PH_ASSERT(root->_flushPending);
+        root->_flushPending = false;
+        ++_flushStats.subtrees;
+        root->bfsTraverseNodeGraph([&](Node * n) {
+            if (n->_lastFlush == _flushCounter) return Node::TraverseAction::SKIP_SUBTREE;
+            n->_lastFlush = _flushCounter;
+            n->flushWorldTransform();
+            ++_flushStats.nodes;
+            _flushStats.entities += n->modelCount() + n->lightCount();
+            return Node::TraverseAction::CONTINUE;
+        });
+    }
+    _pendingFlush.clear();
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 //
 void Graph::refreshSceneGpuData(VkCommandBuffer cb) {
-    for (auto n : _nodes) n->flushWorldTransform();
+    flushDirtyTransforms();
     scene().refreshGpuData(cb);
 }
 
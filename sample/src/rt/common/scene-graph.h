@@ -5,7 +5,7 @@
 #pragma once
 #include <ph/rt-scene.h>
 #include <ostream>
-#include <list>
+#include <memory>
 #include <queue>
 
 // namespace of scene graph
@@ -284,10 +284,40 @@ public:
 // };
 
 class Graph;
+class NodePool;
 
 /// Node implementation class.
 class Node {
 public:
+    /// Forward range of child nodes. Children are linked through intrusive sibling pointers, in the order they are
+    /// added to the parent.
+    class ChildRange {
+    public:
+        class Iterator {
+        public:
+            Iterator(Node * n): _n(n) {}
+            Node *     operator*() const { return _n; }
+            Iterator & operator++() {
+                _n = _n->_nextSibling;
+                return *this;
+            }
+            bool operator==(const Iterator & rhs) const { return _n == rhs._n; }
+            bool operator!=(const Iterator & rhs) const { return _n != rhs._n; }
+
+        private:
+            Node * _n;
+        };
+
+        ChildRange(const Node & parent): _parent(parent) {}
+        Iterator begin() const { return {_parent._firstChild}; }
+        Iterator end() const { return {nullptr}; }
+        bool     empty() const { return !_parent._firstChild; }
+        size_t   size() const { return _parent._childCount; }
+
+    private:
+        const Node & _parent;
+    };
+
     std::string name; ///< name of the node. For debugging and logging purpose only. Can be set to any value.
 
     auto graph() const -> const Graph & { return _graph; }
@@ -297,8 +327,7 @@ public:
     auto parent() const -> const Node * { return _parent; }
     auto parent() -> Node * { return _parent; }
     void setParent(Node *);
-    auto children() const -> const std::list<Node *> & { return _children; }
-    auto children() -> const std::list<Node *> & { return _children; }
+    auto children() const -> ChildRange { return {*this}; }
 
     void detachAllComponents();
 
@@ -330,7 +359,17 @@ public:
         return _local2World;
     }
     void setWorldTransform(const Transform & worldToParent);
+
+    /// Version of the world transform. A new, larger value is assigned each time the world transform of the node is
+    /// invalidated, either by changing the transform of the node itself, or the transform of any of its ancestors.
+    auto worldTransformVersion() const -> uint64_t { return _worldVersion; }
+
+    /// The largest world transform version of all nodes in the subtree rooted at this node. If it is unchanged since
+    /// the last time world transforms of the subtree were read, none of them has changed since then.
+    auto subtreeVersion() const -> uint64_t { return _subtreeVersion; }
+
     void flushWorldTransform() { // flush the world transform matrix to scene entity.
+        if (_models.empty() && _lights.empty()) return;
         auto &                     s = scene();
         Eigen::Matrix<float, 3, 4> t = worldTransform();
         for (auto m : _models) s.setTransform(m.second, t);
@@ -371,9 +410,12 @@ private:
     friend class Graph;
 
     Graph &                                           _graph;
-    std::list<Node *>::iterator                       _iter; // where the node is in the graph.
-    Node *                                            _parent = nullptr;
-    std::list<Node *>                                 _children;
+    Node *                                            _parent      = nullptr;
+    Node *                                            _firstChild  = nullptr;
+    Node *                                            _lastChild   = nullptr;
+    Node *                                            _prevSibling = nullptr;
+    Node *                                            _nextSibling = nullptr;
+    size_t                                            _childCount  = 0;
     std::vector<std::pair<ph::rt::Model *, uint64_t>> _models;
     std::vector<std::pair<ph::rt::Light *, uint64_t>> _lights;
 
@@ -383,6 +425,19 @@ private:
     // Used to record if the world transform needs to be updated.
     mutable bool _worldTransformDirty = true;
 
+    // Version of the world transform, and the largest version in the subtree. See worldTransformVersion().
+    uint64_t _worldVersion   = 0;
+    uint64_t _subtreeVersion = 0;
+
+    // Set to true when this node is in the graph's pending flush list.
+    bool _flushPending = false;
+
+    // Value of the graph's flush counter when this node's transform is last flushed to the scene.
+    uint64_t _lastFlush = 0;
+
+    // Index of the node in the graph's flat hierarchy. Only valid when the graph is in FLAT mode.
+    size_t _flatIndex = 0;
+
     // The current local->parent transform of the node.
     Transform _local2Parent = Transform::Identity();
 
@@ -391,9 +446,18 @@ private:
 
     ~Node();
 
-    // Marks this and all descendants as needing to update
+    // Append this node to the end of the parent's child list. O(1).
+    void linkToParent();
+
+    // Remove this node from the parent's child list. O(1).
+    void unlinkFromParent();
+
+    // Marks this and all descendants as needing to update. Also queues the subtree for the next flush to the scene.
     void setWorldTransformDirty();
 
+    // Assigns the version to this node, and raises the subtree version of all ancestors to it. O(depth).
+    void propagateVersion(uint64_t version);
+
     // Updates the world transforms of this node and any dirty parents.
     void updateWorldTransform() const;
 
@@ -410,6 +474,31 @@ private:
 
 class Graph {
 public:
+    /// Statistics of the last call to refreshSceneGpuData()
+    struct FlushStats {
+        size_t   subtrees = 0; ///< number of dirty subtrees that are flushed.
+        size_t   nodes    = 0; ///< number of nodes visited during the flush.
+        size_t   entities = 0; ///< number of scene entities (models and lights) that received new transform.
+        size_t   updated  = 0; ///< number of world transforms recalculated by the batched update (FLAT and PARALLEL modes only).
+        uint64_t updateNs = 0; ///< CPU time of the batched update in nanoseconds, including the rebuild of the flat array.
+    };
+
+    /// Defines how the graph updates world transform of the nodes.
+    enum class TransformUpdateMode {
+        /// World transform of each node is lazily updated by walking up its parent chain. This is the default mode.
+        HIERARCHICAL,
+
+        /// Nodes are mirrored into a topologically sorted array with parent indices and contiguous local/world
+        /// transform arrays. World transforms of all dirty nodes are updated in one linear pass before flushing to the
+        /// scene. Works best for large graphs where lots of nodes are updated every frame.
+        FLAT,
+
+        /// Dirty subtrees are partitioned and their world transforms are updated concurrently on the shared thread
+        /// pool, before flushing to the scene on the calling thread. Works best for scenes with lots of independently
+        /// animated subtrees, like crowds of skinned characters.
+        PARALLEL,
+    };
+
     Graph(ph::rt::Scene & scene);
     ~Graph();
 
@@ -420,11 +509,90 @@ public:
     auto createNode(Node * parent = nullptr) -> Node *;
     void deleteNodeAndSubtree(Node *& node);
     void refreshSceneGpuData(VkCommandBuffer); // update the scene with the latest transformation matrices.
+    auto flushStats() const -> const FlushStats & { return _flushStats; }
+
+    /// Changed each time nodes are created, deleted or re-parented, or models are attached to or detached from nodes.
+    /// No two graphs share the same version.
+    auto topologyVersion() const -> uint64_t { return _topologyVersion; }
+    auto transformUpdateMode() const -> TransformUpdateMode { return _transformUpdateMode; }
+    void setTransformUpdateMode(TransformUpdateMode);
 
 private:
-    ph::rt::Scene &   _scene;
-    Node              _root {*this, nullptr};
-    std::list<Node *> _nodes;
+    friend class Node;
+
+    /// SoA mirror of the node hierarchy, used by FLAT transform update mode.
+    struct FlatHierarchy {
+        std::vector<Node *>                                         nodes;   // in BFS order. So parent is always in front of its children.
+        std::vector<size_t>                                         parents; // index of parent node. SIZE_MAX for root node.
+        std::vector<Transform, Eigen::aligned_allocator<Transform>> local;   // local->parent transforms
+        std::vector<Transform, Eigen::aligned_allocator<Transform>> world;   // local->world transforms
+        std::vector<uint8_t>                                        dirty;   // set to 1 if local transform is changed.
+        size_t                                                      firstDirty    = SIZE_MAX; // index of the first dirty node. SIZE_MAX if none.
+        bool                                                        topologyDirty = true;
+
+        void clear() {
+            nodes.clear();
+            parents.clear();
+            local.clear();
+            world.clear();
+            dirty.clear();
+            firstDirty    = SIZE_MAX;
+            topologyDirty = true;
+        }
+    };
+
+    ph::rt::Scene &           _scene;
+    std::unique_ptr<NodePool> _pool; // storage of all nodes, except the root node.
+    Node                      _root {*this, nullptr};
+    size_t                    _nodeCount = 0;       // number of nodes, not counting the root node.
+    std::vector<Node *>       _pendingFlush;        // root of subtrees that need to flush their transforms to the scene.
+    uint64_t                  _flushCounter = 0;
+    uint64_t                  _transformVersion = 0; // the last world transform version assigned to any node.
+    uint64_t                  _topologyVersion  = nextTopologyVersion(); // see topologyVersion().
+    FlushStats                _flushStats;
+    TransformUpdateMode       _transformUpdateMode = TransformUpdateMode::HIERARCHICAL;
+    FlatHierarchy             _flat;
+
+    // Add the node to the pending flush list. Its whole subtree will be flushed in next refreshSceneGpuData() call.
+    void markSubtreeForFlush(Node * n) {
+        if (n->_flushPending) return;
+        n->_flushPending = true;
+        _pendingFlush.push_back(n);
+    }
+
+    // Flush world transform of all dirty subtrees to the scene.
+    void flushDirtyTransforms();
+
+    // Called when local transform of the node is changed.
+    void onLocalTransformChanged(Node * n) {
+        if (TransformUpdateMode::FLAT != _transformUpdateMode || _flat.topologyDirty) return;
+        PH_ASSERT(_flat.nodes[n->_flatIndex] == n);
+        _flat.local[n->_flatIndex] = n->_local2Parent;
+        _flat.dirty[n->_flatIndex] = 1;
+        _flat.firstDirty           = std::min(_flat.firstDirty, n->_flatIndex);
+    }
+
+    // Called when nodes are added, removed or re-parented.
+    void onTopologyChanged() {
+        _flat.topologyDirty = true;
+        onModelsChanged();
+    }
+
+    // Called when models are attached to or detached from nodes.
+    void onModelsChanged() { _topologyVersion = nextTopologyVersion(); }
+
+    // Topology versions are unique across all graphs, so a graph created at the address of a deleted one is never
+    // mistaken for it.
+    static uint64_t nextTopologyVersion();
+
+    // Rebuild the flat hierarchy from the node tree.
+    void rebuildFlatHierarchy();
+
+    // Recalculate world transform of all dirty nodes in the flat hierarchy.
+    void updateFlatWorldTransforms();
+
+    // Recalculate world transform of all pending subtrees on the thread pool.
+    void updateWorldTransformsInParallel();
 };
 
 inline ph::rt::Scene & Node::scene() const { return _graph.scene(); }
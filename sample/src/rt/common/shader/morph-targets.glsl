@@ -72,6 +72,59 @@ struct Vertex {
 static_assert(0 == (sizeof(Vertex) % 16));
 #endif
 
+// ---------------------------------------------------------------------------------------------------------------------
+// Vertex attributes that are modified by morph targets.
+struct MorphVertex {
+    vec3  position;
+    float positionPadding;
+    vec3  normal;
+    float normalPadding;
+    vec3  tangent;
+    float tangentPadding;
+};
+
+#ifdef __cplusplus
+static_assert(48 == sizeof(MorphVertex));
+#endif
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Morph target deltas of a mesh are stored as a stream of 32-bit words, sorted by vertex. Vertices that a target doesn't
+// displace have no delta at all for that target. Each delta starts with a header word:
+//
+//  - bits [0, 16): index of the target, which is also the index of its weight.
+//  - bits 16, 17, 18: set if the delta displaces position, normal and tangent. Attributes that are not displaced are
+//    omitted from the stream.
+//
+// Displaced attributes follow the header in the order of position, normal, tangent. Each is encoded in one of these
+// formats, selected per mesh:
+//
+//  - MORPH_DELTA_FLOAT16: 2 words, packHalf2x16(x, y) and packHalf2x16(z, 0).
+//  - MORPH_DELTA_SNORM10: 1 word, x, y, z as 10-bit signed normalized integers at bits [0, 10), [10, 20) and
+//    [20, 30), multiplied by the per-target scale of the attribute.
+#define MORPH_DELTA_FLOAT16     0
+#define MORPH_DELTA_SNORM10     1
+#define MORPH_DELTA_TARGET_MASK 0xFFFFu
+#define MORPH_DELTA_POSITION    (1u << 16)
+#define MORPH_DELTA_NORMAL      (1u << 17)
+#define MORPH_DELTA_TANGENT     (1u << 18)
+
+// Dequantization scale of MORPH_DELTA_SNORM10 deltas of one target: the largest absolute component of position (x),
+// normal (y) and tangent (z) deltas of the target. Not used by MORPH_DELTA_FLOAT16.
+struct MorphDeltaScale {
+    vec3  scale;
+    float padding;
+};
+
+#ifdef __cplusplus
+static_assert(16 == sizeof(MorphDeltaScale));
+#endif
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Push constants of the morph target shader.
+struct MorphConstants {
+    uint format; // MORPH_DELTA_FLOAT16 or MORPH_DELTA_SNORM10
+};
+
 #ifdef __cplusplus
 } // namespace jedi::rt::device
 #endif
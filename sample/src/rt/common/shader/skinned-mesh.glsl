@@ -48,6 +48,26 @@ struct WeightedJoint {
 static_assert(0 == (sizeof(WeightedJoint) % 16));
 #endif
 
+// ---------------------------------------------------------------------------------------------------------------------
+// Rigid transform of a joint, used by dual quaternion skinning. It is the joint matrix times the inverse bind matrix,
+// with scaling dropped. Quaternions are stored as (x, y, z, w).
+struct DualQuaternion {
+    vec4 real; // rotation
+    vec4 dual; // 0.5 * translation * rotation
+};
+#ifdef __cplusplus
+static_assert(32 == sizeof(DualQuaternion));
+#endif
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Push constants of the batched skinning shader. Vertices of all skinned submeshes are packed into shared buffers, and
+// each dispatch skins vertices in range [vertexBase, vertexBase + vertexCount). Joint indices in the weighted joint
+// buffer are already offset to the joint palette of the submesh that the vertex belongs to.
+struct BatchedSkinningConstants {
+    uint vertexBase;
+    uint vertexCount;
+};
+
 #ifdef __cplusplus
 } // namespace skinning
 #endif
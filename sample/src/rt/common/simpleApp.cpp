@@ -285,6 +285,7 @@ bool SimpleApp::render() {
                 _cpuFrameTimes.begin("record");
                 _gpuTimestamps->refresh(rp.cb); // refresh timestamp value once per frame.
                 finalLayout = _scene->record(rp);
+                frameRecorded(rp, finalLayout);
                 _cpuFrameTimes.end();
                 _cpuFrameTimes.frame();
             } else {
@@ -194,6 +194,10 @@ protected:
     /// The signal fired after the scene is fully loaded.
     ph::sigslot::signal<> sceneLoaded;
 
+    /// The signal fired after the scene has recorded its commands of the frame, and before the frame is submitted. The
+    /// 2nd parameter is the current layout of the back buffer.
+    ph::sigslot::signal<const ph::va::SimpleRenderLoop::RecordParameters &, VkImageLayout> frameRecorded;
+
 #if PH_ANDROID
     void handleAndroidSimpleTouchEvent(bool down, float x, float y) { _ui->handleAndroidSimpleTouchEvent(down, x, y); }
 #endif
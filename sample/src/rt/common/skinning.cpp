@@ -4,6 +4,7 @@
 
 #include "pch.h"
 #include "skinning.h"
+#include "thread-pool.h"
 
 #include <cmrc/cmrc.hpp>
 CMRC_DECLARE(sampleasset);
@@ -27,10 +28,10 @@ static AutoHandle<VkShaderModule> createShader(const VulkanGlobalInfo & vgi, con
 // ---------------------------------------------------------------------------------------------------------------------
 // Constructor / Destructor
 
-SkinnedMeshManager::SkinnedMeshManager(const VulkanGlobalInfo & vgi) {
+SkinnedMeshManager::SkinnedMeshManager(const VulkanGlobalInfo & vgi, bool batched): _stagingRing(vgi) {
     // Load the skinning compute shader from embedded resources
     PH_ASSERT(_shaderModule.empty());
-    loadSkinningShader(vgi);
+    _shaderModule = loadSkinningShader(vgi, "skinned-mesh");
     // If shader module is still empty then setup failed
     if (_shaderModule.empty()) return;
 
@@ -39,6 +40,25 @@ SkinnedMeshManager::SkinnedMeshManager(const VulkanGlobalInfo & vgi) {
     for (size_t i = 0; i < 5; ++i) cp.bindings[i] = {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1};
     cp.pushConstantsSize = 0; // This compute shader has no push constants
     _compute             = new SimpleCompute(cp);
+
+    // Load the batched skinning shader. Fall back to per-submesh skinning if it is not available.
+    if (batched) {
+        _batchedShaderModule = loadSkinningShader(vgi, "skinned-mesh-batched");
+        if (!_batchedShaderModule.empty()) {
+            cp.cs                = _batchedShaderModule;
+            cp.pushConstantsSize = sizeof(BatchedSkinningConstants);
+            _batchedCompute      = new SimpleCompute(cp);
+            _batched             = true;
+        }
+    }
+
+    // Load the dual quaternion skinning shader. Meshes fall back to linear blend skinning if it is not available.
+    _dqShaderModule = loadSkinningShader(vgi, "skinned-mesh-dq");
+    if (!_dqShaderModule.empty()) {
+        cp.cs                = _dqShaderModule;
+        cp.pushConstantsSize = sizeof(BatchedSkinningConstants);
+        _dqCompute           = new SimpleCompute(cp);
+    }
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -53,35 +73,127 @@ static bool validateJointWeight(float weight, size_t joint, size_t maxJoints) {
     return true;
 }
 
-void SkinnedMeshManager::cleanup() { safeDelete(_compute); }
-
-// TODO: This function needs to be updated when the buffers are converted from StagedBufferObject and
-// DynamicBufferObject to simple BufferObjects.
-bool SkinnedMeshManager::allocateBuffers(ph::va::VulkanSubmissionProxy & vsp, const skinning::SkinningData & skinData, SkinningBuffer & skinBuffer) {
-    const auto & vgi = vsp.vgi();
-
-    // Allocate input/output vertex buffers
-    std::vector<Vertex> vertexData;
+/// Convert vertices of the submesh to the layout used by the skinning shader, and append them to the vertex array.
+static void appendVertices(const SkinningData & skinData, std::vector<Vertex> & vertexData) {
     for (size_t i = 0; i < skinData.origPositions.size(); i += 3) {
         Vertex v   = {};
         v.position = vec3(skinData.origPositions[i], skinData.origPositions[i + 1], skinData.origPositions[i + 2]);
         v.normal   = vec3(skinData.origNormals[i], skinData.origNormals[i + 1], skinData.origNormals[i + 2]);
         vertexData.emplace_back(v);
     }
-    ConstRange<Vertex> vData(vertexData);
-    skinBuffer.inputVertexBuffer.allocate(vgi, vData);
-    skinBuffer.outputVertexBuffer.allocate(vgi, vData);
+}
 
-    // Allocate weights buffer
+/// Convert joints and weights of the submesh to the layout used by the skinning shader, and append them to the weight
+/// array. jointOffset is added to all joint indices.
+static bool appendWeightedJoints(const SkinningData & skinData, uint32_t jointOffset, std::vector<WeightedJoint> & weightData) {
     PH_ASSERT(skinData.weights.size() == skinData.joints.size());
-    std::vector<WeightedJoint> weightData;
     for (size_t i = 0; i < skinData.weights.size(); i += 4) {
         WeightedJoint wj = {};
         wj.weights       = vec4(skinData.weights[i], skinData.weights[i + 1], skinData.weights[i + 2], skinData.weights[i + 3]);
         wj.joints        = uvec4(skinData.joints[i], skinData.joints[i + 1], skinData.joints[i + 2], skinData.joints[i + 3]);
         if (!validateJointWeight(wj.weights.x(), wj.joints.x(), skinData.jointMatrices.size())) return false;
+        wj.joints += uvec4::Constant(jointOffset);
         weightData.emplace_back(wj);
     }
+    return true;
+}
+
+/// Linear blend skinning of vertices in range [begin, end) of the submesh. Same math as skinned-mesh.comp, including
+/// transforming normals with the translation part of the skinning matrix, so both backends give the same result. Each
+/// palette entry is the top 3 rows of joint matrix times inverse bind matrix. There are no hand written intrinsics: the
+/// weighted sum of the 3x4 matrices is a fixed size Eigen expression, which is left to Eigen and the compiler to
+/// vectorize for the target instruction set.
+template<typename PALETTE>
+static void skinVertices(const SkinningData & skinData, const PALETTE & palette, size_t begin, size_t end, Vertex * output) {
+    const size_t jointCount = palette.size();
+    for (size_t v = begin; v < end; ++v) {
+        Eigen::Matrix<float, 3, 4> m = Eigen::Matrix<float, 3, 4>::Zero();
+        for (size_t k = 0; k < 4; ++k) {
+            float    w = skinData.weights[v * 4 + k];
+            uint32_t j = skinData.joints[v * 4 + k];
+            // Out of range joints are only validated for the first weight. Skip the rest, instead of reading out of bound.
+            if (0.0f != w && j < jointCount) m += w * palette[j];
+        }
+        Eigen::Map<const Eigen::Vector3f> p(&skinData.origPositions[v * 3]);
+        Eigen::Map<const Eigen::Vector3f> n(&skinData.origNormals[v * 3]);
+        auto &                            out = output[v];
+        out.position                          = m.leftCols<3>() * p + m.col(3);
+        out.normal                            = m.leftCols<3>() * n + m.col(3);
+    }
+}
+
+/// Convert the rigid part of a skinning matrix to a dual quaternion. Scaling is dropped.
+static DualQuaternion toDualQuaternion(const Eigen::Matrix4f & m) {
+    Eigen::Affine3f    a(m);
+    Eigen::Quaternionf r(a.rotation());
+    r.normalize();
+    Eigen::Vector3f    t = a.translation();
+    Eigen::Quaternionf d = Eigen::Quaternionf(0.0f, t.x(), t.y(), t.z()) * r;
+    DualQuaternion     dq;
+    dq.real = r.coeffs();
+    dq.dual = 0.5f * d.coeffs();
+    return dq;
+}
+
+/// Dual quaternion skinning of vertices in range [begin, end) of the submesh. Same math as skinned-mesh-dq.comp.
+static void skinVerticesDQ(const SkinningData & skinData, const std::vector<DualQuaternion> & palette, size_t begin, size_t end, Vertex * output) {
+    const uint32_t jointCount = (uint32_t) palette.size();
+    for (size_t v = begin; v < end; ++v) {
+        Eigen::Vector4f real  = Eigen::Vector4f::Zero();
+        Eigen::Vector4f dual  = Eigen::Vector4f::Zero();
+        const vec4 *    pivot = nullptr;
+        for (size_t k = 0; k < 4; ++k) {
+            float    w = skinData.weights[v * 4 + k];
+            uint32_t j = skinData.joints[v * 4 + k];
+            if (0.0f == w || j >= jointCount) continue;
+            const auto & dq = palette[j];
+            if (!pivot) pivot = &dq.real;
+            if (pivot->dot(dq.real) < 0.0f) w = -w;
+            real += w * dq.real;
+            dual += w * dq.dual;
+        }
+        auto &          out      = output[v];
+        Eigen::Vector3f position = Eigen::Map<const Eigen::Vector3f>(&skinData.origPositions[v * 3]);
+        Eigen::Vector3f normal   = Eigen::Map<const Eigen::Vector3f>(&skinData.origNormals[v * 3]);
+        float           len      = real.norm();
+        if (len < 1e-6f) {
+            // No valid joint, or joints that cancel each other out. Leave the vertex where it is. Same threshold as
+            // MIN_BLEND_LENGTH in skinned-mesh-dq.comp.
+            out.position = position;
+            out.normal   = normal;
+            continue;
+        }
+        real /= len;
+        dual /= len;
+
+        Eigen::Vector3f    translation = 2.0f * (real.w() * dual.head<3>() - dual.w() * real.head<3>() + real.head<3>().cross(dual.head<3>()));
+        Eigen::Quaternionf rotation(real);
+        out.position = rotation * position + translation;
+        out.normal   = rotation * normal;
+    }
+}
+
+void SkinnedMeshManager::cleanup() {
+    safeDelete(_compute);
+    safeDelete(_batchedCompute);
+    safeDelete(_dqCompute);
+}
+
+// TODO: This function needs to be updated when the buffers are converted from StagedBufferObject and
+// DynamicBufferObject to simple BufferObjects.
+bool SkinnedMeshManager::allocateBuffers(ph::va::VulkanSubmissionProxy & vsp, const skinning::SkinningData & skinData, SkinningBuffer & skinBuffer) {
+    const auto & vgi = vsp.vgi();
+
+    // Allocate input/output vertex buffers
+    std::vector<Vertex> vertexData;
+    appendVertices(skinData, vertexData);
+    ConstRange<Vertex> vData(vertexData);
+    skinBuffer.inputVertexBuffer.allocate(vgi, vData);
+    skinBuffer.outputVertexBuffer.allocate(vgi, vData);
+
+    // Allocate weights buffer
+    std::vector<WeightedJoint> weightData;
+    if (!appendWeightedJoints(skinData, 0, weightData)) return false;
     skinBuffer.weightsBuffer.allocate(vgi, weightData);
 
     // Ensure that joint matrices and inverse bind matrices are valid
@@ -97,6 +209,7 @@ bool SkinnedMeshManager::allocateBuffers(ph::va::VulkanSubmissionProxy & vsp, co
     std::vector<mat4> joints;
     for (size_t i = 0; i < skinData.jointMatrices.size(); i++) { joints.emplace_back(skinData.jointMatrices[i]->worldTransform().matrix4f()); }
     skinBuffer.jointsBuffer.allocate(vgi, joints.size());
+    skinBuffer.dualQuaternionsBuffer.allocate(vgi, joints.size());
 
     // Sync the buffers to the gpu
     ph::va::SingleUseCommandPool pool(vsp);
@@ -106,12 +219,241 @@ bool SkinnedMeshManager::allocateBuffers(ph::va::VulkanSubmissionProxy & vsp, co
         skinBuffer.weightsBuffer.sync2gpu(cb);
         skinBuffer.invBindMatricesBuffer.sync2gpu(cb);
         skinBuffer.jointsBuffer.sync2gpu(cb);
+        skinBuffer.dualQuaternionsBuffer.sync2gpu(cb);
     });
 
     // done
     return true;
 }
 
+bool SkinnedMeshManager::allocateBatchedBuffers(ph::va::VulkanSubmissionProxy & vsp) {
+    const auto & vgi = vsp.vgi();
+
+    // Pack all submeshes into shared arrays. Joint indices of each submesh are offset to its own range of the joint
+    // palette, so the shader needs no per-instance lookup.
+    std::vector<Vertex>        vertexData;
+    std::vector<WeightedJoint> weightData;
+    std::vector<mat4>          invBindMatrices;
+    _instances.clear();
+    _meshToInstances.clear();
+    for (auto & [mesh, submeshes] : _skinnedMeshes) {
+        size_t first = _instances.size();
+        for (size_t i = 0; i < submeshes.size(); i++) {
+            auto & skinData = submeshes[i];
+            if (skinData.inverseBindMatrices.size() != skinData.jointMatrices.size()) {
+                PH_LOGE("incorrect inverse bind matrix array size.");
+                return false;
+            }
+
+            SkinningInstance inst = {};
+            inst.mesh             = mesh;
+            inst.skinData         = &skinData;
+            inst.vertexOffset     = (uint32_t) vertexData.size();
+            inst.jointOffset      = (uint32_t) invBindMatrices.size();
+            inst.jointCount       = (uint32_t) skinData.jointMatrices.size();
+            appendVertices(skinData, vertexData);
+            if (!appendWeightedJoints(skinData, inst.jointOffset, weightData)) return false;
+            if (weightData.size() != vertexData.size()) {
+                PH_LOGE("submesh %zu of mesh %s has %zu vertices, but %zu weights.", i, mesh->name.c_str(), vertexData.size() - inst.vertexOffset,
+                        weightData.size() - inst.vertexOffset);
+                return false;
+            }
+            invBindMatrices.insert(invBindMatrices.end(), skinData.inverseBindMatrices.begin(), skinData.inverseBindMatrices.end());
+            inst.vertexCount = (uint32_t) vertexData.size() - inst.vertexOffset;
+            _instances.push_back(inst);
+        }
+        _meshToInstances[mesh] = {first, _instances.size()};
+    }
+    if (vertexData.empty() || invBindMatrices.empty()) return false;
+
+    // Allocate the shared buffers.
+    ConstRange<Vertex> vData(vertexData);
+    _batchedBuffer.inputVertexBuffer.allocate(vgi, vData);
+    _batchedBuffer.outputVertexBuffer.allocate(vgi, vData);
+    _batchedBuffer.weightsBuffer.allocate(vgi, weightData);
+    _batchedBuffer.invBindMatricesBuffer.allocate(vgi, invBindMatrices);
+    _batchedBuffer.jointsBuffer.allocate(vgi, invBindMatrices.size());
+    _batchedBuffer.dualQuaternionsBuffer.allocate(vgi, invBindMatrices.size());
+
+    // Sync the buffers to the gpu
+    ph::va::SingleUseCommandPool pool(vsp);
+    pool.syncExec([&](auto cb) {
+        _batchedBuffer.inputVertexBuffer.sync2gpu(cb);
+        _batchedBuffer.outputVertexBuffer.sync2gpu(cb);
+        _batchedBuffer.weightsBuffer.sync2gpu(cb);
+        _batchedBuffer.invBindMatricesBuffer.sync2gpu(cb);
+        _batchedBuffer.jointsBuffer.sync2gpu(cb);
+        _batchedBuffer.dualQuaternionsBuffer.sync2gpu(cb);
+    });
+
+    PH_LOGI("Batched skinning: %zu submeshes, %zu vertices, %zu joints.", _instances.size(), vertexData.size(), invBindMatrices.size());
+    return true;
+}
+
+void SkinnedMeshManager::applyBatchedGPUSkinning(DeferredHostOperation & dho, VkCommandBuffer cb) {
+    va::beginVkDebugLabel(cb, "batched skinning");
+
+    // Merge instances of dirty meshes into contiguous runs. Instances are grouped by mesh in the same order as
+    // _skinnedMeshes, so instances of adjacent dirty meshes are adjacent too. Meshes in a run share the same skinning mode.
+    _dirtyRuns.clear();
+    for (auto mesh : _dirtyMeshes) {
+        auto range = _meshToInstances[mesh];
+        if (range.first == range.second) continue;
+        if (!_dirtyRuns.empty() && _dirtyRuns.back().second == range.first &&
+            useDualQuaternions(_instances[_dirtyRuns.back().first].mesh) == useDualQuaternions(mesh))
+            _dirtyRuns.back().second = range.second;
+        else
+            _dirtyRuns.push_back(range);
+    }
+
+    // Upload joint palettes, one upload per run. Dual quaternion palettes have the inverse bind matrices baked in.
+    for (const auto & [begin, end] : _dirtyRuns) {
+        uint32_t jointBegin = _instances[begin].jointOffset;
+        uint32_t jointEnd   = _instances[end - 1].jointOffset + _instances[end - 1].jointCount;
+        if (useDualQuaternions(_instances[begin].mesh)) {
+            _dqPalette.resize(jointEnd - jointBegin);
+            for (size_t i = begin; i < end; ++i) {
+                const auto & inst = _instances[i];
+                const auto & skin = *inst.skinData;
+                for (uint32_t j = 0; j < inst.jointCount; ++j) {
+                    Eigen::Matrix4f m = Eigen::Affine3f(skin.jointMatrices[j]->worldTransform()).matrix() * skin.inverseBindMatrices[j];
+                    _dqPalette[inst.jointOffset - jointBegin + j] = toDualQuaternion(m);
+                }
+            }
+            _stagingRing.cmdUploadToGpu(dho, cb, _batchedBuffer.dualQuaternionsBuffer.g.buffer, jointBegin * sizeof(DualQuaternion), _dqPalette);
+            continue;
+        }
+        _jointPalette.resize(jointEnd - jointBegin);
+        for (size_t i = begin; i < end; ++i) {
+            const auto & inst = _instances[i];
+            for (uint32_t j = 0; j < inst.jointCount; ++j) {
+                _jointPalette[inst.jointOffset - jointBegin + j] = Eigen::Affine3f(inst.skinData->jointMatrices[j]->worldTransform()).matrix();
+            }
+        }
+        _stagingRing.cmdUploadToGpu(dho, cb, _batchedBuffer.jointsBuffer.g.buffer, jointBegin * sizeof(mat4), _jointPalette);
+    }
+
+    // Make sure the uploads are done before the shader reads the joint matrices.
+    VkMemoryBarrier uploadBarrier = {.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                     .pNext         = nullptr,
+                                     .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                                     .dstAccessMask = VK_ACCESS_SHADER_READ_BIT};
+    vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &uploadBarrier, 0, nullptr, 0, nullptr);
+
+    // Skin each run with one dispatch. All dispatches share the same buffers.
+    for (const auto & [begin, end] : _dirtyRuns) {
+        BatchedSkinningConstants pc = {};
+        pc.vertexBase               = _instances[begin].vertexOffset;
+        pc.vertexCount              = _instances[end - 1].vertexOffset + _instances[end - 1].vertexCount - pc.vertexBase;
+
+        bool dq        = useDualQuaternions(_instances[begin].mesh);
+        auto dp        = SimpleCompute::DispatchParameters {dho, cb};
+        dp.bindings[0] = std::vector<VkDescriptorBufferInfo> {getDescriptor(_batchedBuffer.inputVertexBuffer.g)};
+        dp.bindings[1] = std::vector<VkDescriptorBufferInfo> {getDescriptor(_batchedBuffer.outputVertexBuffer.g)};
+        dp.bindings[2] = std::vector<VkDescriptorBufferInfo> {getDescriptor(_batchedBuffer.weightsBuffer.g)};
+        dp.bindings[3] = std::vector<VkDescriptorBufferInfo> {getDescriptor(_batchedBuffer.invBindMatricesBuffer.g)};
+        dp.bindings[4] = std::vector<VkDescriptorBufferInfo> {getDescriptor(dq ? _batchedBuffer.dualQuaternionsBuffer.g : _batchedBuffer.jointsBuffer.g)};
+        dp.width       = pc.vertexCount;
+        dp.setPushConstants(pc);
+        (dq ? _dqCompute : _batchedCompute)->dispatch(dp);
+    }
+
+    // One barrier to ensure all output is complete before it is used elsewhere
+    VkBuffer        outputBuffer = _batchedBuffer.outputVertexBuffer.g.buffer;
+    VkMemoryBarrier mBarrier     = {.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                .pNext         = nullptr,
+                                .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+                                .dstAccessMask = VK_ACCESS_SHADER_READ_BIT};
+    vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &mBarrier, 0, nullptr, 0, nullptr);
+
+    // Call mesh.morph() to add the meshes to the queue of modified meshes that need to be processed
+    for (const auto & [begin, end] : _dirtyRuns) {
+        for (size_t i = begin; i < end; ++i) {
+            const auto & inst   = _instances[i];
+            uint64_t     offset = (uint64_t) inst.vertexOffset * sizeof(Vertex);
+            auto         vi     = Mesh::VertexInput {
+                .position = Mesh::VertexElement(outputBuffer, offset + offsetof(Vertex, position), sizeof(Vertex)),
+                .normal   = Mesh::VertexElement(outputBuffer, offset + offsetof(Vertex, normal), sizeof(Vertex)),
+            };
+            inst.mesh->morph(vi, inst.skinData->submeshOffset, inst.skinData->submeshSize);
+        }
+    }
+
+    va::endVkDebugLabel(cb);
+}
+
+void SkinnedMeshManager::applyCPUSkinning(DeferredHostOperation & dho, VkCommandBuffer cb) {
+    va::beginVkDebugLabel(cb, "cpu skinning");
+
+    struct Output {
+        ph::rt::Mesh *       mesh;
+        const SkinningData * skinData;
+        VkBuffer             buffer;
+        uint64_t             offset;
+    };
+    std::vector<Output> outputs;
+
+    auto & pool = ThreadPool::shared();
+    for (auto mesh : _cpuDirtyMeshes) {
+        auto & submeshes = _skinnedMeshes[mesh];
+        for (size_t i = 0; i < submeshes.size(); i++) {
+            const auto & skinData    = submeshes[i];
+            const size_t vertexCount = skinData.origPositions.size() / 3;
+            if (0 == vertexCount || skinData.weights.size() < vertexCount * 4 || skinData.origNormals.size() < vertexCount * 3) continue;
+
+            // Skinned vertices go to the same place as the output of the compute shader.
+            Output o = {mesh, &skinData, VK_NULL_HANDLE, 0};
+            if (_batched) {
+                const auto & inst = _instances[_meshToInstances[mesh].first + i];
+                o.buffer          = _batchedBuffer.outputVertexBuffer.g.buffer;
+                o.offset          = (uint64_t) inst.vertexOffset * sizeof(Vertex);
+            } else {
+                o.buffer = _skinningBuffers[mesh][i].outputVertexBuffer.g.buffer;
+            }
+
+            // Build the skinning palette of the submesh.
+            const bool dq = useDualQuaternions(mesh);
+            _skinPalette.resize(dq ? 0 : skinData.jointMatrices.size());
+            _dqPalette.resize(dq ? skinData.jointMatrices.size() : 0);
+            for (size_t j = 0; j < skinData.jointMatrices.size(); ++j) {
+                Eigen::Matrix4f m = Eigen::Affine3f(skinData.jointMatrices[j]->worldTransform()).matrix() * skinData.inverseBindMatrices[j];
+                if (dq)
+                    _dqPalette[j] = toDualQuaternion(m);
+                else
+                    _skinPalette[j] = m.topRows<3>();
+            }
+
+            // Skin the vertices on all threads, then copy them to the ring. Vertex padding is left uninitialized.
+            _cpuVertices.resize(vertexCount);
+            pool.parallelFor(vertexCount, 4096, [&](size_t begin, size_t end) {
+                if (dq)
+                    skinVerticesDQ(skinData, _dqPalette, begin, end, _cpuVertices.data());
+                else
+                    skinVertices(skinData, _skinPalette, begin, end, _cpuVertices.data());
+            });
+            _stagingRing.cmdUploadToGpu(dho, cb, o.buffer, o.offset, _cpuVertices);
+            outputs.push_back(o);
+        }
+    }
+
+    // Make sure the uploads are done before the vertices are read by the BLAS builder.
+    VkMemoryBarrier mBarrier = {.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                .pNext         = nullptr,
+                                .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                                .dstAccessMask = VK_ACCESS_SHADER_READ_BIT};
+    vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &mBarrier, 0, nullptr, 0, nullptr);
+
+    for (const auto & o : outputs) {
+        auto vi = Mesh::VertexInput {
+            .position = Mesh::VertexElement(o.buffer, o.offset + offsetof(Vertex, position), sizeof(Vertex)),
+            .normal   = Mesh::VertexElement(o.buffer, o.offset + offsetof(Vertex, normal), sizeof(Vertex)),
+        };
+        o.mesh->morph(vi, o.skinData->submeshOffset, o.skinData->submeshSize);
+    }
+
+    va::endVkDebugLabel(cb);
+}
+
 void SkinnedMeshManager::applyGPUSkinning(ph::rt::Mesh * meshPtr, DeferredHostOperation & dho, VkCommandBuffer cb) {
     va::beginVkDebugLabel(cb, meshPtr->name.c_str());
     auto & submeshes      = _skinnedMeshes[meshPtr];
@@ -119,7 +461,8 @@ void SkinnedMeshManager::applyGPUSkinning(ph::rt::Mesh * meshPtr, DeferredHostOp
     for (size_t i = 0; i < submeshes.size(); i++) {
         // Update the data in joint matrix buffer associated with this submesh
         auto & skinBuffer = submeshBuffers[i];
-        updateJointMatrixBuffer(dho, cb, submeshes[i], skinBuffer);
+        bool   dq         = useDualQuaternions(meshPtr);
+        updateJointMatrixBuffer(dho, cb, submeshes[i], skinBuffer, dq);
 
         // Set up a the dispatch parameters for this submesh and dispatch the compute
         auto dp        = SimpleCompute::DispatchParameters {dho, cb};
@@ -127,9 +470,17 @@ void SkinnedMeshManager::applyGPUSkinning(ph::rt::Mesh * meshPtr, DeferredHostOp
         dp.bindings[1] = std::vector<VkDescriptorBufferInfo> {getDescriptor(skinBuffer.outputVertexBuffer.g)};
         dp.bindings[2] = std::vector<VkDescriptorBufferInfo> {getDescriptor(skinBuffer.weightsBuffer.g)};
         dp.bindings[3] = std::vector<VkDescriptorBufferInfo> {getDescriptor(skinBuffer.invBindMatricesBuffer.g)};
-        dp.bindings[4] = std::vector<VkDescriptorBufferInfo> {getDescriptor(skinBuffer.jointsBuffer.g)};
+        dp.bindings[4] = std::vector<VkDescriptorBufferInfo> {getDescriptor(dq ? skinBuffer.dualQuaternionsBuffer.g : skinBuffer.jointsBuffer.g)};
         dp.width       = skinBuffer.inputVertexBuffer.size();
-        _compute->dispatch(dp);
+        if (dq) {
+            // The dual quaternion shader is shared with batched skinning. The whole submesh is one batch.
+            BatchedSkinningConstants pc = {};
+            pc.vertexCount              = (uint32_t) dp.width;
+            dp.setPushConstants(pc);
+            _dqCompute->dispatch(dp);
+        } else {
+            _compute->dispatch(dp);
+        }
 
         // Setup memory barrier to ensure the output is complete before it is used elsewhere
         VkBuffer        outputBuffer = skinBuffer.outputVertexBuffer.g.buffer;
@@ -150,14 +501,20 @@ void SkinnedMeshManager::applyGPUSkinning(ph::rt::Mesh * meshPtr, DeferredHostOp
 }
 
 bool SkinnedMeshManager::checkForSkeletonChanges(SkinningData & skinnedMesh) {
-    bool result = false;
-    for (size_t i = 0; i < skinnedMesh.jointMatrices.size(); i++) {
-        const auto & nt   = skinnedMesh.jointMatrices[i]->worldTransform();
-        const auto & prev = skinnedMesh.prevJointMatrices[i];
-        if (!result && nt != prev) result = true;
-        skinnedMesh.prevJointMatrices[i] = nt;
-    }
-    return result;
+    // Any change to a joint, or to one of its ancestors, gives the skeleton root a new subtree version. This relies on
+    // the caller reading the world transforms of all joints when a change is reported, which is what skinning does.
+    if (!skinnedMesh.skeletonRoot) return false;
+    uint64_t version = skinnedMesh.skeletonRoot->subtreeVersion();
+    if (version == skinnedMesh.skeletonVersion) return false;
+    skinnedMesh.skeletonVersion = version;
+    return true;
+}
+
+void SkinnedMeshManager::invalidateSkinning(ph::rt::Mesh * mesh) {
+    // Skin the mesh again on next record(), even if its skeleton doesn't change.
+    auto iter = _skinnedMeshes.find(mesh);
+    if (iter == _skinnedMeshes.end()) return;
+    for (auto & skinnedMesh : iter->second) skinnedMesh.skeletonVersion = UINT64_MAX;
 }
 
 va::SimpleCompute::ConstructParameters SkinnedMeshManager::createComputeCP(const VulkanGlobalInfo & vgi) {
@@ -185,22 +542,41 @@ VkDescriptorBufferInfo SkinnedMeshManager::getDescriptor(const BufferObject & bu
     return info;
 }
 
-void SkinnedMeshManager::initPrevSkinMatrices() {
+/// @return The lowest common ancestor of all joints. Null if there's no joint.
+static const sg::Node * findSkeletonRoot(const std::vector<sg::Node *> & joints) {
+    if (joints.empty()) return nullptr;
+
+    // Path from the first joint up to the graph root. The skeleton root is always on it.
+    std::vector<const sg::Node *> path;
+    for (const sg::Node * n = joints[0]; n; n = n->parent()) path.push_back(n);
+
+    size_t root = 0;
+    for (const sg::Node * j : joints) {
+        for (const sg::Node * n = j; n; n = n->parent()) {
+            auto iter = std::find(path.begin() + root, path.end(), n);
+            if (iter != path.end()) {
+                root = iter - path.begin();
+                break;
+            }
+        }
+    }
+    return path[root];
+}
+
+void SkinnedMeshManager::initSkeletonVersions() {
     for (auto & [mesh, submeshes] : _skinnedMeshes) {
         for (auto & skinnedMesh : submeshes) {
-            for (size_t i = 0; i < skinnedMesh.jointMatrices.size(); i++) {
-                sg::Transform nt = skinnedMesh.jointMatrices[i]->worldTransform();
-                sg::Transform ntCopy(nt);
-                skinnedMesh.prevJointMatrices.emplace_back(ntCopy);
-            }
+            skinnedMesh.skeletonRoot = findSkeletonRoot(skinnedMesh.jointMatrices);
+            // Not a valid version, so the first check always reports a change.
+            skinnedMesh.skeletonVersion = UINT64_MAX;
         }
     }
 }
 
-void SkinnedMeshManager::loadSkinningShader(const VulkanGlobalInfo & vgi) {
-    auto blob = loadEmbeddedResource("shader/skinned-mesh.comp.spirv", false);
-    if (blob.empty()) return;
-    _shaderModule = createShader(vgi, blob, "skinned-mesh.spirv");
+AutoHandle<VkShaderModule> SkinnedMeshManager::loadSkinningShader(const VulkanGlobalInfo & vgi, const char * name) {
+    auto blob = loadEmbeddedResource(formatstr("shader/%s.comp.spirv", name), false);
+    if (blob.empty()) return {};
+    return createShader(vgi, blob, formatstr("%s.spirv", name).c_str());
 }
 
 std::vector<uint8_t> SkinnedMeshManager::loadEmbeddedResource(const std::string & name, bool quiet) {
@@ -214,7 +590,18 @@ std::vector<uint8_t> SkinnedMeshManager::loadEmbeddedResource(const std::string
     return std::vector<uint8_t>((const uint8_t *) file.begin(), (const uint8_t *) file.end());
 }
 
-void SkinnedMeshManager::updateJointMatrixBuffer(DeferredHostOperation & dho, VkCommandBuffer cb, SkinningData & skinData, SkinningBuffer & skinBuffer) {
+void SkinnedMeshManager::updateJointMatrixBuffer(DeferredHostOperation & dho, VkCommandBuffer cb, SkinningData & skinData, SkinningBuffer & skinBuffer,
+                                                 bool dualQuaternions) {
+    if (dualQuaternions) {
+        _dqPalette.resize(skinData.jointMatrices.size());
+        for (size_t i = 0; i < _dqPalette.size(); ++i) {
+            Eigen::Matrix4f m = Eigen::Affine3f(skinData.jointMatrices[i]->worldTransform()).matrix() * skinData.inverseBindMatrices[i];
+            _dqPalette[i]     = toDualQuaternion(m);
+        }
+        _stagingRing.cmdUploadToGpu(dho, cb, skinBuffer.dualQuaternionsBuffer.g.buffer, 0, _dqPalette);
+        return;
+    }
+
     static std::vector<mat4> jointMatrices;
     jointMatrices.resize(skinData.jointMatrices.size());
     for (size_t i = 0; i < jointMatrices.size(); ++i) {
@@ -222,7 +609,7 @@ void SkinnedMeshManager::updateJointMatrixBuffer(DeferredHostOperation & dho, Vk
         auto & n = skinData.jointMatrices[i];
         m        = Eigen::Affine3f(n->worldTransform()).matrix();
     }
-    dho.cmdUploadToGpu(cb, skinBuffer.jointsBuffer.g.buffer, 0, jointMatrices);
+    _stagingRing.cmdUploadToGpu(dho, cb, skinBuffer.jointsBuffer.g.buffer, 0, jointMatrices);
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -234,8 +621,14 @@ void SkinnedMeshManager::initializeSkinning(VulkanSubmissionProxy & vsp) {
         return;
     }
 
-    // TODO: uncomment this line if joints checking is reenabled in update
-    initPrevSkinMatrices();
+    initSkeletonVersions();
+
+    // Pack all skinned meshes into shared buffers for batched skinning.
+    if (_batched) {
+        if (allocateBatchedBuffers(vsp)) return;
+        PH_LOGW("Failed to allocate batched skinning buffers. Fall back to per-submesh skinning.");
+        _batched = false;
+    }
 
     // Allocate required GPU buffers for all the loaded skinned meshes
     for (const auto & kv : _skinnedMeshes) {
@@ -253,20 +646,62 @@ void SkinnedMeshManager::initializeSkinning(VulkanSubmissionProxy & vsp) {
     }
 }
 
-void SkinnedMeshManager::record(DeferredHostOperation & dho, VkCommandBuffer cb) {
-    if (!_compute) return;
+void SkinnedMeshManager::setBackend(SkinningBackend backend) {
+    _defaultBackend = backend;
+    _meshBackends.clear();
+    for (auto & kv : _skinnedMeshes) invalidateSkinning(kv.first);
+}
 
-    // NOTE: Skinning seems to run significantly faster WITHOUT the checks for whether the transforms have
-    // changed. This does mean that skinning costs are still incurred even if the model hasn't been changed
-    // BUT the difference seems to be ~20-40 fps with the dragonfly.gltf model, so, until the transform
-    // checks can be optimized, this seems like the preferable solution. I left the alternative commented out
-    // so that we can revisit it in the near future.
+void SkinnedMeshManager::setBackend(ph::rt::Mesh * mesh, SkinningBackend backend) {
+    if (backend == _defaultBackend)
+        _meshBackends.erase(mesh);
+    else
+        _meshBackends[mesh] = backend;
+    invalidateSkinning(mesh);
+}
+
+void SkinnedMeshManager::setMode(SkinningMode mode) {
+    _defaultMode = mode;
+    _meshModes.clear();
+    for (auto & kv : _skinnedMeshes) invalidateSkinning(kv.first);
+}
+
+void SkinnedMeshManager::setMode(ph::rt::Mesh * mesh, SkinningMode mode) {
+    if (mode == _defaultMode)
+        _meshModes.erase(mesh);
+    else
+        _meshModes[mesh] = mode;
+    invalidateSkinning(mesh);
+}
+
+void SkinnedMeshManager::record(DeferredHostOperation & dho, VkCommandBuffer cb) {
+    // Collect meshes whose skeletons have changed. Skeleton change detection is one integer compare per submesh, so
+    // static characters cost nothing here.
+    _dirtyMeshes.clear();
+    _cpuDirtyMeshes.clear();
     for (auto & [mesh, skinnedMeshes] : _skinnedMeshes) {
-        for (auto & skinnedMesh : skinnedMeshes) {
-            if (checkForSkeletonChanges(skinnedMesh)) {
-                applyGPUSkinning(mesh, dho, cb);
-                break;
-            }
+        // Check all submeshes, so that their versions are all up to date once the mesh is skinned.
+        bool changed = false;
+        for (auto & skinnedMesh : skinnedMeshes) changed |= checkForSkeletonChanges(skinnedMesh);
+        if (!changed) continue;
+        if (SkinningBackend::CPU == backend(mesh))
+            _cpuDirtyMeshes.push_back(mesh);
+        else
+            _dirtyMeshes.push_back(mesh);
+    }
+
+    if (!_cpuDirtyMeshes.empty()) applyCPUSkinning(dho, cb);
+
+    // GPU skinning needs the compute shader, which might have failed to load. CPU skinning doesn't.
+    if (_compute) {
+        if (_batched) {
+            // Skin all dirty meshes at once.
+            if (!_dirtyMeshes.empty()) applyBatchedGPUSkinning(dho, cb);
+        } else {
+            for (auto mesh : _dirtyMeshes) applyGPUSkinning(mesh, dho, cb);
         }
     }
+
+    // Staging space used by this frame can be reclaimed once GPU is done with it.
+    _stagingRing.endFrame(dho);
 }
@@ -10,6 +10,7 @@
 #include <exception>
 
 #include "sbb.h"
+#include "staging-ring.h"
 #include "shader/skinned-mesh.glsl"
 
 namespace skinning {
@@ -17,9 +18,12 @@ namespace skinning {
 struct SkinningData {
     // Indexed by joint id
     std::vector<sg::Node *>      jointMatrices;
-    std::vector<sg::Transform>   prevJointMatrices;
     std::vector<Eigen::Matrix4f> inverseBindMatrices;
 
+    // Lowest common ancestor of all joints, and its subtree version when the joints were last read.
+    const sg::Node * skeletonRoot    = nullptr;
+    uint64_t         skeletonVersion = 0;
+
     // Per-vertex data
     std::vector<uint32_t> joints;
     std::vector<float>    weights;
@@ -31,19 +35,45 @@ struct SkinningData {
     size_t submeshSize;
 };
 
+// GPU buffers of the skinning shaders. There's one per submesh for per-submesh skinning, and a single one shared by
+// all skinned submeshes for batched skinning.
 struct SkinningBuffer {
-    ph::va::StagedBufferObject<VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, Vertex>        inputVertexBuffer;
-    ph::va::StagedBufferObject<VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, Vertex>        outputVertexBuffer;
-    ph::va::StagedBufferObject<VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, WeightedJoint> weightsBuffer;
-    ph::va::StagedBufferObject<VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, mat4>          invBindMatricesBuffer;
-    ph::va::StagedBufferObject<VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, mat4>          jointsBuffer;
+    ph::va::StagedBufferObject<VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, Vertex>         inputVertexBuffer;
+    ph::va::StagedBufferObject<VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, Vertex>         outputVertexBuffer;
+    ph::va::StagedBufferObject<VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, WeightedJoint>  weightsBuffer;
+    ph::va::StagedBufferObject<VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, mat4>           invBindMatricesBuffer;
+    ph::va::StagedBufferObject<VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, mat4>           jointsBuffer;
+    ph::va::StagedBufferObject<VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, DualQuaternion> dualQuaternionsBuffer; // joint palette of dual quaternion skinning
+};
+
+// Location of one skinned submesh in the batched skinning buffers.
+struct SkinningInstance {
+    ph::rt::Mesh * mesh;
+    SkinningData * skinData;
+    uint32_t       vertexOffset; // index of the first vertex in the vertex and weight buffers
+    uint32_t       vertexCount;
+    uint32_t       jointOffset; // index of the first joint in the joint and inverse bind matrix buffers
+    uint32_t       jointCount;
 };
 
 // Per-mesh skinning data (CPU)
 typedef std::map<ph::rt::Mesh * const, std::vector<SkinningData>> SkinMap;
 
+// Where vertices of a skinned mesh are transformed.
+enum class SkinningBackend {
+    GPU, // compute shader
+    CPU, // worker threads, then the result is uploaded to GPU
+};
+
+// How vertices are blended between joints.
+enum class SkinningMode {
+    LINEAR,          // linear blend skinning: weighted sum of joint matrices.
+    DUAL_QUATERNION, // weighted sum of joint dual quaternions. Preserves volume around twisted joints, but ignores joint scaling.
+};
+
 struct SkinnedMeshManager {
-    SkinnedMeshManager(const ph::va::VulkanGlobalInfo & vgi);
+    /// @param batched If true, skin all submeshes with a few dispatches on shared buffers, instead of one dispatch per submesh.
+    SkinnedMeshManager(const ph::va::VulkanGlobalInfo & vgi, bool batched = true);
 
     ~SkinnedMeshManager() { cleanup(); }
 
@@ -53,17 +83,56 @@ struct SkinnedMeshManager {
 
     void record(ph::va::DeferredHostOperation & dho, VkCommandBuffer cb);
 
+    /// Statistics of per-frame joint matrix uploads.
+    const StagingRing::Stats & uploadStats() const { return _stagingRing.stats(); }
+
+    /// Select the skinning backend of all meshes, including the ones loaded later. Overrides per-mesh selections.
+    void setBackend(SkinningBackend backend);
+
+    /// Select the skinning backend of one mesh.
+    void setBackend(ph::rt::Mesh * mesh, SkinningBackend backend);
+
+    SkinningBackend backend(ph::rt::Mesh * mesh) const {
+        auto iter = _meshBackends.find(mesh);
+        return iter != _meshBackends.end() ? iter->second : _defaultBackend;
+    }
+
+    /// Select the skinning mode of all meshes, including the ones loaded later. Overrides per-mesh selections.
+    void setMode(SkinningMode mode);
+
+    /// Select the skinning mode of one mesh.
+    void setMode(ph::rt::Mesh * mesh, SkinningMode mode);
+
+    SkinningMode mode(ph::rt::Mesh * mesh) const {
+        auto iter = _meshModes.find(mesh);
+        return iter != _meshModes.end() ? iter->second : _defaultMode;
+    }
+
 private:
     void cleanup();
 
     bool allocateBuffers(ph::va::VulkanSubmissionProxy & vsp, const SkinningData & skinData, SkinningBuffer & skinBuffer);
 
+    bool allocateBatchedBuffers(ph::va::VulkanSubmissionProxy & vsp);
+
     void applySkinning(ph::va::DeferredHostOperation & dho, VkCommandBuffer cb);
 
     void applyGPUSkinning(ph::rt::Mesh * meshPtr, ph::va::DeferredHostOperation & dho, VkCommandBuffer cb);
 
+    void applyBatchedGPUSkinning(ph::va::DeferredHostOperation & dho, VkCommandBuffer cb);
+
+    void applyCPUSkinning(ph::va::DeferredHostOperation & dho, VkCommandBuffer cb);
+
     bool checkForSkeletonChanges(SkinningData & skinnedMesh);
 
+    void invalidateSkinning(ph::rt::Mesh * mesh);
+
+    /// @return True if the mesh is skinned with dual quaternions. Falls back to linear blend skinning on GPU, if the
+    /// dual quaternion shader is not available.
+    bool useDualQuaternions(ph::rt::Mesh * mesh) const {
+        return SkinningMode::DUAL_QUATERNION == mode(mesh) && (_dqCompute || SkinningBackend::CPU == backend(mesh));
+    }
+
     ph::va::SimpleCompute::ConstructParameters createComputeCP(const ph::va::VulkanGlobalInfo & vgi);
 
     VkDescriptorBufferInfo getDescriptor(ph::va::BufferObject & bufferObj);
@@ -72,13 +141,14 @@ private:
 
     void initGPUSkinning();
 
-    void initPrevSkinMatrices();
+    void initSkeletonVersions();
 
-    void loadSkinningShader(const ph::va::VulkanGlobalInfo &);
+    ph::va::AutoHandle<VkShaderModule> loadSkinningShader(const ph::va::VulkanGlobalInfo &, const char * name);
 
     std::vector<uint8_t> loadEmbeddedResource(const std::string & name, bool quiet);
 
-    void updateJointMatrixBuffer(ph::va::DeferredHostOperation & dho, VkCommandBuffer cb, SkinningData & skinData, SkinningBuffer & skinBuffer);
+    void updateJointMatrixBuffer(ph::va::DeferredHostOperation & dho, VkCommandBuffer cb, SkinningData & skinData, SkinningBuffer & skinBuffer,
+                                 bool dualQuaternions);
 
 private:
     // Per-mesh buffers for GPU skinning
@@ -88,6 +158,33 @@ private:
     SkinMap                            _skinnedMeshes;
     BufferMap                          _skinningBuffers;
     ph::va::SimpleCompute *            _compute = nullptr;
+    StagingRing                        _stagingRing; ///< staging space of per-frame joint matrix uploads.
+
+    // Batched skinning states
+    bool                                                      _batched = false;
+    ph::va::AutoHandle<VkShaderModule>                        _batchedShaderModule;
+    ph::va::SimpleCompute *                                   _batchedCompute = nullptr;
+    SkinningBuffer                                            _batchedBuffer;
+    std::vector<SkinningInstance>                             _instances;       ///< all skinned submeshes, grouped by mesh.
+    std::map<ph::rt::Mesh * const, std::pair<size_t, size_t>> _meshToInstances; ///< range of instances of each mesh.
+    std::vector<ph::rt::Mesh *>                               _dirtyMeshes;     ///< meshes to skin in current frame.
+    std::vector<std::pair<size_t, size_t>>                    _dirtyRuns;       ///< ranges of instances to skin in current frame.
+    std::vector<mat4>                                         _jointPalette;    ///< scratch buffer of joint matrix uploads.
+
+    // CPU skinning states
+    using SkinPalette = std::vector<Eigen::Matrix<float, 3, 4>, Eigen::aligned_allocator<Eigen::Matrix<float, 3, 4>>>;
+    SkinningBackend                                 _defaultBackend = SkinningBackend::GPU;
+    std::map<const ph::rt::Mesh *, SkinningBackend> _meshBackends;   ///< meshes that don't use the default backend.
+    std::vector<ph::rt::Mesh *>                     _cpuDirtyMeshes; ///< meshes to skin on CPU in current frame.
+    SkinPalette                                     _skinPalette;    ///< joint matrix times inverse bind matrix, of one submesh.
+    std::vector<Vertex>                             _cpuVertices;    ///< scratch buffer of skinned vertices of one submesh.
+
+    // Dual quaternion skinning states
+    ph::va::AutoHandle<VkShaderModule>           _dqShaderModule;
+    ph::va::SimpleCompute *                      _dqCompute   = nullptr;
+    SkinningMode                                 _defaultMode = SkinningMode::LINEAR;
+    std::map<const ph::rt::Mesh *, SkinningMode> _meshModes; ///< meshes that don't use the default mode.
+    std::vector<DualQuaternion>                  _dqPalette; ///< scratch buffer of dual quaternion palette uploads.
 };
 
 } // namespace skinning
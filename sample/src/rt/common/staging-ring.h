@@ -0,0 +1,141 @@
+/*****************************************************************************
+ * Copyright (C) 2020 - 2024 OPPO. All rights reserved.
+ *******************************************************************************/
+
+#pragma once
+
+#include <ph/va.h>
+
+#include <memory>
+
+/// A persistently mapped ring buffer to stage per-frame uploads from CPU to GPU.
+///
+/// This is a replacement of DeferredHostOperation::cmdUploadToGpu() for data that is uploaded every frame. Instead of
+/// creating a new scratch buffer for each upload, space is sub-allocated from one persistent buffer. Space allocated in
+/// a frame is reclaimed once GPU is done with that frame, via DeferredHostOperation::deferUntilGPUWorkIsDone(). Requests
+/// that don't fit into the ring fall back to DeferredHostOperation::cmdUploadToGpu().
+///
+/// Typical usage:
+///
+///     for (each upload of the frame) ring.cmdUploadToGpu(dho, cb, buffer, offset, data, size);
+///     ring.endFrame(dho);
+class StagingRing {
+public:
+    struct Stats {
+        uint64_t uploads       = 0; ///< number of uploads served by the ring.
+        uint64_t bytesUploaded = 0; ///< total bytes uploaded through the ring.
+        uint64_t wraps         = 0; ///< number of times allocation wrapped around to the beginning of the ring.
+        uint64_t fallbacks     = 0; ///< number of uploads that are oversized, or happened when the ring is full.
+    };
+
+    /// @param capacity Size of the ring in bytes. It should be large enough to hold uploads of all in-flight frames.
+    StagingRing(const ph::va::VulkanGlobalInfo & vgi, size_t capacity = 4 * 1024 * 1024): _ring(std::make_shared<Ring>(vgi, capacity)) {}
+
+    PH_NO_COPY(StagingRing);
+    PH_DEFAULT_MOVE(StagingRing);
+
+    /// Record command to upload data from CPU to GPU. The data is copied to the ring immediately.
+    void cmdUploadToGpu(ph::va::DeferredHostOperation & dho, VkCommandBuffer cb, VkBuffer dstBuffer, size_t dstOffset, const void * data, size_t dataSize) {
+        if (0 == data || 0 == dataSize) return;
+
+        auto & r      = *_ring;
+        size_t offset = r.allocate(dataSize);
+        if (offset == INVALID_OFFSET) {
+            ++r.stats.fallbacks;
+            dho.cmdUploadToGpu(cb, dstBuffer, dstOffset, data, dataSize);
+            return;
+        }
+
+        memcpy(r.mapped->range.data() + offset, data, dataSize);
+        auto region      = VkBufferCopy {};
+        region.srcOffset = offset;
+        region.dstOffset = dstOffset;
+        region.size      = dataSize;
+        vkCmdCopyBuffer(cb, r.buffer.buffer, dstBuffer, 1, &region);
+
+        ++r.stats.uploads;
+        r.stats.bytesUploaded += dataSize;
+    }
+
+    /// Upload data from CPU to GPU. Note that dstOffset is in unit of byte.
+    template<typename T>
+    void cmdUploadToGpu(ph::va::DeferredHostOperation & dho, VkCommandBuffer cb, VkBuffer dstBuffer, size_t dstOffset, const std::vector<T> & source) {
+        cmdUploadToGpu(dho, cb, dstBuffer, dstOffset, source.data(), source.size() * sizeof(T));
+    }
+
+    /// Mark the end of the current frame. Space allocated since last call is reclaimed after GPU is done with the frame.
+    void endFrame(ph::va::DeferredHostOperation & dho) {
+        auto & r = *_ring;
+        if (0 == r.frameBytes) return;
+        size_t bytes = r.frameBytes;
+        size_t end   = r.head;
+        r.frameBytes = 0;
+        // The job holds a reference to the ring, so the buffer stays alive until GPU is done with it.
+        dho.deferUntilGPUWorkIsDone([ring = _ring, bytes, end]() {
+            PH_ASSERT(ring->used >= bytes);
+            ring->used -= bytes;
+            ring->tail = end;
+        });
+    }
+
+    const Stats & stats() const { return _ring->stats; }
+
+    size_t capacity() const { return _ring->buffer.size; }
+
+private:
+    static constexpr size_t INVALID_OFFSET = size_t(~0);
+
+    /// vkCmdCopyBuffer() has no alignment requirement on source offset. 16 is to keep memcpy() fast.
+    static constexpr size_t ALIGNMENT = 16;
+
+    using Mapped = ph::va::BufferObject::MappedResult<uint8_t>;
+
+    struct Ring {
+        ph::va::BufferObject    buffer;
+        std::unique_ptr<Mapped> mapped;
+        size_t                  head       = 0; ///< where next allocation starts.
+        size_t                  tail       = 0; ///< start of the oldest allocation still in use by GPU.
+        size_t                  used       = 0; ///< bytes in use, including padding skipped by wrapping.
+        size_t                  frameBytes = 0; ///< bytes allocated in current frame.
+        Stats                   stats;
+
+        Ring(const ph::va::VulkanGlobalInfo & vgi, size_t capacity): buffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, ph::va::DeviceMemoryUsage::CPU_ONLY) {
+            buffer.allocate(vgi, ph::nextMultiple(capacity, ALIGNMENT), "staging ring");
+            mapped.reset(new Mapped(buffer.map<uint8_t>()));
+        }
+
+        ~Ring() {
+            // unmap before the buffer is released.
+            mapped.reset();
+        }
+
+        size_t allocate(size_t size) {
+            const size_t capacity = buffer.size;
+            size                  = ph::nextMultiple(size, ALIGNMENT);
+            if (size > capacity / 2) return INVALID_OFFSET;
+            if (0 == used) head = tail = 0;
+
+            size_t offset = head;
+            size_t skip   = 0;
+            if (head >= tail && used < capacity) {
+                // free space is [head, capacity) + [0, tail)
+                if (head + size > capacity) {
+                    if (size > tail) return INVALID_OFFSET;
+                    skip   = capacity - head;
+                    offset = 0;
+                    ++stats.wraps;
+                }
+            } else {
+                // free space is [head, tail)
+                if (head + size > tail) return INVALID_OFFSET;
+            }
+
+            head = offset + size;
+            used += skip + size;
+            frameBytes += skip + size;
+            return offset;
+        }
+    };
+
+    std::shared_ptr<Ring> _ring;
+};
@@ -4,6 +4,7 @@
 
 #include "pch.h"
 #include "texture-cache.h"
+#include "thread-pool.h"
 
 // Image returned when image does not exist.
 static const ph::RawImage EMPTY_IMAGE;
@@ -12,6 +13,12 @@ TextureCache::TextureCache(ph::va::VulkanSubmissionProxy * vsp, ph::AssetSystem
                            uint32_t defaultShadowMapSize)
     : _vsp(vsp), _assetSystem(assetSystem), _defaultShadowMapFormat(defaultShadowMapFormat), _defaultShadowMapSize(defaultShadowMapSize) {}
 
+TextureCache::~TextureCache() {
+    // Background jobs use the asset system. Make sure they are done before it goes away.
+    for (auto & p : _pending) p.second.image.wait();
+    retireUploads(true);
+}
+
 ph::rt::Material::TextureHandle TextureCache::loadFromAsset(const std::string & assetPath, VkImageUsageFlagBits usage) {
     // If no resource was selected.
     if (assetPath.empty()) {
@@ -24,8 +31,31 @@ ph::rt::Material::TextureHandle TextureCache::loadFromAsset(const std::string &
 
     // If this asset is already loaded.
     if (iterator != _textureHandles.end()) {
-        // Return the entry for it.
-        return ph::rt::Material::TextureHandle(iterator->second);
+        // Return the entry for it, with all levels resident.
+        completeStreaming(iterator->second.image);
+        ph::rt::Material::TextureHandle handle(iterator->second);
+        retain(handle);
+        return handle;
+    }
+
+    // If the asset is being loaded asynchronously, finish the load right here.
+    auto pending = _pending.find(assetPath);
+    if (pending != _pending.end()) {
+        pending->second.usage |= usage;
+        std::vector<std::pair<std::string, PendingTexture>> decoded;
+        decoded.emplace_back(pending->first, std::move(pending->second));
+        _pending.erase(pending);
+        std::vector<LevelCopy>  copies;
+        std::list<ph::RawImage> pixels;
+        prepare(decoded, false, copies, pixels);
+        submit(copies);
+        handOver(decoded);
+        iterator = _textureHandles.find(assetPath);
+        if (iterator == _textureHandles.end()) return {};
+        ph::rt::Material::TextureHandle handle(iterator->second);
+        retain(handle);
+        trim();
+        return handle;
     }
 
     // Load the image bytes from the asset system.
@@ -44,17 +74,449 @@ ph::rt::Material::TextureHandle TextureCache::loadFromAsset(const std::string &
     // Save image to the handle mapping.
     ph::va::ImageObject & imageObject = _textureHandles[assetPath];
     imageObject.createFromImageProxy(assetPath.c_str(), *_vsp, usage, ph::va::DeviceMemoryUsage::GPU_ONLY, asset.content.i.proxy());
+    auto handle = track(assetPath, imageObject);
+    retain(handle);
+    trim();
 
     // done
-    return ph::rt::Material::TextureHandle(imageObject);
+    return handle;
+}
+
+ph::rt::Material::TextureHandle TextureCache::loadFromAssetAsync(const std::string & assetPath, TextureReady onReady, VkImageUsageFlagBits usage) {
+    if (assetPath.empty()) return {};
+
+    // Already resident.
+    auto iterator = _textureHandles.find(assetPath);
+    if (iterator != _textureHandles.end()) {
+        // The returned handle holds one reference, whether or not there is a callback to receive it as well.
+        auto handle = _residency[iterator->second.image].handle;
+        retain(handle);
+        if (onReady) {
+            onReady(handle);
+            // Call again as larger levels become resident.
+            auto s = _streaming.find(handle.image);
+            if (s != _streaming.end()) s->second.callbacks.push_back(std::move(onReady));
+        }
+        return handle;
+    }
+
+    // Join the load in flight, or start a new one. Only the decoded image is kept. The asset itself is released on
+    // the worker thread.
+    auto & pending = _pending[assetPath];
+    if (!pending.image.valid()) {
+        pending.image = ThreadPool::shared().async([assetSystem = _assetSystem, assetPath]() {
+            ph::Asset asset = assetSystem->load(assetPath.c_str()).get();
+            return std::move(asset.content.i);
+        });
+    }
+    pending.usage |= usage;
+    if (onReady) pending.callbacks.push_back(std::move(onReady));
+
+    // Placeholder
+    return {};
+}
+
+void TextureCache::cancelCallbacks() {
+    for (auto & p : _pending) p.second.callbacks.clear();
+    for (auto & s : _streaming) s.second.callbacks.clear();
+}
+
+size_t TextureCache::update() {
+    retireUploads(false);
+
+    // Refine textures that are already streaming, by one mip level each, until the upload budget runs out. At least
+    // one level is uploaded per frame, no matter how large it is.
+    std::vector<LevelCopy> copies;
+    std::vector<VkImage>   refined;
+    size_t                 bytes = 0;
+    for (auto & [image, s] : _streaming) {
+        uint32_t level = s.firstLevel - 1;
+        size_t   size  = levelBytes(s.pixels, level);
+        if (bytes > 0 && bytes + size > _uploadBudget) continue;
+        bytes += size;
+        copies.push_back({s.object, &s.pixels, level, s.firstLevel, false});
+        refined.push_back(image);
+    }
+    for (auto image : refined) {
+        auto & s = _streaming[image];
+        --s.firstLevel;
+        refreshView(s);
+    }
+
+    std::vector<std::pair<std::string, PendingTexture>> decoded;
+    for (auto iterator = _pending.begin(); iterator != _pending.end();) {
+        if (std::future_status::ready == iterator->second.image.wait_for(std::chrono::seconds(0))) {
+            decoded.emplace_back(iterator->first, std::move(iterator->second));
+            iterator = _pending.erase(iterator);
+        } else {
+            ++iterator;
+        }
+    }
+    std::list<ph::RawImage> pixels;
+    prepare(decoded, true, copies, pixels);
+    submit(copies);
+
+    for (auto image : refined) handOver(image);
+    handOver(decoded);
+    trim();
+    return decoded.size();
+}
+
+void TextureCache::setUploadBudget(size_t bytes) {
+    _uploadBudget = bytes;
+    // Without a budget, textures are not streamed. Finish the ones in flight.
+    if (0 == _uploadBudget) {
+        while (!_streaming.empty()) completeStreaming(_streaming.begin()->first);
+    }
+}
+
+void TextureCache::prepare(std::vector<std::pair<std::string, PendingTexture>> & decoded, bool stream, std::vector<LevelCopy> & copies,
+                           std::list<ph::RawImage> & pixels) {
+    const auto & vgi = _vsp->vgi();
+    for (auto & d : decoded) {
+        const auto & path = d.first;
+        ph::RawImage image;
+        try {
+            image = d.second.image.get();
+        } catch (std::exception & e) {
+            PH_LOGE("Failed to load image file %s: %s", path.c_str(), e.what());
+            continue;
+        }
+        if (image.empty()) {
+            PH_LOGE("Failed to load image file %s", path.c_str());
+            continue;
+        }
+
+        // The path might have been loaded synchronously by createFromImageProxy() in the meantime.
+        if (_textureHandles.count(path)) continue;
+
+        // Only 2D textures and cube maps in formats that GPU can sample directly are uploaded in batch. Everything
+        // else goes through createFromImageProxy(), which knows how to convert them.
+        const auto & desc   = image.desc();
+        auto         format = ph::va::colorFormat2VK(image.format());
+        bool         cube   = 6 == desc.layers && image.width() == image.height();
+        bool         direct = VK_FORMAT_UNDEFINED != format && 1 == image.depth() && (1 == desc.layers || cube);
+        if (direct) {
+            VkFormatProperties props;
+            vkGetPhysicalDeviceFormatProperties(vgi.phydev, format, &props);
+            direct = 0 != (props.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
+        }
+        auto & object = _textureHandles[path];
+        if (!direct) {
+            object.createFromImageProxy(path.c_str(), *_vsp, d.second.usage, ph::va::DeviceMemoryUsage::GPU_ONLY, image.proxy());
+            track(path, object);
+            continue;
+        }
+
+        auto ci = ph::va::ImageObject::CreateInfo {};
+        if (cube)
+            ci.setCube(image.width());
+        else
+            ci.set2D(image.width(), image.height());
+        ci.setLevels(desc.levels)
+            .setFormat(format)
+            .setUsage(d.second.usage | VK_IMAGE_USAGE_TRANSFER_DST_BIT)
+            .setMemoryUsage(ph::va::DeviceMemoryUsage::GPU_ONLY);
+        object.create(path.c_str(), vgi, ci);
+        track(path, object);
+
+        // With an upload budget, only the mip tail is uploaded now. The decoded pixels are kept around to upload the
+        // rest of the levels in later frames.
+        uint32_t tail = stream ? tailLevel(image) : 0;
+        if (0 == tail) {
+            pixels.push_back(std::move(image));
+            copies.push_back({&object, &pixels.back(), 0, desc.levels, true});
+        } else {
+            auto & s     = _streaming[object.image];
+            s.object     = &object;
+            s.pixels     = std::move(image);
+            s.firstLevel = tail;
+            refreshView(s);
+            copies.push_back({&object, &s.pixels, tail, desc.levels, true});
+        }
+    }
+}
+
+void TextureCache::submit(const std::vector<LevelCopy> & copies) {
+    const auto & vgi = _vsp->vgi();
+
+    // Evicted textures and replaced views go with the batch, whether or not there's anything to upload.
+    if (copies.empty() && _evictedImages.empty() && _replacedViews.empty()) return;
+    std::unique_ptr<UploadBatch> batch(new UploadBatch());
+    batch->images = std::move(_evictedImages);
+    batch->views  = std::move(_replacedViews);
+    _evictedImages.clear();
+    _replacedViews.clear();
+
+    if (!copies.empty()) {
+        // Copy regions of all planes. Buffer offsets are aligned to both the texel block size and 4 bytes.
+        struct Plane {
+            const uint8_t *   pixels;
+            size_t            size;
+            VkBufferImageCopy region;
+        };
+        std::vector<std::vector<Plane>> planes(copies.size());
+        size_t                          stagingSize = 0;
+        for (size_t i = 0; i < copies.size(); ++i) {
+            const auto & c    = copies[i];
+            const auto & desc = c.pixels->desc();
+            for (uint32_t level = c.first; level < c.end; ++level) {
+                for (uint32_t layer = 0; layer < desc.layers; ++layer) {
+                    const auto & pd     = c.pixels->desc(layer, level);
+                    const auto & ld     = pd.format.layoutDesc();
+                    size_t       align  = pd.step * 4;
+                    stagingSize         = (stagingSize + align - 1) / align * align;
+                    auto region         = VkBufferImageCopy {};
+                    region.bufferOffset = stagingSize;
+                    // Buffer row length and image height are in unit of texels, while plane pitch and slice are in bytes.
+                    region.bufferRowLength   = pd.pitch / pd.step * ld.blockWidth;
+                    region.bufferImageHeight = pd.slice / pd.pitch * ld.blockHeight;
+                    region.imageSubresource  = {VK_IMAGE_ASPECT_COLOR_BIT, level, layer, 1};
+                    region.imageExtent       = {pd.width, pd.height, 1};
+                    planes[i].push_back({c.pixels->proxy().pixel(layer, level), pd.slice, region});
+                    stagingSize += pd.slice;
+                }
+            }
+        }
+
+        // Create the command pool on first use.
+        if (!_uploadPool) {
+            auto cpci             = VkCommandPoolCreateInfo {VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+            cpci.flags            = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+            cpci.queueFamilyIndex = _vsp->queueFamilyIndex();
+            PH_VA_REQUIRE(vkCreateCommandPool(vgi.device, &cpci, vgi.allocator, _uploadPool.prepare(vgi)));
+        }
+
+        // All planes of all images go into one staging buffer.
+        batch->staging.allocate(vgi, stagingSize, "Texture Cache Staging Buffer");
+        auto mapped = batch->staging.map<uint8_t>();
+        for (const auto & p : planes) {
+            for (const auto & plane : p) memcpy(mapped.range.data() + plane.region.bufferOffset, plane.pixels, plane.size);
+        }
+        mapped.unmap();
+
+        // Record copies of all images into one command buffer. Levels that are not uploaded yet stay in transfer
+        // layout, so later copies don't have to transition them again.
+        auto cbai               = VkCommandBufferAllocateInfo {VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+        cbai.commandPool        = _uploadPool;
+        cbai.level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        cbai.commandBufferCount = 1;
+        PH_VA_REQUIRE(vkAllocateCommandBuffers(vgi.device, &cbai, &batch->cb));
+        auto cbbi  = VkCommandBufferBeginInfo {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+        cbbi.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        PH_VA_REQUIRE(vkBeginCommandBuffer(batch->cb, &cbbi));
+        std::vector<VkBufferImageCopy> regions;
+        for (size_t i = 0; i < copies.size(); ++i) {
+            const auto & c      = copies[i];
+            auto         layers = c.object->ci.arrayLayers;
+            if (c.fresh) {
+                auto all = VkImageSubresourceRange {VK_IMAGE_ASPECT_COLOR_BIT, 0, c.object->ci.mipLevels, 0, layers};
+                ph::va::setImageLayout(batch->cb, c.object->image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, all);
+            }
+            regions.clear();
+            for (const auto & p : planes[i]) regions.push_back(p.region);
+            vkCmdCopyBufferToImage(batch->cb, batch->staging.buffer, c.object->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t) regions.size(),
+                                   regions.data());
+            auto range = VkImageSubresourceRange {VK_IMAGE_ASPECT_COLOR_BIT, c.first, c.end - c.first, 0, layers};
+            ph::va::setImageLayout(batch->cb, c.object->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, range);
+        }
+        PH_VA_REQUIRE(vkEndCommandBuffer(batch->cb));
+    }
+
+    // Submit without waiting. Rendering work submitted to the same queue later sees the images in their final
+    // layout, so the textures can be handed over right away. The fence tells when the staging buffer, and the
+    // resources retired with the batch, can go.
+    auto fci = VkFenceCreateInfo {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+    PH_VA_REQUIRE(vkCreateFence(vgi.device, &fci, vgi.allocator, batch->fence.prepare(vgi)));
+    ph::va::VulkanSubmissionProxy::SubmitInfo si;
+    if (batch->cb) si.commandBuffers = {&batch->cb, 1};
+    PH_VA_REQUIRE(_vsp->submit(si, batch->fence));
+    _uploads.push_back(std::move(batch));
+}
+
+void TextureCache::handOver(std::vector<std::pair<std::string, PendingTexture>> & decoded) {
+    for (auto & d : decoded) {
+        auto                            iterator = _textureHandles.find(d.first);
+        ph::rt::Material::TextureHandle handle;
+        if (iterator != _textureHandles.end()) handle = _residency[iterator->second.image].handle;
+        for (auto & callback : d.second.callbacks) {
+            retain(handle);
+            callback(handle);
+        }
+
+        // Streamed textures call back again each time a larger level becomes resident.
+        auto s = _streaming.find(handle.image);
+        if (s != _streaming.end()) {
+            for (auto & callback : d.second.callbacks) s->second.callbacks.push_back(std::move(callback));
+        }
+    }
+}
+
+void TextureCache::handOver(VkImage image) {
+    auto s = _streaming.find(image);
+    if (s == _streaming.end()) return;
+    auto handle    = _residency[image].handle;
+    auto callbacks = s->second.callbacks;
+    if (0 == s->second.firstLevel) {
+        // All levels are resident. The texture is not streamed anymore.
+        _streaming.erase(s);
+    }
+    for (auto & callback : callbacks) callback(handle);
+}
+
+void TextureCache::completeStreaming(VkImage image) {
+    auto s = _streaming.find(image);
+    if (s == _streaming.end()) return;
+    std::vector<LevelCopy> copies = {{s->second.object, &s->second.pixels, 0, s->second.firstLevel, false}};
+    s->second.firstLevel          = 0;
+    refreshView(s->second);
+    submit(copies);
+    handOver(image);
+}
+
+void TextureCache::refreshView(Streaming & s) {
+    const auto & vgi    = _vsp->vgi();
+    const auto & object = *s.object;
+    auto &       r      = _residency[object.image];
+    if (s.view) _replacedViews.push_back(s.view);
+    if (0 == s.firstLevel) {
+        // Use the default view of the image, which covers all levels.
+        r.handle = ph::rt::Material::TextureHandle(object);
+        s.view.clear();
+        return;
+    }
+    auto ivci             = VkImageViewCreateInfo {VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
+    ivci.image            = object.image;
+    ivci.viewType         = object.viewType;
+    ivci.format           = object.ci.format;
+    ivci.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, s.firstLevel, object.ci.mipLevels - s.firstLevel, 0, object.ci.arrayLayers};
+    PH_VA_REQUIRE(vkCreateImageView(vgi.device, &ivci, vgi.allocator, s.view.prepare(vgi)));
+    r.handle = ph::rt::Material::TextureHandle(object.image, s.view, object.viewType, object.ci.format, s.pixels.width(0, s.firstLevel),
+                                               s.pixels.height(0, s.firstLevel), 1);
+}
+
+uint32_t TextureCache::tailLevel(const ph::RawImage & image) const {
+    if (0 == _uploadBudget) return 0;
+    uint32_t level = image.desc().levels - 1;
+    while (level > 0 && std::max(image.width(0, level - 1), image.height(0, level - 1)) <= MIP_TAIL_SIZE) --level;
+    return level;
+}
+
+size_t TextureCache::levelBytes(const ph::RawImage & image, uint32_t level) {
+    size_t bytes = 0;
+    for (uint32_t layer = 0; layer < image.desc().layers; ++layer) bytes += image.slice(layer, level);
+    return bytes;
+}
+
+void TextureCache::retireUploads(bool wait) {
+    const auto & vgi     = _vsp->vgi();
+    size_t       retired = 0;
+    // Batches finish in submission order. Stop at the first one that is still in flight.
+    for (; retired < _uploads.size(); ++retired) {
+        auto & batch = *_uploads[retired];
+        if (wait) {
+            PH_VA_REQUIRE(vkWaitForFences(vgi.device, 1, &batch.fence, VK_TRUE, UINT64_MAX));
+        } else if (VK_SUCCESS != vkGetFenceStatus(vgi.device, batch.fence)) {
+            break;
+        }
+        if (batch.cb) vkFreeCommandBuffers(vgi.device, _uploadPool, 1, &batch.cb);
+    }
+    _uploads.erase(_uploads.begin(), _uploads.begin() + retired);
 }
 
 std::string TextureCache::getAssetPath(const ph::rt::Material::TextureHandle & textureHandle) {
-    auto iterator = _textureHandles.begin();
-    while (iterator != _textureHandles.end()) {
-        if (ph::rt::Material::TextureHandle(iterator->second) == textureHandle) return iterator->first;
+    auto iterator = _residency.find(textureHandle.image);
+    return iterator != _residency.end() ? iterator->second.path : "";
+}
+
+void TextureCache::retain(const ph::rt::Material::TextureHandle & textureHandle) {
+    auto iterator = _residency.find(textureHandle.image);
+    if (iterator == _residency.end()) return;
+    auto & r = iterator->second;
+    if (0 == r.refCount++ && !r.path.empty()) _lru.erase(r.lru);
+}
+
+void TextureCache::release(const ph::rt::Material::TextureHandle & textureHandle) {
+    auto iterator = _residency.find(textureHandle.image);
+    if (iterator == _residency.end()) return;
+    auto & r = iterator->second;
+    if (r.refCount <= 0) {
+        PH_LOGW("Texture %s is released more times than it is retained.", r.path.c_str());
+        return;
+    }
+    if (--r.refCount > 0) return;
+    if (r.path.empty()) {
+        evict(textureHandle.image);
+    } else {
+        r.lru = _lru.insert(_lru.end(), textureHandle.image);
+        trim();
+    }
+}
+
+void TextureCache::retain(const ph::rt::Material::Desc & desc) {
+    for (const auto & m : desc.maps) retain(m);
+}
+
+void TextureCache::release(const ph::rt::Material::Desc & desc) {
+    for (const auto & m : desc.maps) release(m);
+}
+
+void TextureCache::setBudget(size_t bytes) {
+    _budget = bytes;
+    trim();
+}
+
+size_t TextureCache::residentBytes(const ph::rt::Material::TextureHandle & textureHandle) const {
+    auto iterator = _residency.find(textureHandle.image);
+    return iterator != _residency.end() ? iterator->second.bytes : 0;
+}
+
+ph::rt::Material::TextureHandle TextureCache::track(const std::string & path, const ph::va::ImageObject & image) {
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(_vsp->vgi().device, image.image, &requirements);
+
+    auto & r   = _residency[image.image];
+    r.path     = path;
+    r.handle   = ph::rt::Material::TextureHandle(image);
+    r.bytes    = requirements.size;
+    r.refCount = 0;
+    if (!path.empty()) r.lru = _lru.insert(_lru.end(), image.image);
+    _residentBytes += r.bytes;
+    return r.handle;
+}
+
+void TextureCache::trim() {
+    if (0 == _budget) return;
+    while (_residentBytes > _budget && !_lru.empty()) evict(_lru.front());
+    if (_residentBytes > _budget) {
+        PH_LOGW("Texture cache is over budget: %zu of %zu MB resident, all of them in use.", _residentBytes >> 20, _budget >> 20);
+    }
+}
+
+void TextureCache::evict(VkImage image) {
+    auto iterator = _residency.find(image);
+    if (iterator == _residency.end()) return;
+    auto & r = iterator->second;
+    // GPU might still be using the texture. It is destroyed along with the next upload batch.
+    if (r.path.empty()) {
+        auto object = std::find_if(_imageProxyHandles.begin(), _imageProxyHandles.end(), [&](const ph::va::ImageObject & o) { return o.image == image; });
+        if (object != _imageProxyHandles.end()) {
+            _evictedImages.push_back(std::move(*object));
+            _imageProxyHandles.erase(object);
+        }
+    } else {
+        if (0 == r.refCount) _lru.erase(r.lru);
+        auto s = _streaming.find(image);
+        if (s != _streaming.end()) {
+            _replacedViews.push_back(s->second.view);
+            _streaming.erase(s);
+        }
+        auto object = _textureHandles.find(r.path);
+        _evictedImages.push_back(std::move(object->second));
+        _textureHandles.erase(object);
     }
-    return "";
+    _residentBytes -= r.bytes;
+    _residency.erase(iterator);
 }
 
 ph::rt::Material::TextureHandle TextureCache::createFromImageProxy(const ph::ImageProxy & imageProxy) {
@@ -70,8 +532,11 @@ ph::rt::Material::TextureHandle TextureCache::createFromImageProxy(const ph::Ima
 
     // load from image proxy
     imageObject.createFromImageProxy("image proxy", *_vsp, VK_IMAGE_USAGE_SAMPLED_BIT, ph::va::DeviceMemoryUsage::GPU_ONLY, imageProxy);
+    auto handle = track("", imageObject);
+    retain(handle);
+    trim();
 
-    return ph::rt::Material::TextureHandle(imageObject);
+    return handle;
 }
 
 ph::rt::Material::TextureHandle TextureCache::createFromImageProxy(const ph::ImageProxy & imageProxy, std::string imageAssetPath) {
@@ -80,9 +545,12 @@ ph::rt::Material::TextureHandle TextureCache::createFromImageProxy(const ph::Ima
         return createFromImageProxy(imageProxy);
     else {
         auto itr = _textureHandles.find(imageAssetPath);
-        if (itr != _textureHandles.end())
-            return ph::rt::Material::TextureHandle(itr->second);
-        else {
+        if (itr != _textureHandles.end()) {
+            completeStreaming(itr->second.image);
+            ph::rt::Material::TextureHandle handle(itr->second);
+            retain(handle);
+            return handle;
+        } else {
             // If the image is empty.
             if (imageProxy.empty()) {
                 // Return an empty texture handle.
@@ -92,8 +560,11 @@ ph::rt::Material::TextureHandle TextureCache::createFromImageProxy(const ph::Ima
             ph::va::ImageObject & imageObject = _textureHandles[imageAssetPath];
             // load from image proxy
             imageObject.createFromImageProxy("image proxy", *_vsp, VK_IMAGE_USAGE_SAMPLED_BIT, ph::va::DeviceMemoryUsage::GPU_ONLY, imageProxy);
+            auto handle = track(imageAssetPath, imageObject);
+            retain(handle);
+            trim();
 
-            return ph::rt::Material::TextureHandle(imageObject);
+            return handle;
         }
     }
 }
@@ -179,7 +650,9 @@ ph::rt::Material::TextureHandle TextureCache::createShadowMap2D(const char * nam
 
     cmdpool.finish(cb);
 
-    return ph::rt::Material::TextureHandle(shadowMap);
+    auto handle = track("", shadowMap);
+    retain(handle);
+    return handle;
 }
 
 ph::rt::Material::TextureHandle TextureCache::createShadowMap2D(const char * name) {
@@ -228,7 +701,9 @@ ph::rt::Material::TextureHandle TextureCache::createShadowMapCube(const char * n
 
     cmdpool.finish(cb);
 
-    return ph::rt::Material::TextureHandle(shadowMap);
+    auto handle = track("", shadowMap);
+    retain(handle);
+    return handle;
 }
 
 ph::rt::Material::TextureHandle TextureCache::createShadowMapCube(const char * name) {
@@ -6,14 +6,26 @@
 
 #include <ph/rt-utils.h>
 
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
 #include <unordered_map>
 
 /// Manages loading and caching images.
+///
+/// Each handle returned by the cache holds one reference to the texture, until it is given back via release(). Textures
+/// loaded from asset paths stay cached after their last reference is released, and are evicted in least recently
+/// released order once resident textures exceed the memory budget. Textures without an asset path are destroyed as soon
+/// as their last reference is released, since nothing could look them up again.
 class TextureCache {
 public:
+    /// Callback of asynchronously loaded textures. The handle is empty, if the image failed to load.
+    typedef std::function<void(const ph::rt::Material::TextureHandle &)> TextureReady;
+
     TextureCache(ph::va::VulkanSubmissionProxy * vsp, ph::AssetSystem * assetSystem, const VkFormat defaultShadowMapFormat, uint32_t defaultShadowMapSize);
 
-    ~TextureCache() = default;
+    ~TextureCache();
 
     const std::unordered_map<std::string, ph::va::ImageObject> & textures() const { return _textureHandles; }
 
@@ -23,7 +35,80 @@ public:
     /// @return TextureHandle containing the image at the given path.
     ph::rt::Material::TextureHandle loadFromAsset(const std::string & assetPath, VkImageUsageFlagBits usage = VK_IMAGE_USAGE_SAMPLED_BIT);
 
-    /// Gets asset path for a given texture handle. Slow- should only be used outside of runtime.
+    /// Starts loading the image at the given asset path in background, and returns immediately.
+    ///
+    /// The image is decoded on the shared thread pool, and uploaded to GPU by the next update() call, together with
+    /// all other images decoded by then. Requests of the same path share one load. Once the texture is resident,
+    /// onReady is called on the thread calling update(), to swap the real texture in.
+    ///
+    /// With an upload budget, the texture is streamed: only its smallest mip levels are uploaded at first, and the
+    /// larger ones follow in later frames. onReady is called again each time a larger level becomes resident, with a
+    /// new view of the same image. All these calls share one reference to the texture.
+    ///
+    /// @param onReady Called once the texture is resident, unless cancelled by cancelCallbacks(). If the texture is
+    ///                already resident, it is called right away, before this function returns.
+    /// @return The resident texture, or an empty handle as the placeholder, which renders like a material without this
+    ///         texture map. A resident texture holds one reference, which is the same one passed to onReady.
+    ph::rt::Material::TextureHandle loadFromAssetAsync(const std::string & assetPath, TextureReady onReady,
+                                                       VkImageUsageFlagBits usage = VK_IMAGE_USAGE_SAMPLED_BIT);
+
+    /// Drops all onReady callbacks that are not called yet, and the ones that streaming would call again. Loads in
+    /// flight carry on, and their textures stay cached without reference. Call it before deleting objects that the
+    /// callbacks refer to, like materials of a scene that is being reset.
+    void cancelCallbacks();
+
+    /// Adds one reference to the texture. Does nothing if the texture is not owned by the cache.
+    void retain(const ph::rt::Material::TextureHandle & textureHandle);
+
+    /// Gives back one reference of the texture. Unreferenced textures might be evicted to meet the memory budget.
+    /// Textures that are not owned by the cache, like placeholders and empty handles, are ignored.
+    void release(const ph::rt::Material::TextureHandle & textureHandle);
+
+    /// Adds one reference to each texture map of the material.
+    void retain(const ph::rt::Material::Desc & desc);
+
+    /// Gives back one reference of each texture map of the material. Call it when the material is deleted, or when its
+    /// maps are replaced.
+    void release(const ph::rt::Material::Desc & desc);
+
+    /// Sets the budget of GPU memory used by textures of the cache, in bytes. 0 means no limit, which is the default.
+    /// Referenced textures are never evicted, so resident bytes may still go above the budget.
+    void setBudget(size_t bytes);
+
+    size_t budget() const { return _budget; }
+
+    /// GPU memory used by all textures of the cache, in bytes.
+    size_t residentBytes() const { return _residentBytes; }
+
+    /// GPU memory used by the texture, in bytes. 0 if the texture is not owned by the cache.
+    size_t residentBytes(const ph::rt::Material::TextureHandle & textureHandle) const;
+
+    /// Calls proc(const std::string & assetPath, const TextureHandle &, size_t bytes, int refCount) for each texture of
+    /// the cache. The asset path is empty for textures that are not loaded from asset paths.
+    template<typename PROC>
+    void forEachTexture(PROC && proc) const {
+        for (const auto & r : _residency) proc(r.second.path, r.second.handle, r.second.bytes, r.second.refCount);
+    }
+
+    /// Sets how many bytes of mip levels update() uploads per frame to refine streamed textures. At least one level is
+    /// uploaded per frame, regardless of the budget. 0 means no limit, and textures are uploaded with all their levels
+    /// at once, which is the default.
+    void setUploadBudget(size_t bytes);
+
+    size_t uploadBudget() const { return _uploadBudget; }
+
+    /// Number of textures with mip levels that are not resident yet.
+    size_t streamingCount() const { return _streaming.size(); }
+
+    /// Uploads all images decoded since last call in one submission, and calls their onReady callbacks. Call once
+    /// per frame from the main thread, outside of command buffer recording. Doesn't wait for GPU.
+    /// @return Number of textures that become resident.
+    size_t update();
+
+    /// Number of asynchronous loads that are not resident yet.
+    size_t pendingCount() const { return _pending.size(); }
+
+    /// Gets asset path for a given texture handle.
     /// Currently used for PBRT3 exporter.
     /// @param textureHandle TextureHandle as stored in MaterialDesc.map[*].
     /// @return Path of the original asset used to load the given textureHandle.
@@ -52,6 +137,53 @@ public:
     ph::rt::Material::TextureHandle createShadowMapCube(const char * name);
 
 private:
+    /// Residency of one texture owned by the cache.
+    struct Residency {
+        std::string                     path; ///< asset path. Empty for textures not loaded from asset paths.
+        ph::rt::Material::TextureHandle handle;
+        size_t                          bytes    = 0;
+        int                             refCount = 0;
+        std::list<VkImage>::iterator    lru;  ///< position in _lru. Valid only when refCount is 0.
+    };
+
+    /// An asynchronous load in flight.
+    struct PendingTexture {
+        std::future<ph::RawImage> image;
+        VkImageUsageFlags         usage = 0; ///< union of usage of all requests.
+        std::vector<TextureReady> callbacks;
+    };
+
+    /// A texture whose larger mip levels are not resident yet.
+    struct Streaming {
+        ph::va::ImageObject *           object = nullptr;
+        ph::RawImage                    pixels;         ///< decoded pixels of all levels.
+        uint32_t                        firstLevel = 0; ///< most detailed level that is resident.
+        ph::va::AutoHandle<VkImageView> view;           ///< view of the resident levels.
+        std::vector<TextureReady>       callbacks;
+    };
+
+    /// Copy of a range of mip levels, from decoded pixels to the image.
+    struct LevelCopy {
+        ph::va::ImageObject * object;
+        const ph::RawImage *  pixels;
+        uint32_t              first;
+        uint32_t              end;
+        bool                  fresh; ///< true if the image is just created, and all its levels are in undefined layout.
+    };
+
+    /// Staging buffer and command buffer of one upload submission, and textures retired along with it. All of them are
+    /// released once GPU is done with the submission.
+    struct UploadBatch {
+        ph::va::BufferObjectT<VK_BUFFER_USAGE_TRANSFER_SRC_BIT, ph::va::DeviceMemoryUsage::CPU_ONLY> staging;
+        VkCommandBuffer                                                                            cb = VK_NULL_HANDLE;
+        ph::va::AutoHandle<VkFence>                                                                fence;
+        std::vector<ph::va::ImageObject>                                                           images;
+        std::vector<ph::va::AutoHandle<VkImageView>>                                               views;
+    };
+
+    /// Mip levels no larger than this, in pixels, are uploaded right away when a texture is streamed.
+    static constexpr uint32_t MIP_TAIL_SIZE = 64;
+
     /// Used to load images into vulkan.
     ph::va::VulkanSubmissionProxy * const _vsp = nullptr;
 
@@ -61,9 +193,36 @@ private:
     /// Maps texture handle to all relevant info about it.
     std::unordered_map<std::string, ph::va::ImageObject> _textureHandles;
 
-    /// image objects created from ImageProxy. Keeps images stored in Vulkan until texture cache is destroyed.
+    /// image objects created from ImageProxy. Keeps images stored in Vulkan until their last reference is released.
     std::vector<ph::va::ImageObject> _imageProxyHandles;
 
+    /// Residency of all textures above, keyed by image. Also serves as the reverse index from texture to asset path.
+    std::unordered_map<VkImage, Residency> _residency;
+
+    /// Unreferenced textures with asset paths, least recently released first.
+    std::list<VkImage> _lru;
+
+    size_t _budget        = 0;
+    size_t _residentBytes = 0;
+
+    /// Asynchronous loads in flight, keyed by asset path.
+    std::unordered_map<std::string, PendingTexture> _pending;
+
+    /// Textures being streamed, keyed by image.
+    std::unordered_map<VkImage, Streaming> _streaming;
+
+    size_t _uploadBudget = 0;
+
+    /// Evicted textures and replaced views, waiting for the next upload submission, after which GPU is done with them.
+    std::vector<ph::va::ImageObject>             _evictedImages;
+    std::vector<ph::va::AutoHandle<VkImageView>> _replacedViews;
+
+    /// Command pool of upload batches. Created on first use.
+    ph::va::AutoHandle<VkCommandPool> _uploadPool;
+
+    /// Upload batches submitted to GPU, in submission order.
+    std::vector<std::unique_ptr<UploadBatch>> _uploads;
+
     VkFormat _defaultShadowMapFormat = VK_FORMAT_R16_SFLOAT;
     uint32_t _defaultShadowMapSize   = 512;
 
@@ -78,4 +237,41 @@ private:
     /// @param size Size of the shadow map.
     /// @return a texture suitable for a 3d shadow map.
     ph::rt::Material::TextureHandle createShadowMapCube(const char * name, VkFormat format, uint32_t size);
+
+    /// Starts tracking residency of a new texture, with no reference. Returns its handle.
+    ph::rt::Material::TextureHandle track(const std::string & path, const ph::va::ImageObject & image);
+
+    /// Evicts least recently released textures until resident bytes are within the budget.
+    void trim();
+
+    /// Forgets about the texture, and destroys it once GPU is done with it.
+    void evict(VkImage image);
+
+    /// Creates images of the decoded loads, and adds copies of their levels to the list. If stream is true, only the
+    /// mip tail is copied. Decoded pixels of textures that are not streamed are moved to the pixels list.
+    void prepare(std::vector<std::pair<std::string, PendingTexture>> & decoded, bool stream, std::vector<LevelCopy> & copies,
+                 std::list<ph::RawImage> & pixels);
+
+    /// Uploads all copies in one submission, along with textures and views retired since last submission.
+    void submit(const std::vector<LevelCopy> & copies);
+
+    /// Calls callbacks of the decoded loads, each with one reference to its texture.
+    void handOver(std::vector<std::pair<std::string, PendingTexture>> & decoded);
+
+    /// Calls callbacks of the streamed texture with its current view.
+    void handOver(VkImage image);
+
+    /// Uploads all remaining levels of the texture right away, if it is streamed.
+    void completeStreaming(VkImage image);
+
+    /// Recreates the view of the resident levels, and updates the texture's handle.
+    void refreshView(Streaming & s);
+
+    /// Largest level of the mip tail, which is uploaded first.
+    uint32_t tailLevel(const ph::RawImage & image) const;
+
+    static size_t levelBytes(const ph::RawImage & image, uint32_t level);
+
+    /// Releases upload batches that GPU is done with. If wait is true, waits for all of them.
+    void retireUploads(bool wait);
 };
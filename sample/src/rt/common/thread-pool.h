@@ -0,0 +1,149 @@
+/*****************************************************************************
+ * Copyright (C) 2020 - 2024 OPPO. All rights reserved.
+ *******************************************************************************/
+
+#pragma once
+
+#include <ph/base.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+/// A simple fixed size pool of worker threads.
+///
+/// The calling thread always participates in parallelFor(). So it is safe to call parallelFor() from within a job that
+/// is running on the pool itself: the call never waits on a job that has not been picked up by any thread.
+class ThreadPool {
+public:
+    /// @param threadCount Number of worker threads. 0 means one less than the number of hardware threads, since the
+    ///                    calling thread is also doing work in parallelFor().
+    explicit ThreadPool(size_t threadCount = 0) {
+        if (0 == threadCount) threadCount = std::max<size_t>(std::thread::hardware_concurrency(), 2) - 1;
+        _workers.reserve(threadCount);
+        for (size_t i = 0; i < threadCount; ++i) _workers.emplace_back([this] { proc(); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _quit = true;
+        }
+        _cv.notify_all();
+        for (auto & w : _workers) w.join();
+    }
+
+    PH_NO_COPY_NO_MOVE(ThreadPool);
+
+    /// The process wide shared thread pool.
+    static ThreadPool & shared() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    /// Number of worker threads in the pool, not counting the calling thread.
+    size_t threadCount() const { return _workers.size(); }
+
+    /// Run a job asynchronously on the pool.
+    template<typename PROC>
+    auto async(PROC && proc) -> std::future<decltype(proc())> {
+        using Result = decltype(proc());
+        auto task    = std::make_shared<std::packaged_task<Result()>>(std::forward<PROC>(proc));
+        auto future  = task->get_future();
+        push([task] { (*task)(); });
+        return future;
+    }
+
+    /// Split range [0, count) into chunks of at most grain items, and call proc(begin, end) for each chunk in parallel.
+    /// Returns after all chunks are processed. If any chunk throws, the first exception is rethrown on the calling
+    /// thread after all other chunks are done.
+    template<typename PROC>
+    void parallelFor(size_t count, size_t grain, PROC && proc) {
+        if (0 == count) return;
+        if (0 == grain) grain = 1;
+        const size_t chunks = (count + grain - 1) / grain;
+
+        // Run inline when there's nothing to split.
+        if (1 == chunks || _workers.empty()) {
+            proc((size_t) 0, count);
+            return;
+        }
+
+        // States shared by all threads working on this loop. Helper jobs might get picked up by workers after this
+        // function returns (and find nothing left to do). So the states has to be ref-counted.
+        struct Loop {
+            std::atomic<size_t>     next {0};
+            std::atomic<size_t>     done {0};
+            std::mutex              mutex;
+            std::condition_variable cv;
+            std::exception_ptr      error;
+        };
+        auto loop = std::make_shared<Loop>();
+
+        // The caller thread is blocked until all chunks are done, so it's safe to refer proc by pointer here.
+        auto runChunks = [loop, chunks, count, grain, p = &proc]() {
+            for (;;) {
+                size_t c = loop->next.fetch_add(1);
+                if (c >= chunks) break;
+                size_t begin = c * grain;
+                try {
+                    (*p)(begin, std::min(begin + grain, count));
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(loop->mutex);
+                    if (!loop->error) loop->error = std::current_exception();
+                }
+                if (loop->done.fetch_add(1) + 1 == chunks) {
+                    std::lock_guard<std::mutex> lock(loop->mutex);
+                    loop->cv.notify_all();
+                }
+            }
+        };
+
+        // Wake up helpers, then work on the chunks from the calling thread too.
+        size_t helpers = std::min(chunks - 1, _workers.size());
+        for (size_t i = 0; i < helpers; ++i) push(runChunks);
+        runChunks();
+
+        // Wait for chunks that are still in flight on other threads.
+        std::unique_lock<std::mutex> lock(loop->mutex);
+        loop->cv.wait(lock, [&] { return loop->done.load() == chunks; });
+        if (loop->error) std::rethrow_exception(loop->error);
+    }
+
+private:
+    std::vector<std::thread>          _workers;
+    std::queue<std::function<void()>> _jobs;
+    std::mutex                        _mutex;
+    std::condition_variable           _cv;
+    bool                              _quit = false;
+
+    void push(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _jobs.push(std::move(job));
+        }
+        _cv.notify_one();
+    }
+
+    void proc() {
+        for (;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cv.wait(lock, [this] { return _quit || !_jobs.empty(); });
+                if (_jobs.empty()) return; // quit
+                job = std::move(_jobs.front());
+                _jobs.pop();
+            }
+            job();
+        }
+    }
+};
@@ -28,12 +28,17 @@ struct SuzanneScene : ModelViewer {
         auto       model    = std::filesystem::path(o.model);
         if (model.empty()) {
             model     = "model/suzanne/15K.obj";
-            material  = world->createMaterial();
-            auto desc = Material::Desc {};
-            desc.setAlbedoMap(textureCache->loadFromAsset("model/suzanne/albedo-mipmapped-astc.ktx2"));
-            desc.setNormalMap(textureCache->loadFromAsset("model/suzanne/normal-astc.ktx2"));
-            desc.setOrmMap(textureCache->loadFromAsset("model/suzanne/orm-mipmapped-astc.ktx2"));
-            material->setDesc(desc);
+            material = world->createMaterial();
+            // Textures are streamed in. The material is rendered without them until they are ready.
+            textureCache->loadFromAssetAsync("model/suzanne/albedo-mipmapped-astc.ktx2", [material](const Material::TextureHandle & h) {
+                material->setDesc(Material::Desc(material->desc()).setAlbedoMap(h));
+            });
+            textureCache->loadFromAssetAsync("model/suzanne/normal-astc.ktx2", [material](const Material::TextureHandle & h) {
+                material->setDesc(Material::Desc(material->desc()).setNormalMap(h));
+            });
+            textureCache->loadFromAssetAsync("model/suzanne/orm-mipmapped-astc.ktx2", [material](const Material::TextureHandle & h) {
+                material->setDesc(Material::Desc(material->desc()).setOrmMap(h));
+            });
         } else if (std::filesystem::is_directory(model)) {
             auto gltf = searchForGLTF(model);
             if (gltf.empty()) PH_THROW("No GLTF/GLB model found in folder %s", model.string().c_str());
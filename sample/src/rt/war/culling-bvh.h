@@ -0,0 +1,222 @@
+/*****************************************************************************
+ * Copyright (C) 2020 - 2024 OPPO. All rights reserved.
+ *******************************************************************************/
+
+#pragma once
+
+#include "culling-engine.h"
+
+#include <algorithm>
+
+/// A bounding volume hierarchy over model instances collected by FrustumCullingEngine, used to cull whole groups of
+/// instances at once.
+///
+/// The tree is built top-down by median split of instance centers along the longest axis. Bounds of each node enclose
+/// the bounding spheres of all instances below it, so both frustum and distance queries can reject (or accept) a whole
+/// subtree with one test. When instances move, only the leaves that hold them and their ancestors are refitted. The
+/// tree is rebuilt when instances are added or removed.
+///
+/// Instances are reordered so that each subtree owns a contiguous range of leaf slots. Results of culling queries are
+/// stored per slot, so a rejected subtree costs one fill of its range.
+class CullingBVH {
+public:
+    /// Statistics of the last query.
+    struct Stats {
+        size_t nodes     = 0; ///< number of tree nodes in the BVH.
+        size_t visited   = 0; ///< number of tree nodes tested.
+        size_t rejected  = 0; ///< number of subtrees rejected as a whole.
+        size_t accepted  = 0; ///< number of subtrees accepted as a whole.
+        size_t instances = 0; ///< number of instances tested individually.
+        size_t refitted  = 0; ///< number of tree nodes refitted by last update() call.
+    };
+
+    /// Bring the tree up to date with the engine's instances. Call after FrustumCullingEngine::gather().
+    void update(const FrustumCullingEngine & engine) {
+        if (engine.instancesChanged() || _nodes.empty()) {
+            build(engine);
+            return;
+        }
+
+        // Mark leaves of moved instances, and all their ancestors, as dirty.
+        for (auto i : engine.updated()) {
+            uint32_t n = _leafOf[i];
+            while (n != INVALID && !_nodes[n].dirty) {
+                _nodes[n].dirty = true;
+                n               = _nodes[n].parent;
+            }
+        }
+
+        // Children always come after their parents. So a reversed walk refits children first.
+        _stats.refitted = 0;
+        for (size_t n = _nodes.size(); n-- > 0;) {
+            if (!_nodes[n].dirty) continue;
+            refit(engine, (uint32_t) n);
+            _nodes[n].dirty = false;
+            ++_stats.refitted;
+        }
+    }
+
+    /// Test all instances against the engine's current frustum, with the same visibility rule as
+    /// FrustumCullingEngine::cull(). Results are in visibility(), in the order of slots().
+    void cull(const FrustumCullingEngine & engine, const Eigen::Vector3f & camPos, float distance) {
+        resetStats();
+        _visibility.resize(_slots.size());
+        if (_nodes.empty()) return;
+
+        // Planes that fully contain the node are not tested again on its children.
+        const auto & planes = engine.planes();
+        _stack.clear();
+        _stack.push_back({0, 0x3F});
+        while (!_stack.empty()) {
+            auto [n, planeMask] = _stack.back();
+            _stack.pop_back();
+            const auto & node = _nodes[n];
+            ++_stats.visited;
+
+            // A subtree with any instance near the camera can't be rejected as a whole.
+            bool mayBeNear = node.bounds.squaredExteriorDistance(camPos) < distance * distance;
+
+            Eigen::Vector3f center = node.bounds.center();
+            Eigen::Vector3f extent = node.bounds.sizes() * 0.5f;
+            bool            outside = false;
+            for (int p = 0; p < 6 && !outside; ++p) {
+                if (!(planeMask & (1 << p))) continue;
+                float d    = planes[p].head<3>().dot(center) + planes[p].w();
+                float push = planes[p].head<3>().cwiseAbs().dot(extent);
+                if (d + push < 0.0f)
+                    outside = true;
+                else if (d - push >= 0.0f)
+                    planeMask &= ~(1 << p);
+            }
+
+            if (outside && !mayBeNear) {
+                std::fill_n(_visibility.begin() + node.first, node.count, uint8_t(0));
+                ++_stats.rejected;
+            } else if (!outside && 0 == planeMask) {
+                std::fill_n(_visibility.begin() + node.first, node.count, uint8_t(1));
+                ++_stats.accepted;
+            } else if (node.isLeaf()) {
+                for (uint32_t s = node.first; s < node.first + node.count; ++s) _visibility[s] = engine.visible(_slots[s], camPos, distance) ? 1 : 0;
+                _stats.instances += node.count;
+            } else {
+                _stack.push_back({node.right, planeMask});
+                _stack.push_back({n + 1, planeMask});
+            }
+        }
+    }
+
+    /// Call proc(instanceIndex) for each instance whose bounding sphere is within the distance to the point.
+    template<typename PROC>
+    void forEachWithinDistance(const FrustumCullingEngine & engine, const Eigen::Vector3f & point, float distance, PROC && proc) const {
+        if (_nodes.empty()) return;
+        std::vector<uint32_t> stack = {0};
+        while (!stack.empty()) {
+            uint32_t n = stack.back();
+            stack.pop_back();
+            const auto & node = _nodes[n];
+            if (node.bounds.squaredExteriorDistance(point) >= distance * distance) continue;
+            if (node.isLeaf()) {
+                for (uint32_t s = node.first; s < node.first + node.count; ++s) {
+                    size_t i = _slots[s];
+                    float  r = engine.radius(i) + distance;
+                    if ((engine.center(i) - point).squaredNorm() < r * r) proc(i);
+                }
+            } else {
+                stack.push_back(node.right);
+                stack.push_back(n + 1);
+            }
+        }
+    }
+
+    /// Instance index of each leaf slot. Instances without bounds are not in the tree.
+    const std::vector<size_t> & slots() const { return _slots; }
+
+    /// Visibility of each leaf slot, as of last cull() call. 1 means visible.
+    const std::vector<uint8_t> & visibility() const { return _visibility; }
+
+    const Stats & stats() const { return _stats; }
+
+private:
+    static constexpr uint32_t INVALID   = uint32_t(~0u);
+    static constexpr uint32_t LEAF_SIZE = 4;
+
+    struct Node {
+        Eigen::AlignedBox3f bounds;
+        uint32_t            first;  ///< first slot of the subtree.
+        uint32_t            count;  ///< number of slots of the subtree.
+        uint32_t            right;  ///< index of the right child. Left child is always the next node. INVALID for leaves.
+        uint32_t            parent; ///< INVALID for the root node.
+        bool                dirty = false;
+
+        bool isLeaf() const { return INVALID == right; }
+    };
+
+    std::vector<Node>                         _nodes;
+    std::vector<size_t>                       _slots;
+    std::vector<uint32_t>                     _leafOf; ///< leaf node of each instance. INVALID if the instance is not in the tree.
+    std::vector<uint8_t>                      _visibility;
+    std::vector<std::pair<uint32_t, uint8_t>> _stack; ///< node index and mask of planes to test.
+    Stats                                     _stats;
+
+    static Eigen::AlignedBox3f sphereBounds(const FrustumCullingEngine & engine, size_t i) {
+        Eigen::Vector3f c = engine.center(i);
+        Eigen::Vector3f r = Eigen::Vector3f::Constant(engine.radius(i));
+        return {c - r, c + r};
+    }
+
+    void resetStats() {
+        size_t refitted = _stats.refitted;
+        _stats          = {};
+        _stats.nodes    = _nodes.size();
+        _stats.refitted = refitted;
+    }
+
+    void build(const FrustumCullingEngine & engine) {
+        const auto & instances = engine.instances();
+        _slots.clear();
+        _leafOf.assign(instances.size(), INVALID);
+        for (size_t i = 0; i < instances.size(); ++i)
+            if (instances[i].hasBounds) _slots.push_back(i);
+        _nodes.clear();
+        _nodes.reserve(_slots.size() / LEAF_SIZE * 2 + 1);
+        if (!_slots.empty()) buildNode(engine, 0, (uint32_t) _slots.size(), INVALID);
+        _stats.refitted = _nodes.size();
+    }
+
+    uint32_t buildNode(const FrustumCullingEngine & engine, uint32_t first, uint32_t count, uint32_t parent) {
+        uint32_t index = (uint32_t) _nodes.size();
+        _nodes.push_back({{}, first, count, INVALID, parent});
+
+        Eigen::AlignedBox3f centers;
+        for (uint32_t s = first; s < first + count; ++s) centers.extend(engine.center(_slots[s]));
+
+        if (count <= LEAF_SIZE) {
+            for (uint32_t s = first; s < first + count; ++s) _leafOf[_slots[s]] = index;
+            refit(engine, index);
+            return index;
+        }
+
+        // Split at the median center along the longest axis.
+        int axis;
+        centers.sizes().maxCoeff(&axis);
+        uint32_t half  = count / 2;
+        auto     begin = _slots.begin() + first;
+        std::nth_element(begin, begin + half, begin + count, [&](size_t a, size_t b) { return engine.center(a)[axis] < engine.center(b)[axis]; });
+
+        buildNode(engine, first, half, index);
+        uint32_t right      = buildNode(engine, first + half, count - half, index);
+        _nodes[index].right = right;
+        refit(engine, index);
+        return index;
+    }
+
+    void refit(const FrustumCullingEngine & engine, uint32_t n) {
+        auto & node = _nodes[n];
+        if (node.isLeaf()) {
+            node.bounds.setEmpty();
+            for (uint32_t s = node.first; s < node.first + node.count; ++s) node.bounds.extend(sphereBounds(engine, _slots[s]));
+        } else {
+            node.bounds = _nodes[n + 1].bounds.merged(_nodes[node.right].bounds);
+        }
+    }
+};
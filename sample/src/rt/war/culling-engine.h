@@ -0,0 +1,219 @@
+/*****************************************************************************
+ * Copyright (C) 2020 - 2024 OPPO. All rights reserved.
+ *******************************************************************************/
+
+#pragma once
+
+#include "../common/scene-graph.h"
+
+#include <array>
+#include <limits>
+
+/// Culls all model instances of a scene graph against one camera in a single pass.
+///
+/// World space bounds of all instances are kept in SoA arrays, and only refreshed for nodes whose world transform
+/// version has changed. Frustum planes are extracted from the view projection matrix once per frame. Instances are then
+/// tested 8 at a time with fixed size Eigen arrays, which Eigen vectorizes with whatever SIMD the compiler targets: two
+/// 4-wide SSE2 or NEON packets with the default flags of this project, one AVX packet if built with -mavx. Once the
+/// arrays have grown to the size of the scene, cull() does no heap allocation.
+///
+/// An instance is visible if it is close to the camera, or if its bounds intersect the frustum. Skinned instances are
+/// tested with their bounding sphere, and static instances with their bounding box. Models without skin flag data are
+/// not culled at all. This is the same visibility rule as WarZoneCullingAlgorithm2.
+class FrustumCullingEngine {
+public:
+    static constexpr size_t PACKET_SIZE = 8;
+
+    struct Instance {
+        sg::Node *          node;
+        ph::rt::Model *     model;
+        int64_t             entity;
+        uint64_t            version;   ///< world transform version of the node, when the world bounds are calculated.
+        bool                hasBounds; ///< false if the model has no skin flag or bounding box data. Such instances are not culled.
+        Eigen::AlignedBox3f localBounds;
+    };
+
+    /// @param guidBBOX    Guid of the model's user data that stores its Eigen::AlignedBox3f bounding box.
+    /// @param guidHasSkin Guid of the model's user data that stores a bool, which is true if the model is skinned.
+    FrustumCullingEngine(Guid guidBBOX, Guid guidHasSkin): _guidBBOX(guidBBOX), _guidHasSkin(guidHasSkin) {}
+
+    /// Collect all model instances in the graph, and refresh world bounds of the ones that have moved. The graph is only
+    /// walked again when its topology has changed. Otherwise the instances of last call are reused, and nothing is done
+    /// at all if no world transform of the graph has changed either.
+    void gather(sg::Graph & graph) {
+        _updated.clear();
+        _instancesChanged = false;
+
+        uint64_t subtreeVersion = graph.root().subtreeVersion();
+        if (graph.topologyVersion() == _topologyVersion) {
+            if (subtreeVersion == _subtreeVersion) return;
+            for (size_t i = 0; i < _instances.size(); ++i) {
+                const auto & inst = _instances[i];
+                updateInstance(i, inst.node, inst.model, inst.entity);
+            }
+            _subtreeVersion = subtreeVersion;
+            return;
+        }
+
+        size_t count = 0;
+        _stack.clear();
+        _stack.push_back(&graph.root());
+        while (!_stack.empty()) {
+            auto n = _stack.back();
+            _stack.pop_back();
+            n->forEachModel([&](ph::rt::Model * model, uint64_t entity) { updateInstance(count++, n, model, (int64_t) entity); });
+            for (auto c : n->children()) _stack.push_back(c);
+        }
+        if (count != _instances.size()) _instancesChanged = true;
+        resize(count);
+        _topologyVersion = graph.topologyVersion();
+        _subtreeVersion  = subtreeVersion;
+    }
+
+    /// Extract the 6 frustum planes from the view projection matrix (clip space z in [-1, 1]). Planes are normalized,
+    /// and point to the inside of the frustum.
+    void setFrustum(const Eigen::Matrix4f & mvp) {
+        const Eigen::RowVector4f rows[]   = {mvp.row(0), mvp.row(1), mvp.row(2), mvp.row(3)};
+        const Eigen::RowVector4f planes[] = {
+            rows[3] + rows[0], // left
+            rows[3] - rows[0], // right
+            rows[3] + rows[1], // bottom
+            rows[3] - rows[1], // top
+            rows[3] + rows[2], // near
+            rows[3] - rows[2], // far
+        };
+        for (int i = 0; i < 6; ++i) _planes[i] = (planes[i] / planes[i].head<3>().norm()).transpose();
+    }
+
+    /// Test all instances against the frustum set by setFrustum(). Results are in visibility().
+    /// @param distance Instances closer to the camera than their bounding radius plus this distance are always visible.
+    void cull(const Eigen::Vector3f & camPos, float distance) {
+        using Packet = Eigen::Array<float, PACKET_SIZE, 1>;
+        using Map    = Eigen::Map<const Packet>;
+        for (size_t i = 0; i < _instances.size(); i += PACKET_SIZE) {
+            Map cx(&_centerX[i]), cy(&_centerY[i]), cz(&_centerZ[i]);
+            Map ex(&_extentX[i]), ey(&_extentY[i]), ez(&_extentZ[i]);
+            Map radius(&_radius[i]), skinned(&_skinned[i]);
+
+            // Distance test: squared distance to the camera against squared (radius + distance).
+            Packet dx         = cx - camPos.x();
+            Packet dy         = cy - camPos.y();
+            Packet dz         = cz - camPos.z();
+            Packet nearRadius = radius + distance;
+            Packet nearSlack  = nearRadius * nearRadius - (dx * dx + dy * dy + dz * dz);
+
+            // Frustum test: the smallest signed distance to any plane, pushed out by the box extent or sphere radius.
+            Packet boxSlack    = Packet::Constant(std::numeric_limits<float>::max());
+            Packet sphereSlack = Packet::Constant(std::numeric_limits<float>::max());
+            for (const auto & p : _planes) {
+                Packet d    = p.x() * cx + p.y() * cy + p.z() * cz + p.w();
+                Packet push = std::abs(p.x()) * ex + std::abs(p.y()) * ey + std::abs(p.z()) * ez;
+                boxSlack    = boxSlack.min(d + push);
+                sphereSlack = sphereSlack.min(d + radius);
+            }
+            Packet slack = skinned * sphereSlack + (1.0f - skinned) * boxSlack;
+
+            for (size_t k = 0; k < PACKET_SIZE; ++k) _visibility[i + k] = (nearSlack[k] > 0.0f || slack[k] >= 0.0f) ? 1 : 0;
+        }
+    }
+
+    /// All instances found by last gather() call.
+    const std::vector<Instance> & instances() const { return _instances; }
+
+    /// Visibility of each instance, as of last cull() call. 1 means visible.
+    const std::vector<uint8_t> & visibility() const { return _visibility; }
+
+    /// True if last gather() call found new instances, or lost some of the old ones.
+    bool instancesChanged() const { return _instancesChanged; }
+
+    /// Indices of instances whose world bounds are refreshed by last gather() call.
+    const std::vector<size_t> & updated() const { return _updated; }
+
+    /// Frustum planes set by last setFrustum() call. xyz is the normal, w is the offset.
+    const std::array<Eigen::Vector4f, 6> & planes() const { return _planes; }
+
+    // World space bounds of the instance i.
+    Eigen::Vector3f center(size_t i) const { return {_centerX[i], _centerY[i], _centerZ[i]}; }
+    Eigen::Vector3f extent(size_t i) const { return {_extentX[i], _extentY[i], _extentZ[i]}; }
+    float           radius(size_t i) const { return _radius[i]; }
+    bool            skinned(size_t i) const { return _skinned[i] != 0.0f; }
+
+    /// Same test as cull(), on one instance.
+    bool visible(size_t i, const Eigen::Vector3f & camPos, float distance) const {
+        Eigen::Vector3f c          = center(i);
+        float           nearRadius = _radius[i] + distance;
+        if ((c - camPos).squaredNorm() < nearRadius * nearRadius) return true;
+        Eigen::Vector3f e = extent(i);
+        for (const auto & p : _planes) {
+            float d    = p.head<3>().dot(c) + p.w();
+            float push = skinned(i) ? _radius[i] : p.head<3>().cwiseAbs().dot(e);
+            if (d + push < 0.0f) return false;
+        }
+        return true;
+    }
+
+private:
+    // SoA array of floats, padded to multiple of PACKET_SIZE.
+    typedef std::vector<float, Eigen::aligned_allocator<float>> FloatArray;
+
+    Guid                           _guidBBOX;
+    Guid                           _guidHasSkin;
+    uint64_t                       _topologyVersion = 0; // topology version of the graph, as of last gather() call. 0 before the first call.
+    uint64_t                       _subtreeVersion  = 0; // subtree version of the graph root, as of last gather() call.
+    std::vector<sg::Node *>        _stack;
+    std::vector<Instance>          _instances;
+    FloatArray                     _centerX, _centerY, _centerZ;
+    FloatArray                     _extentX, _extentY, _extentZ;
+    FloatArray                     _radius;
+    FloatArray                     _skinned; // 1.0 for skinned instances, 0.0 for static ones.
+    std::vector<uint8_t>           _visibility;
+    std::array<Eigen::Vector4f, 6> _planes;
+    std::vector<size_t>            _updated;
+    bool                           _instancesChanged = false;
+
+    void resize(size_t count) {
+        _instances.resize(count);
+        // Padding lanes are tested along with real instances, but their results are never read back.
+        size_t padded = (count + PACKET_SIZE - 1) / PACKET_SIZE * PACKET_SIZE;
+        for (auto a : {&_centerX, &_centerY, &_centerZ}) a->resize(padded, std::numeric_limits<float>::max());
+        for (auto a : {&_extentX, &_extentY, &_extentZ, &_radius, &_skinned}) a->resize(padded, 0.0f);
+        _visibility.resize(padded);
+    }
+
+    void updateInstance(size_t i, sg::Node * node, ph::rt::Model * model, int64_t entity) {
+        if (i >= _instances.size()) resize(i + 1);
+        auto & inst = _instances[i];
+        if (inst.node != node || inst.model != model || inst.entity != entity) {
+            // A new instance. This is the only place that reads user data of the model, since it returns a new vector.
+            _instancesChanged = true;
+            inst              = Instance {node, model, entity, 0, false, {}};
+            auto bbox         = model->userData(_guidBBOX);
+            auto skin         = model->userData(_guidHasSkin);
+            _skinned[i]       = (skin.size() >= sizeof(bool) && *(const bool *) skin.data()) ? 1.0f : 0.0f;
+            // Same as WarZoneCullingAlgorithm2, which skips models without skin flag data.
+            if (skin.size() >= sizeof(bool) && bbox.size() >= sizeof(Eigen::AlignedBox3f)) {
+                inst.hasBounds   = true;
+                inst.localBounds = *(const Eigen::AlignedBox3f *) bbox.data();
+            }
+        } else if (inst.version == node->worldTransformVersion()) {
+            return; // world bounds are up to date.
+        }
+
+        inst.version = node->worldTransformVersion();
+        if (!inst.hasBounds) return; // visibility of the instance is left to the caller.
+
+        // Transform the box center, and project the box extent onto world axes. Same result as transforming all 8
+        // corners with CullingAlgorithm::calculateWorldSpaceBoundingBox(), but much cheaper.
+        const auto &    t      = node->worldTransform();
+        Eigen::Vector3f center = t * inst.localBounds.center();
+        Eigen::Vector3f extent = t.linear().cwiseAbs() * (inst.localBounds.sizes() * 0.5f);
+        _centerX[i]            = center.x();
+        _centerY[i]            = center.y();
+        _centerZ[i]            = center.z();
+        _extentX[i]            = extent.x();
+        _extentY[i]            = extent.y();
+        _extentZ[i]            = extent.z();
+        _radius[i]             = extent.norm();
+        _updated.push_back(i);
+    }
+};
@@ -5,6 +5,8 @@
 #pragma once
 
 #include "../common/scene-graph.h"
+#include "culling-bvh.h"
+#include "visibility-cache.h"
 #include <queue>
 
 struct CullingAlgorithm {
@@ -17,11 +19,25 @@ struct CullingAlgorithm {
     // index for culling algorithm, used to switch between different algorithms
     float distanceCullingSize = 4.0f;
 
+    // receives visibility of all tested entities. Set by CullingManager.
+    VisibilityCache * visibility = nullptr;
+
     virtual ~CullingAlgorithm() = default;
 
     // culling implementation
     virtual void culling(sg::Node * node, const Eigen::Vector3f * camPos, const Eigen::Matrix4f & mvp) = 0;
 
+    // cull the whole graph. Default implementation calls culling() on each node in BFS order.
+    virtual void cullGraph(sg::Graph & graph, const Eigen::Vector3f * camPos, const Eigen::Matrix4f & mvp) {
+        graph.root().bfsTraverseNodeGraph([&](sg::Node * n) {
+            culling(n, camPos, mvp);
+            return sg::Node::TraverseAction::CONTINUE;
+        });
+    }
+
+    // one line summary of the last cullGraph() call, for display. Empty if the algorithm has nothing to report.
+    virtual std::string stats() const { return {}; }
+
     // calculate BBox transfer from local to world space
     // same function as the calculateWorldSpaceBoundingBox in gltf-scene-asset-builder
     static Eigen::AlignedBox3f calculateWorldSpaceBoundingBox(const sg::Transform & transform, const Eigen::AlignedBox3f & bbox) {
@@ -168,7 +184,8 @@ struct EmptyCullingAlgorithm : CullingAlgorithm {
     void culling(sg::Node * node, const Eigen::Vector3f * camPos, const Eigen::Matrix4f & mvp) override {
         (void) camPos;
         (void) mvp;
-        node->forEachLight([&](auto, auto entity) { node->graph().scene().setVisible(entity, true); });
+        node->forEachModel([&](auto, auto entity) { visibility->push(entity, true); });
+        node->forEachLight([&](auto, auto entity) { visibility->push(entity, true); });
     }
 };
 
@@ -194,7 +211,7 @@ struct DistanceCullingAlgorithm : CullingAlgorithm {
             // TODO: this method calculate square root, could remove this and compare square
             float radius          = radiusVector.norm();
             float camInstanceDiff = camInstanceVector.norm();
-            node->graph().scene().setVisible(entity, camInstanceDiff < radius + distanceCullingSize);
+            visibility->push(entity, camInstanceDiff < radius + distanceCullingSize);
         });
     }
 };
@@ -218,7 +235,7 @@ struct FrustumCullingAlgorithm1 : CullingAlgorithm {
             Eigen::Vector3f instanceCenter = instanceBBox.center();
             Eigen::Vector3f instanceExtent = (instanceBBox.max() - instanceBBox.min()) / 2.0f;
 
-            node->graph().scene().setVisible(entity, boundingBoxIntersectOrInsideFrustum(mvp, instanceCenter, instanceExtent));
+            visibility->push(entity, boundingBoxIntersectOrInsideFrustum(mvp, instanceCenter, instanceExtent));
         });
     }
 };
@@ -252,7 +269,7 @@ struct WarZoneCullingAlgorithm2 : CullingAlgorithm {
                 if (camInstanceDiff < radius + distanceCullingSize) { instanceVisible = true; }
             }
             if (instanceVisible) {
-                node->graph().scene().setVisible(entity, true);
+                visibility->push(entity, true);
                 return;
             }
 
@@ -266,17 +283,84 @@ struct WarZoneCullingAlgorithm2 : CullingAlgorithm {
                     instanceVisible = boundingBoxIntersectOrInsideFrustum(mvp, instanceCenter, radiusVector);
                 }
             }
-            node->graph().scene().setVisible(entity, instanceVisible);
+            visibility->push(entity, instanceVisible);
         });
     }
 };
 
+// Same visibility rule as WarZoneCullingAlgorithm2, but culls all instances of the graph in one batch with
+// FrustumCullingEngine, instead of rebuilding the frustum for each model.
+struct BatchedCullingAlgorithm : CullingAlgorithm {
+
+    BatchedCullingAlgorithm(): _engine(guidBBOX, guidHasSkin) { name = "Batched Culling"; }
+
+    void culling(sg::Node * node, const Eigen::Vector3f * camPos, const Eigen::Matrix4f & mvp) override {
+        // Everything is done in cullGraph().
+        (void) node;
+        (void) camPos;
+        (void) mvp;
+    }
+
+    void cullGraph(sg::Graph & graph, const Eigen::Vector3f * camPos, const Eigen::Matrix4f & mvp) override {
+        _engine.gather(graph);
+        _engine.setFrustum(mvp);
+        _engine.cull(*camPos, distanceCullingSize);
+
+        const auto & instances = _engine.instances();
+        const auto & visible   = _engine.visibility();
+        for (size_t i = 0; i < instances.size(); ++i) {
+            if (instances[i].hasBounds) visibility->push(instances[i].entity, 0 != visible[i]);
+        }
+    }
+
+private:
+    FrustumCullingEngine _engine;
+};
+
+// Same visibility rule as WarZoneCullingAlgorithm2, but culls groups of nearby instances together with a BVH. Subtrees
+// that are far from the camera and fully outside the frustum are hidden without testing their instances; subtrees that
+// are fully inside the frustum are shown the same way.
+struct BVHCullingAlgorithm : CullingAlgorithm {
+
+    BVHCullingAlgorithm(): _engine(guidBBOX, guidHasSkin) { name = "BVH Culling"; }
+
+    void culling(sg::Node * node, const Eigen::Vector3f * camPos, const Eigen::Matrix4f & mvp) override {
+        // Everything is done in cullGraph().
+        (void) node;
+        (void) camPos;
+        (void) mvp;
+    }
+
+    void cullGraph(sg::Graph & graph, const Eigen::Vector3f * camPos, const Eigen::Matrix4f & mvp) override {
+        _engine.gather(graph);
+        _engine.setFrustum(mvp);
+        _bvh.update(_engine);
+        _bvh.cull(_engine, *camPos, distanceCullingSize);
+
+        const auto & instances = _engine.instances();
+        const auto & slots     = _bvh.slots();
+        const auto & visible   = _bvh.visibility();
+        for (size_t s = 0; s < slots.size(); ++s) visibility->push(instances[slots[s]].entity, 0 != visible[s]);
+    }
+
+    std::string stats() const override {
+        const auto & s = _bvh.stats();
+        return ph::formatstr("nodes: %zu, visited: %zu, rejected: %zu, accepted: %zu, tested: %zu, refitted: %zu", s.nodes, s.visited, s.rejected,
+                             s.accepted, s.instances, s.refitted);
+    }
+
+private:
+    FrustumCullingEngine _engine;
+    CullingBVH           _bvh;
+};
+
 class CullingManager {
     std::vector<std::unique_ptr<CullingAlgorithm>> _algorithms;
     size_t                                         _activeAlgorithm = 0;
     sg::Graph *                                    _graph           = nullptr;
     Eigen::Vector3f                                _cameraPosition  = Eigen::Vector3f(0.f, 0.f, 0.f);
     Eigen::Matrix4f                                _projView;
+    VisibilityCache                                _visibility;
 
 public:
     CullingManager() {
@@ -284,6 +368,9 @@ public:
         _algorithms.emplace_back(new DistanceCullingAlgorithm());
         _algorithms.emplace_back(new FrustumCullingAlgorithm1());
         _algorithms.emplace_back(new WarZoneCullingAlgorithm2());
+        _algorithms.emplace_back(new BatchedCullingAlgorithm());
+        _algorithms.emplace_back(new BVHCullingAlgorithm());
+        for (auto & a : _algorithms) a->visibility = &_visibility;
     }
 
     void setCamera(Camera * cam, float displayW, float displayH) {
@@ -295,7 +382,11 @@ public:
         _projView                  = proj * viewMatrix;
     }
 
-    void setGraph(sg::Graph * graph) { _graph = graph; }
+    void setGraph(sg::Graph * graph) {
+        // entities of the old graph mean nothing to the new one.
+        if (graph != _graph) _visibility.clear();
+        _graph = graph;
+    }
 
     size_t numAlgorithms() const { return _algorithms.size(); }
 
@@ -307,24 +398,14 @@ public:
 
     float & cullingDistance() const { return _algorithms[_activeAlgorithm]->distanceCullingSize; }
 
+    // Cull the graph with the active algorithm. Only entities whose visibility has changed since last update are sent
+    // to the scene.
     void update() {
-        sg::Node & rootNode = _graph->root();
-        auto       c        = _algorithms[_activeAlgorithm].get();
-        bfsTraverseNodeGraph(&rootNode, [&](sg::Node * n) { c->culling(n, &_cameraPosition, _projView); });
+        _visibility.begin();
+        _algorithms[_activeAlgorithm]->cullGraph(*_graph, &_cameraPosition, _projView);
+        _visibility.submit(_graph->scene());
     }
 
-private:
-    template<typename PROC>
-    void bfsTraverseNodeGraph(sg::Node * root, PROC p) {
-        std::queue<sg::Node *> pending;
-        pending.push(root);
-        while (!pending.empty()) {
-            // update the queue
-            auto n = pending.front();
-            pending.pop();
-            p(n);
-
-            for (auto c : n->children()) pending.push(c);
-        }
-    }
+    // number of entities whose visibility is changed by last update() call.
+    size_t visibilityFlips() const { return _visibility.flips(); }
 };
\ No newline at end of file
@@ -0,0 +1,75 @@
+/*****************************************************************************
+ * Copyright (C) 2020 - 2024 OPPO. All rights reserved.
+ *******************************************************************************/
+
+#pragma once
+
+#include <ph/rt-scene.h>
+
+#include <vector>
+
+/// Collects entity visibility for one frame, and sends only the entities whose visibility has changed since last
+/// frame to the scene, all at once in submit().
+///
+/// Culling algorithms push the visibility of every entity they test, every frame, in their own traversal order. The
+/// cache remembers what is pushed at each position of that sequence. An entity that shows up at the same position with
+/// the same visibility as last frame is skipped. If the order changes, entities simply don't match their old position
+/// and are sent again, so the result is always correct.
+///
+/// All visibility changes of the pushed entities should go through the cache. Otherwise the scene and the cache could
+/// disagree, and the entity is not updated until its visibility flips again.
+class VisibilityCache {
+public:
+    /// Start a new frame.
+    void begin() {
+        _cursor = 0;
+        _changes.clear();
+    }
+
+    /// Set visibility of the next entity in this frame.
+    void push(int64_t entity, bool visible) {
+        if (_cursor < _state.size()) {
+            auto & s = _state[_cursor];
+            if (s.entity != entity || s.visible != visible) {
+                s = {entity, visible};
+                _changes.push_back(s);
+            }
+        } else {
+            _state.push_back({entity, visible});
+            _changes.push_back(_state.back());
+        }
+        ++_cursor;
+    }
+
+    /// Send all changes of this frame to the scene. Returns number of visibility flips.
+    size_t submit(ph::rt::Scene & scene) {
+        // Forget positions not reached this frame. So each entity has at most one record in the cache, which always
+        // matches its current visibility in the scene.
+        _state.resize(_cursor);
+        for (const auto & c : _changes) scene.setVisible(c.entity, c.visible);
+        _flips = _changes.size();
+        _changes.clear();
+        return _flips;
+    }
+
+    /// Number of visibility flips sent by last submit() call.
+    size_t flips() const { return _flips; }
+
+    /// Forget all entities. Everything pushed in the next frame is sent to the scene.
+    void clear() {
+        _state.clear();
+        _changes.clear();
+        _cursor = 0;
+    }
+
+private:
+    struct EntityVisibility {
+        int64_t entity;
+        bool    visible;
+    };
+
+    std::vector<EntityVisibility> _state;   ///< visibility pushed at each position of last frame.
+    std::vector<EntityVisibility> _changes; ///< changes of this frame, in push order.
+    size_t                        _cursor = 0;
+    size_t                        _flips  = 0;
+};
@@ -63,7 +63,7 @@ struct WarScene : ModelViewer {
         setCamera(o.animated);
 
         // setup culling parameters
-        _cullingManager.setActiveAlgorithm(3); // set to war-zone's special culling algorithm.
+        _cullingManager.setActiveAlgorithm(4); // set to batched version of war-zone's special culling algorithm.
         _cullingManager.cullingDistance() = 0.75f;
 
         // Setup light bounding box (The directional light shadow map rendering code needs it to calculate light projection matrix)
@@ -102,6 +102,7 @@ struct WarScene : ModelViewer {
         if (_cullingManager.activeAlgorithm() != 0) {
             _cullingManager.setCamera(&cameras[selectedCameraIndex], ((float) sw().initParameters().width), ((float) sw().initParameters().height));
             _cullingManager.setGraph(graph);
+            SimpleCpuFrameTimes::ScopedTimer c(app().cpuTimes(), "Culling");
             _cullingManager.update();
         }
     }
@@ -124,6 +125,9 @@ struct WarScene : ModelViewer {
                 }
                 ImGui::EndListBox();
             }
+            auto stats = _cullingManager.algorithm(_cullingManager.activeAlgorithm()).stats();
+            if (!stats.empty()) ImGui::TextWrapped("%s", stats.c_str());
+            ImGui::Text("visibility flips: %zu", _cullingManager.visibilityFlips());
             ImGui::SliderFloat("Distance Cutoff", &_cullingManager.cullingDistance(), 0.1f, 4.0f);
             ImGui::SliderFloat("camera Zfar", &cameras[0].zFar, 0.1f, 4.0f);
             if (ImGui::BeginTable("", (int) ph::rt::render::NoiseFreeRenderPack::ShadowMode::NUM_SHADOW_MODES)) {